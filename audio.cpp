@@ -19,6 +19,7 @@
 #include "file_io.h"
 #include "menu.h"
 #include "audio.h"
+#include "coeff_cache.h"
 
 static uint8_t vol_att = 0;
 static uint8_t corevol_att = 0;
@@ -28,9 +29,78 @@ static int has_filter = 0;
 static char filter_cfg_path[1024] = {};
 static char filter_cfg[1024] = {};
 
+static int parseFilter(char *buf, int size, uint16_t *words, int max)
+{
+	int line = 0;
+	int num = 0;
+
+	char *end = buf + size;
+	char *pos = buf;
+	while (pos < end && line < 9 && num + 3 <= max)
+	{
+		char *st = pos;
+		while ((pos < end) && *pos && (*pos != 10)) pos++;
+		*pos = 0;
+		while (*st == ' ' || *st == '\t' || *st == 13) st++;
+		if (*st == '#' || *st == ';' || !*st) pos++;
+		else
+		{
+			if (line == 0)
+			{
+				printf("version: %s\n", st);
+				if (strncasecmp(st, "v1", 2)) break;
+				line++;
+			}
+			else if (line == 1 || line == 3 || line == 4 || line == 5)
+			{
+				int val = 0;
+				int n = sscanf(st, "%d", &val);
+				printf("got %d values: %d\n", n, val);
+				if (n == 1)
+				{
+					words[num++] = (uint16_t)val;
+					if (line == 1) words[num++] = (uint16_t)(val >> 16);
+					line++;
+				}
+			}
+			else if (line == 2)
+			{
+				double val = 0;
+				int n = sscanf(st, "%lg", &val);
+				printf("got %d values: %g\n", n, val);
+				if (n == 1)
+				{
+					int64_t coeff = 0x8000000000 * val;
+					printf("  -> converted to: %lld\n", coeff);
+					words[num++] = (uint16_t)coeff;
+					words[num++] = (uint16_t)(coeff >> 16);
+					words[num++] = (uint16_t)(coeff >> 32);
+					line++;
+				}
+			}
+			else
+			{
+				double val = 0;
+				int n = sscanf(st, "%lg", &val);
+				printf("got %d values: %g\n", n, val);
+				if (n == 1)
+				{
+					int32_t coeff = 0x200000 * val;
+					printf("  -> converted to: %d\n", coeff);
+					words[num++] = (uint16_t)coeff;
+					words[num++] = (uint16_t)(coeff >> 16);
+					line++;
+				}
+			}
+		}
+	}
+
+	return num;
+}
+
 static void setFilter()
 {
-	fileTYPE f = {};
+	static uint16_t coeff[16];
 
 	has_filter = spi_uio_cmd(UIO_SET_AFILTER);
 	if (!has_filter) return;
@@ -38,83 +108,13 @@ static void setFilter()
 	sprintf(filter_cfg_path, AFILTER_DIR"/%s", filter_cfg + 1);
 	if(filter_cfg[0]) printf("\nLoading audio filter: %s\n", filter_cfg_path);
 
-	if (filter_cfg[0] && FileOpen(&f, filter_cfg_path))
+	int num = filter_cfg[0] ? coeff_load(filter_cfg_path, parseFilter, coeff, sizeof(coeff) / sizeof(coeff[0])) : -1;
+	if (num >= 0)
 	{
-		char *buf = (char*)malloc(f.size + 1);
-		if (buf)
-		{
-			memset(buf, 0, f.size + 1);
-			int size;
-			if ((size = FileReadAdv(&f, buf, f.size)))
-			{
-				int line = 0;
-				spi_uio_cmd_cont(UIO_SET_AFILTER);
-				spi_w((uint8_t)get_core_volume());
-
-				char *end = buf + size;
-				char *pos = buf;
-				while (pos < end && line < 9)
-				{
-					char *st = pos;
-					while ((pos < end) && *pos && (*pos != 10)) pos++;
-					*pos = 0;
-					while (*st == ' ' || *st == '\t' || *st == 13) st++;
-					if (*st == '#' || *st == ';' || !*st) pos++;
-					else
-					{
-						if (line == 0)
-						{
-							printf("version: %s\n", st);
-							if (strncasecmp(st, "v1", 2)) break;
-							line++;
-						}
-						else if (line == 1 || line == 3 || line == 4 || line == 5)
-						{
-							int val = 0;
-							int n = sscanf(st, "%d", &val);
-							printf("got %d values: %d\n", n, val);
-							if (n == 1)
-							{
-								spi_w((uint16_t)val);
-								if (line == 1) spi_w((uint16_t)(val >> 16));
-								line++;
-							}
-						}
-						else if (line == 2)
-						{
-							double val = 0;
-							int n = sscanf(st, "%lg", &val);
-							printf("got %d values: %g\n", n, val);
-							if (n == 1)
-							{
-								int64_t coeff = 0x8000000000 * val;
-								printf("  -> converted to: %lld\n", coeff);
-								spi_w((uint16_t)coeff);
-								spi_w((uint16_t)(coeff >> 16));
-								spi_w((uint16_t)(coeff >> 32));
-								line++;
-							}
-						}
-						else
-						{
-							double val = 0;
-							int n = sscanf(st, "%lg", &val);
-							printf("got %d values: %g\n", n, val);
-							if (n == 1)
-							{
-								int32_t coeff = 0x200000 * val;
-								printf("  -> converted to: %d\n", coeff);
-								spi_w((uint16_t)coeff);
-								spi_w((uint16_t)(coeff >> 16));
-								line++;
-							}
-						}
-					}
-				}
-				DisableIO();
-			}
-			free(buf);
-		}
+		spi_uio_cmd_cont(UIO_SET_AFILTER);
+		spi_w((uint8_t)get_core_volume());
+		fpga_spi_fast_block_write(coeff, num);
+		DisableIO();
 	}
 	else
 	{
@@ -0,0 +1,173 @@
+// bufops.cpp
+// Byte order and interleave kernels for bulk data.
+// Built with -mfpu=neon on ARM (see Makefile).
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "bufops.h"
+
+void bswap16_buf(void *buf, uint32_t size)
+{
+	uint8_t *p = (uint8_t*)buf;
+	uint32_t cnt = size >> 1;
+
+#ifdef __ARM_NEON
+	for (; cnt >= 8; cnt -= 8, p += 16)
+	{
+		vst1q_u8(p, vrev16q_u8(vld1q_u8(p)));
+	}
+#endif
+
+	for (; cnt; cnt--, p += 2)
+	{
+		uint8_t tmp = p[0];
+		p[0] = p[1];
+		p[1] = tmp;
+	}
+}
+
+void bswap32_buf(uint32_t *buf, uint32_t count)
+{
+#ifdef __ARM_NEON
+	for (; count >= 4; count -= 4, buf += 4)
+	{
+		vst1q_u8((uint8_t*)buf, vrev32q_u8(vld1q_u8((uint8_t*)buf)));
+	}
+#endif
+
+	for (; count; count--, buf++) *buf = __builtin_bswap32(*buf);
+}
+
+void bswap_mid32_buf(uint32_t *buf, uint32_t count)
+{
+#ifdef __ARM_NEON
+	static const uint8_t idx[8] = { 0, 2, 1, 3, 4, 6, 5, 7 };
+	uint8x8_t tbl = vld1_u8(idx);
+
+	for (; count >= 4; count -= 4, buf += 4)
+	{
+		uint8x16_t v = vld1q_u8((uint8_t*)buf);
+		v = vcombine_u8(vtbl1_u8(vget_low_u8(v), tbl), vtbl1_u8(vget_high_u8(v), tbl));
+		vst1q_u8((uint8_t*)buf, v);
+	}
+#endif
+
+	for (; count; count--, buf++) *buf = (*buf & 0xFF0000FF) | ((*buf & 0xFF00) << 8) | ((*buf & 0xFF0000) >> 8);
+}
+
+void interleave8_buf(uint8_t *dst, const uint8_t *a, const uint8_t *b, uint32_t count)
+{
+#ifdef __ARM_NEON
+	for (; count >= 16; count -= 16, a += 16, b += 16, dst += 32)
+	{
+		uint8x16x2_t v = { { vld1q_u8(a), vld1q_u8(b) } };
+		vst2q_u8(dst, v);
+	}
+#endif
+
+	for (; count; count--)
+	{
+		*dst++ = *a++;
+		*dst++ = *b++;
+	}
+}
+
+void interleave16_buf(uint16_t *dst, const uint16_t *a, const uint16_t *b, uint32_t count)
+{
+#ifdef __ARM_NEON
+	for (; count >= 8; count -= 8, a += 8, b += 8, dst += 16)
+	{
+		uint16x8x2_t v = { { vld1q_u16(a), vld1q_u16(b) } };
+		vst2q_u16(dst, v);
+	}
+#endif
+
+	for (; count; count--)
+	{
+		*dst++ = *a++;
+		*dst++ = *b++;
+	}
+}
+
+void interleave32_buf(uint32_t *dst, const uint32_t *a, const uint32_t *b, uint32_t count)
+{
+#ifdef __ARM_NEON
+	for (; count >= 4; count -= 4, a += 4, b += 4, dst += 8)
+	{
+		uint32x4x2_t v = { { vld1q_u32(a), vld1q_u32(b) } };
+		vst2q_u32(dst, v);
+	}
+#endif
+
+	for (; count; count--)
+	{
+		*dst++ = *a++;
+		*dst++ = *b++;
+	}
+}
+
+void wswap32_buf(uint32_t *buf, uint32_t count)
+{
+#ifdef __ARM_NEON
+	for (; count >= 4; count -= 4, buf += 4)
+	{
+		vst1q_u16((uint16_t*)buf, vrev32q_u16(vld1q_u16((uint16_t*)buf)));
+	}
+#endif
+
+	for (; count; count--, buf++) *buf = (*buf << 16) | (*buf >> 16);
+}
+
+void shuffle32_buf(uint8_t *dst, const uint8_t *src, const uint8_t *tbl, uint32_t size)
+{
+#ifdef __ARM_NEON
+	uint8x8_t idx0 = vld1_u8(tbl);
+	uint8x8_t idx1 = vld1_u8(tbl + 8);
+	uint8x8_t idx2 = vld1_u8(tbl + 16);
+	uint8x8_t idx3 = vld1_u8(tbl + 24);
+
+	for (; size >= 32; size -= 32, src += 32, dst += 32)
+	{
+		uint8x8x4_t v = { { vld1_u8(src), vld1_u8(src + 8), vld1_u8(src + 16), vld1_u8(src + 24) } };
+		vst1_u8(dst, vtbl4_u8(v, idx0));
+		vst1_u8(dst + 8, vtbl4_u8(v, idx1));
+		vst1_u8(dst + 16, vtbl4_u8(v, idx2));
+		vst1_u8(dst + 24, vtbl4_u8(v, idx3));
+	}
+#else
+	for (; size >= 32; size -= 32, src += 32, dst += 32)
+	{
+		for (int i = 0; i < 32; i++) dst[i] = src[tbl[i]];
+	}
+#endif
+}
+
+void scatter8_buf(uint8_t *dst, const uint8_t *src, uint32_t count, uint32_t step)
+{
+#ifdef __ARM_NEON
+	// vld2/vld4 also read the bytes between the targets, so stop one
+	// element early to never touch memory past the last one.
+	if (step == 2)
+	{
+		for (; count > 16; count -= 16, src += 16, dst += 32)
+		{
+			uint8x16x2_t v = vld2q_u8(dst);
+			v.val[0] = vld1q_u8(src);
+			vst2q_u8(dst, v);
+		}
+	}
+	else if (step == 4)
+	{
+		for (; count > 16; count -= 16, src += 16, dst += 64)
+		{
+			uint8x16x4_t v = vld4q_u8(dst);
+			v.val[0] = vld1q_u8(src);
+			vst4q_u8(dst, v);
+		}
+	}
+#endif
+
+	for (; count; count--, dst += step) *dst = *src++;
+}
@@ -0,0 +1,35 @@
+// bufops.h
+// Byte order and interleave kernels for bulk data (CD audio, ROM images).
+// NEON versions are used when available, portable C otherwise.
+
+#ifndef BUFOPS_H
+#define BUFOPS_H
+
+#include <stdint.h>
+
+// swap bytes of every 16-bit word. size in bytes (odd tail byte is kept).
+void bswap16_buf(void *buf, uint32_t size);
+
+// swap bytes of every 32-bit word. count in words.
+void bswap32_buf(uint32_t *buf, uint32_t count);
+
+// swap two middle bytes of every 32-bit word (ABCD -> ACBD). count in words.
+void bswap_mid32_buf(uint32_t *buf, uint32_t count);
+
+// dst = a0 b0 a1 b1 ... count is number of elements in each source.
+void interleave8_buf(uint8_t *dst, const uint8_t *a, const uint8_t *b, uint32_t count);
+void interleave16_buf(uint16_t *dst, const uint16_t *a, const uint16_t *b, uint32_t count);
+void interleave32_buf(uint32_t *dst, const uint32_t *a, const uint32_t *b, uint32_t count);
+
+// swap 16-bit halves of every 32-bit word. count in words.
+void wswap32_buf(uint32_t *buf, uint32_t count);
+
+// reorder bytes inside every 32-byte block: dst[i] = src[tbl[i]].
+// size in bytes, multiple of 32.
+void shuffle32_buf(uint8_t *dst, const uint8_t *src, const uint8_t *tbl, uint32_t size);
+
+// dst[i*step] = src[i], other bytes of dst are kept. count in source bytes.
+// NEON path for step 2 and 4.
+void scatter8_buf(uint8_t *dst, const uint8_t *src, uint32_t count, uint32_t step);
+
+#endif
@@ -81,6 +81,11 @@ static const ini_var_t ini_vars[] =
 	{ "SPINNER_THROTTLE", (void*)(&(cfg.spinner_throttle)), INT32, -10000, 10000 },
 	{ "AFILTER_DEFAULT", (void*)(&(cfg.afilter_default)), STRING, 0, sizeof(cfg.afilter_default) - 1 },
 	{ "VFILTER_DEFAULT", (void*)(&(cfg.vfilter_default)), STRING, 0, sizeof(cfg.vfilter_default) - 1 },
+	{ "CHD_CACHE_MB", (void*)(&(cfg.chd_cache_mb)), UINT16, 0, 256 },
+	{ "ROM_CACHE_MB", (void*)(&(cfg.rom_cache_mb)), UINT16, 0, 4096 },
+	{ "INPUT_THREAD", (void*)(&(cfg.input_thread)), UINT8, 0, 1 },
+	{ "FAST_CORE_SWITCH", (void*)(&(cfg.fast_core_switch)), UINT8, 0, 1 },
+	{ "RBF_CACHE_MB", (void*)(&(cfg.rbf_cache_mb)), UINT16, 0, 256 },
 };
 
 static const int nvars = (int)(sizeof(ini_vars) / sizeof(ini_var_t));
@@ -331,5 +336,6 @@ void cfg_parse()
 	cfg.controller_info = 6;
 	cfg.browse_expand = 1;
 	cfg.logo = 1;
+	cfg.chd_cache_mb = 16;
 	ini_parse(altcfg());
 }
@@ -50,6 +50,11 @@ typedef struct {
 	uint8_t sniper_mode;
 	uint8_t browse_expand;
 	uint8_t logo;
+	uint16_t chd_cache_mb;
+	uint16_t rom_cache_mb;
+	uint8_t input_thread;
+	uint8_t fast_core_switch;
+	uint16_t rbf_cache_mb;
 	char bootcore[256];
 	char video_conf[1024];
 	char video_conf_pal[1024];
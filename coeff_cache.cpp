@@ -0,0 +1,108 @@
+// coeff_cache.cpp
+// Compiled cache of the text coefficient files.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "file_io.h"
+#include "coeff_cache.h"
+
+#define COEFF_CACHE_DIR "/tmp/coeff_cache"
+
+struct cc_header
+{
+	char     magic[4];
+	uint32_t words;
+	uint64_t size;
+	int64_t  mtime;
+	char     path[1024];
+};
+
+// tmpfs: survives core reloads, gone after reboot
+static const char *entry_path(const char *path)
+{
+	static char name[256];
+
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	while (*path) hash = (hash ^ (uint8_t)*path++) * 16777619u;
+
+	snprintf(name, sizeof(name), "%s/%08x.bin", COEFF_CACHE_DIR, hash);
+	return name;
+}
+
+static int cache_read(const cc_header *key, uint16_t *words, int max)
+{
+	int fd = open(entry_path(key->path), O_RDONLY);
+	if (fd < 0) return -1;
+
+	cc_header hdr;
+	int num = -1;
+	if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && !memcmp(hdr.magic, key->magic, 4) &&
+		hdr.size == key->size && hdr.mtime == key->mtime && !strcmp(hdr.path, key->path) && hdr.words <= (uint32_t)max)
+	{
+		int len = hdr.words * sizeof(uint16_t);
+		if (read(fd, words, len) == len) num = hdr.words;
+	}
+
+	close(fd);
+	return num;
+}
+
+static void cache_write(cc_header *key, const uint16_t *words, int num)
+{
+	mkdir(COEFF_CACHE_DIR, S_IRWXU | S_IRWXG | S_IRWXO);
+
+	char tmp[300];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", entry_path(key->path));
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
+	if (fd < 0) return;
+
+	key->words = num;
+	int len = num * sizeof(uint16_t);
+	int ok = write(fd, key, sizeof(cc_header)) == sizeof(cc_header) && write(fd, words, len) == len;
+	close(fd);
+
+	// rename keeps a half written entry from ever being used
+	if (!ok || rename(tmp, entry_path(key->path))) unlink(tmp);
+}
+
+int coeff_load(const char *path, coeff_parse_t parse, uint16_t *words, int max)
+{
+	cc_header key = {};
+	memcpy(key.magic, "MCC1", 4);
+	snprintf(key.path, sizeof(key.path), "%s", getFullPath(path));
+
+	// no stat (e.g. inside a zip): parse every time
+	struct stat64 *st = getPathStat(path);
+	if (st)
+	{
+		key.size = st->st_size;
+		key.mtime = st->st_mtime;
+
+		int num = cache_read(&key, words, max);
+		if (num >= 0) return num;
+	}
+
+	fileTYPE f = {};
+	if (!FileOpen(&f, path)) return -1;
+
+	int num = -1;
+	char *buf = (char*)malloc(f.size + 1);
+	if (buf)
+	{
+		memset(buf, 0, f.size + 1);
+		int size = FileReadAdv(&f, buf, f.size);
+		if (size) num = parse(buf, size, words, max);
+		free(buf);
+	}
+	FileClose(&f);
+
+	if (num >= 0 && st) cache_write(&key, words, num);
+	return num;
+}
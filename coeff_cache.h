@@ -0,0 +1,17 @@
+// coeff_cache.h
+// Compiled cache of the text coefficient files (scaler, gamma, audio filter).
+// The SPI words a file parses to are kept in /tmp keyed by path, size and
+// mtime, so the file is only parsed again after it has changed.
+
+#ifndef COEFF_CACHE_H
+#define COEFF_CACHE_H
+
+#include <stdint.h>
+
+// text is zero terminated and may be modified. Returns the number of words.
+typedef int (*coeff_parse_t)(char *text, int size, uint16_t *words, int max);
+
+// number of words in words[], -1 if the file can't be read
+int coeff_load(const char *path, coeff_parse_t parse, uint16_t *words, int max);
+
+#endif
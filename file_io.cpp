@@ -7,12 +7,14 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <dirent.h>
 #include <ctype.h>
 #include <sys/vfs.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <sys/mount.h>
+#include <pthread.h>
 #include <linux/magic.h>
 #include <algorithm>
 #include <vector>
@@ -32,15 +34,30 @@
 
 #define MIN(a,b) (((a)<(b)) ? (a) : (b))
 
-typedef std::vector<direntext_t> DirentVector;
+// File list is kept compact: fixed size entries with names in a string pool.
+// direntext_t is built on request for the few visible items only.
+struct flistEntry
+{
+	uint32_t name;      // offsets in DirStr
+	uint32_t altname;
+	uint32_t datecode;
+	int      cookie;
+	uint8_t  type;
+};
 
 static const size_t YieldIterations = 128;
 
-DirentVector DirItem;
+static std::vector<flistEntry> DirItem;
+static std::vector<char> DirStr;
+
+#define FLIST_VIEW_SIZE 64
+static direntext_t flist_view[FLIST_VIEW_SIZE];
+static int flist_view_idx[FLIST_VIEW_SIZE];
 static int iSelectedEntry = 0;       // selected entry index
 static int iFirstEntry = 0;
 
-static char full_path[2100];
+// per thread: path helpers are also used by startup workers
+static __thread char full_path[2100];
 uint8_t loadbuf[LOADBUF_SZ];
 
 fileTYPE::fileTYPE()
@@ -63,14 +80,113 @@ int fileTYPE::opened()
 	return filp || zip;
 }
 
+// Inflate state captured while reading a zipped file forward,
+// so backward seeks resume from here instead of from the start.
+struct zipSeekPoint
+{
+	__off64_t                        offset;
+	mz_zip_reader_extract_iter_state state;
+	uint8_t                          dict[TINFL_LZ_DICT_SIZE];
+	uint8_t                         *input;  // unconsumed part of the read buffer
+};
+
+#define ZIP_SEEK_POINTS_MAX  64
+#define ZIP_SEEK_STEP_MIN    (1024*1024)
+
 struct fileZipArchive
 {
 	mz_zip_archive                    archive;
 	int                               index;
 	mz_zip_reader_extract_iter_state* iter;
 	__off64_t                         offset;
+	std::vector<zipSeekPoint*>        points;
+	__off64_t                         step;
 };
 
+static void zip_free_points(fileZipArchive *z)
+{
+	for (zipSeekPoint *p : z->points)
+	{
+		free(p->input);
+		delete p;
+	}
+	z->points.clear();
+}
+
+static void zip_add_point(fileZipArchive *z)
+{
+	mz_zip_reader_extract_iter_state *it = z->iter;
+
+	// stored files are seeked directly
+	if (!it->file_stat.m_method || !it->pWrite_buf) return;
+	if (it->status < 0) return;
+
+	if (!z->step)
+	{
+		z->step = it->file_stat.m_uncomp_size / ZIP_SEEK_POINTS_MAX;
+		if (z->step < ZIP_SEEK_STEP_MIN) z->step = ZIP_SEEK_STEP_MIN;
+	}
+
+	__off64_t last = z->points.empty() ? 0 : z->points.back()->offset;
+	if (z->offset < last + z->step) return;
+
+	zipSeekPoint *p = new zipSeekPoint;
+	p->offset = z->offset;
+	p->state = *it;
+	p->input = 0;
+	memcpy(p->dict, it->pWrite_buf, TINFL_LZ_DICT_SIZE);
+	if (it->read_buf_avail)
+	{
+		p->input = (uint8_t*)malloc(it->read_buf_avail);
+		if (!p->input)
+		{
+			delete p;
+			return;
+		}
+		memcpy(p->input, (uint8_t*)it->pRead_buf + it->read_buf_ofs, it->read_buf_avail);
+	}
+
+	z->points.push_back(p);
+}
+
+// Move the iterator as close as possible to offset without inflating.
+static void zip_seek_fast(fileZipArchive *z, __off64_t offset)
+{
+	mz_zip_reader_extract_iter_state *it = z->iter;
+
+	if (!it->file_stat.m_method)
+	{
+		if (offset > (__off64_t)it->file_stat.m_uncomp_size) return;
+
+		__off64_t delta = offset - (__off64_t)it->out_buf_ofs;
+		it->cur_file_ofs += delta;
+		it->comp_remaining -= delta;
+		it->out_buf_ofs = offset;
+		z->offset = offset;
+		return;
+	}
+
+	zipSeekPoint *best = 0;
+	for (zipSeekPoint *p : z->points)
+	{
+		if (p->offset > offset) break;
+		best = p;
+	}
+
+	if (!best || (best->offset <= z->offset && z->offset <= offset)) return;
+
+	void *rbuf = it->pRead_buf;
+	void *wbuf = it->pWrite_buf;
+
+	*it = best->state;
+	it->pRead_buf = rbuf;
+	it->pWrite_buf = wbuf;
+	memcpy(wbuf, best->dict, TINFL_LZ_DICT_SIZE);
+	if (best->input) memcpy((uint8_t*)rbuf + it->read_buf_ofs, best->input, it->read_buf_avail);
+
+	z->offset = best->offset;
+}
+
 static int FileIsZipped(char* path, char** zip_path, char** file_path)
 {
 	char* z = strcasestr(path, ".zip");
@@ -225,6 +341,7 @@ void FileClose(fileTYPE *file)
 		{
 			mz_zip_reader_extract_iter_free(file->zip->iter);
 		}
+		zip_free_points(file->zip);
 		mz_zip_reader_end(&file->zip->archive);
 
 		delete file->zip;
@@ -502,6 +619,8 @@ int FileSeek(fileTYPE *file, __off64_t offset, int origin)
 			offset = file->size - offset;
 		}
 
+		zip_seek_fast(file->zip, offset);
+
 		if (offset < file->zip->offset)
 		{
 			mz_zip_reader_extract_iter_state *iter = mz_zip_reader_extract_iter_new(&file->zip->archive, file->zip->index, 0);
@@ -523,6 +642,7 @@ int FileSeek(fileTYPE *file, __off64_t offset, int origin)
 			const size_t want_len = MIN((__off64_t)sizeof(buf), offset - file->zip->offset);
 			const size_t read_len = mz_zip_reader_extract_iter_read(file->zip->iter, buf, want_len);
 			file->zip->offset += read_len;
+			zip_add_point(file->zip);
 			if (read_len < want_len)
 			{
 				printf("FileSeek(mz_zip_reader_extract_iter_read) Failed to advance iterator, error:%s\n",
@@ -571,6 +691,7 @@ int FileReadAdv(fileTYPE *file, void *pBuffer, int length, int failres)
 			return failres;
 		}
 		file->zip->offset += ret;
+		zip_add_point(file->zip);
 	}
 	else
 	{
@@ -587,6 +708,141 @@ int FileReadSec(fileTYPE *file, void *pBuffer)
 	return FileReadAdv(file, pBuffer, 512);
 }
 
+#define READAHEAD_BUFS 3
+
+struct fileReadAhead
+{
+	fileTYPE       *file;
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	uint8_t        *buf[READAHEAD_BUFS];
+	int             len[READAHEAD_BUFS];
+	int             block;
+	__off64_t       remain;
+	int             wr, rd;
+	int             filled;  // blocks ready for the consumer
+	int             held;    // consumer still uses block rd
+	int             stop;
+	int             done;
+	int             error;   // read failed, reported after the blocks already read
+};
+
+static void *readahead_thread(void *arg)
+{
+	fileReadAhead *ra = (fileReadAhead*)arg;
+
+	pthread_mutex_lock(&ra->lock);
+	while (1)
+	{
+		while (!ra->stop && ra->remain && (ra->filled + ra->held) >= READAHEAD_BUFS) pthread_cond_wait(&ra->cond, &ra->lock);
+		if (ra->stop || !ra->remain) break;
+
+		int idx = ra->wr;
+		int chunk = (ra->remain > ra->block) ? ra->block : (int)ra->remain;
+		pthread_mutex_unlock(&ra->lock);
+
+		int ret = FileReadAdv(ra->file, ra->buf[idx], chunk, -1);
+		if (ret >= 0 && ret < chunk && ra->file->filp && ferror(ra->file->filp)) ret = -1;
+
+		pthread_mutex_lock(&ra->lock);
+		if (ret < 0) ra->error = 1;
+		if (ret <= 0) break;
+
+		ra->len[idx] = ret;
+		ra->remain = (ret < chunk) ? 0 : ra->remain - ret;
+		ra->wr = (idx + 1) % READAHEAD_BUFS;
+		ra->filled++;
+		pthread_cond_broadcast(&ra->cond);
+	}
+
+	ra->done = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+	return NULL;
+}
+
+fileReadAhead *FileReadAheadStart(fileTYPE *file, __off64_t size, int block)
+{
+	if (size <= 0) return 0;
+	if (block > size) block = (int)size;
+
+	fileReadAhead *ra = new fileReadAhead{};
+	ra->file = file;
+	ra->block = block;
+	ra->remain = size;
+
+	for (int i = 0; i < READAHEAD_BUFS; i++)
+	{
+		ra->buf[i] = (uint8_t*)malloc(block);
+		if (!ra->buf[i])
+		{
+			printf("FileReadAheadStart: cannot allocate %d bytes.\n", block);
+			for (int n = 0; n < i; n++) free(ra->buf[n]);
+			delete ra;
+			return 0;
+		}
+	}
+
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+
+	if (pthread_create(&ra->thread, NULL, readahead_thread, ra))
+	{
+		printf("FileReadAheadStart: cannot create thread.\n");
+		pthread_cond_destroy(&ra->cond);
+		pthread_mutex_destroy(&ra->lock);
+		for (int i = 0; i < READAHEAD_BUFS; i++) free(ra->buf[i]);
+		delete ra;
+		return 0;
+	}
+
+	return ra;
+}
+
+int FileReadAheadGet(fileReadAhead *ra, uint8_t **buf)
+{
+	pthread_mutex_lock(&ra->lock);
+
+	if (ra->held)
+	{
+		ra->rd = (ra->rd + 1) % READAHEAD_BUFS;
+		ra->held = 0;
+		pthread_cond_broadcast(&ra->cond);
+	}
+
+	while (!ra->filled && !ra->done) pthread_cond_wait(&ra->cond, &ra->lock);
+
+	int len = ra->error ? -1 : 0;
+	if (ra->filled)
+	{
+		ra->filled--;
+		ra->held = 1;
+		*buf = ra->buf[ra->rd];
+		len = ra->len[ra->rd];
+	}
+
+	pthread_mutex_unlock(&ra->lock);
+	return len;
+}
+
+void FileReadAheadStop(fileReadAhead *ra)
+{
+	if (!ra) return;
+
+	pthread_mutex_lock(&ra->lock);
+	ra->stop = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+
+	pthread_join(ra->thread, NULL);
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->lock);
+
+	for (int i = 0; i < READAHEAD_BUFS; i++) free(ra->buf[i]);
+	delete ra;
+}
+
 // Write with offset advancing
 int FileWriteAdv(fileTYPE *file, void *pBuffer, int length, int failres)
 {
@@ -1092,9 +1348,48 @@ void FindStorage(void)
 	else if (ENOENT == errno) mkdir(full_path, S_IRWXU | S_IRWXG | S_IRWXO);
 }
 
+static inline const char *flist_str(uint32_t ofs)
+{
+	return DirStr.data() + ofs;
+}
+
+static uint32_t flist_addstr(const char *str)
+{
+	if (!*str) return 0;
+
+	uint32_t ofs = DirStr.size();
+	DirStr.insert(DirStr.end(), str, str + strlen(str) + 1);
+	return ofs;
+}
+
+static void flist_invalidate_view()
+{
+	for (int i = 0; i < FLIST_VIEW_SIZE; i++) flist_view_idx[i] = -1;
+}
+
+static void flist_clear()
+{
+	DirItem.clear();
+	DirStr.assign(1, 0);
+	flist_invalidate_view();
+}
+
+static void flist_push(const direntext_t *dext)
+{
+	if (DirStr.empty()) DirStr.assign(1, 0);
+
+	flistEntry item;
+	item.name = flist_addstr(dext->de.d_name);
+	item.altname = flist_addstr(dext->altname);
+	item.datecode = flist_addstr(dext->datecode);
+	item.cookie = dext->cookie;
+	item.type = dext->de.d_type;
+	DirItem.push_back(item);
+}
+
 struct DirentComp
 {
-	bool operator()(const direntext_t& de1, const direntext_t& de2)
+	bool operator()(const flistEntry& e1, const flistEntry& e2)
 	{
 
 #ifdef USE_SCHEDULER
@@ -1104,22 +1399,25 @@ struct DirentComp
 		}
 #endif
 
-		if ((de1.de.d_type == DT_DIR) && !strcmp(de1.altname, "..")) return true;
-		if ((de2.de.d_type == DT_DIR) && !strcmp(de2.altname, "..")) return false;
+		const char *alt1 = flist_str(e1.altname);
+		const char *alt2 = flist_str(e2.altname);
 
-		if ((de1.de.d_type == DT_DIR) && (de2.de.d_type != DT_DIR)) return true;
-		if ((de1.de.d_type != DT_DIR) && (de2.de.d_type == DT_DIR)) return false;
+		if ((e1.type == DT_DIR) && !strcmp(alt1, "..")) return true;
+		if ((e2.type == DT_DIR) && !strcmp(alt2, "..")) return false;
 
-		int len1 = strlen(de1.altname);
-		int len2 = strlen(de2.altname);
-		if ((len1 > 4) && (de1.altname[len1 - 4] == '.')) len1 -= 4;
-		if ((len2 > 4) && (de2.altname[len2 - 4] == '.')) len2 -= 4;
+		if ((e1.type == DT_DIR) && (e2.type != DT_DIR)) return true;
+		if ((e1.type != DT_DIR) && (e2.type == DT_DIR)) return false;
+
+		int len1 = strlen(alt1);
+		int len2 = strlen(alt2);
+		if ((len1 > 4) && (alt1[len1 - 4] == '.')) len1 -= 4;
+		if ((len2 > 4) && (alt2[len2 - 4] == '.')) len2 -= 4;
 
 		int len = (len1 < len2) ? len1 : len2;
-		int ret = strncasecmp(de1.altname, de2.altname, len);
+		int ret = strncasecmp(alt1, alt2, len);
 		if (!ret)
 		{
-			ret = strcasecmp(de1.datecode, de2.datecode);
+			ret = strcasecmp(flist_str(e1.datecode), flist_str(e2.datecode));
 			if (!ret)
 			{
 				return len1 < len2;
@@ -1248,6 +1546,219 @@ static void get_display_name(direntext_t *dext, const char *ext, int options)
 	if (fext) *fext = 0;
 }
 
+// Sorted listings of large folders are kept in config/dircache,
+// valid as long as mtime and size of the folder (or zip file) are unchanged.
+// FAT/exFAT don't reliably update the mtime of a folder, so for folders the
+// names are also read (no stat, no sort) and their count and hash compared.
+// Least recently used lists are removed above DIRCACHE_FILES or DIRCACHE_SIZE.
+#define DIRCACHE_DIR   "dircache"
+#define DIRCACHE_MAGIC 0x32434944 // DIC2
+#define DIRCACHE_MIN   256
+#define DIRCACHE_FILES 64
+#define DIRCACHE_SIZE  (8 * 1024 * 1024)
+
+struct dircache_sum
+{
+	uint32_t entries;
+	uint32_t names;   // sum of the name hashes, readdir order doesn't matter
+};
+
+struct dircache_hdr
+{
+	uint32_t magic;
+	uint32_t count;
+	dircache_sum sum;
+	int64_t  mtime_sec;
+	int64_t  mtime_nsec;
+	int64_t  size;
+	char     key[1024 + 256];
+};
+
+static uint32_t dircache_hash(const char *str)
+{
+	uint32_t hash = 2166136261u;
+	while (*str) hash = (hash ^ (uint8_t)*str++) * 16777619u;
+	return hash;
+}
+
+static const char *dircache_name(const char *key)
+{
+	static char name[64];
+	sprintf(name, DIRCACHE_DIR "/%08X.bin", dircache_hash(key));
+	return name;
+}
+
+static int dircache_sum_dir(const char *path, dircache_sum *sum)
+{
+	memset(sum, 0, sizeof(dircache_sum));
+
+	DIR *d = opendir(path);
+	if (!d) return 0;
+
+	struct dirent64 *de;
+	while ((de = readdir64(d)))
+	{
+		sum->entries++;
+		sum->names += dircache_hash(de->d_name);
+
+#ifdef USE_SCHEDULER
+		if (sum->entries % YieldIterations == 0) scheduler_yield();
+#endif
+	}
+
+	closedir(d);
+	return 1;
+}
+
+static int dircache_load(const char *key, struct stat64 *st, dircache_sum *sum)
+{
+	const char *name = dircache_name(key);
+	int size = FileLoadConfig(name, 0, 0);
+	if (size <= (int)sizeof(dircache_hdr)) return 0;
+
+	uint8_t *buf = (uint8_t*)malloc(size);
+	if (!buf) return 0;
+
+	int ret = 0;
+	dircache_hdr *hdr = (dircache_hdr*)buf;
+	if (FileLoadConfig(name, buf, size) == size && hdr->magic == DIRCACHE_MAGIC && !strcmp(hdr->key, key) &&
+		hdr->mtime_sec == st->st_mtim.tv_sec && hdr->mtime_nsec == st->st_mtim.tv_nsec && hdr->size == st->st_size &&
+		!memcmp(&hdr->sum, sum, sizeof(dircache_sum)))
+	{
+		uint8_t *p = buf + sizeof(dircache_hdr);
+		uint8_t *end = buf + size;
+
+		DirItem.reserve(hdr->count);
+		for (uint32_t i = 0; i < hdr->count; i++)
+		{
+			direntext_t dext;
+			memset(&dext, 0, sizeof(dext));
+
+			if (p + 5 > end) break;
+			dext.de.d_type = *p++;
+			memcpy(&dext.cookie, p, sizeof(dext.cookie));
+			p += sizeof(dext.cookie);
+
+			char *str[3] = { dext.de.d_name, dext.altname, dext.datecode };
+			size_t len[3] = { sizeof(dext.de.d_name), sizeof(dext.altname), sizeof(dext.datecode) };
+			for (int n = 0; n < 3 && p < end; n++)
+			{
+				size_t l = strnlen((char*)p, end - p);
+				if (l >= len[n] || p + l >= end) break;
+				memcpy(str[n], p, l);
+				p += l + 1;
+			}
+
+			flist_push(&dext);
+		}
+
+		ret = (DirItem.size() == hdr->count);
+		if (!ret) flist_clear();
+	}
+
+	free(buf);
+	if (ret)
+	{
+		printf("Using cached list %s\n", name);
+
+		// mtime is the LRU stamp for dircache_trim()
+		char path[1024];
+		snprintf(path, sizeof(path), "%s", getFullPath(CONFIG_DIR));
+		strncat(path, "/", sizeof(path) - strlen(path) - 1);
+		strncat(path, name, sizeof(path) - strlen(path) - 1);
+		utimes(path, NULL);
+	}
+	return ret;
+}
+
+static void dircache_trim()
+{
+	struct dc_file
+	{
+		char name[16];
+		uint64_t size;
+		time_t mtime;
+	};
+
+	static dc_file files[DIRCACHE_FILES * 4];
+	int num = 0;
+	uint64_t total = 0;
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s", getFullPath(CONFIG_DIR "/" DIRCACHE_DIR));
+
+	DIR *dir = opendir(path);
+	if (!dir) return;
+
+	struct dirent *de;
+	while ((de = readdir(dir)) && num < (int)(sizeof(files) / sizeof(files[0])))
+	{
+		int len = strlen(de->d_name);
+		if (len < 4 || strcasecmp(de->d_name + len - 4, ".bin") || len >= (int)sizeof(files[0].name)) continue;
+
+		char name[1024 + 16];
+		snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+
+		struct stat64 st;
+		if (stat64(name, &st) < 0) continue;
+
+		strcpy(files[num].name, de->d_name);
+		files[num].size = st.st_size;
+		files[num].mtime = st.st_mtime;
+		total += st.st_size;
+		num++;
+	}
+	closedir(dir);
+
+	while (num && (num > DIRCACHE_FILES || total > DIRCACHE_SIZE))
+	{
+		int old = 0;
+		for (int i = 1; i < num; i++) if (files[i].mtime < files[old].mtime) old = i;
+
+		char name[1024 + 16];
+		snprintf(name, sizeof(name), "%s/%s", path, files[old].name);
+		printf("dircache: remove %s\n", files[old].name);
+		unlink(name);
+
+		total -= files[old].size;
+		files[old] = files[--num];
+	}
+}
+
+static void dircache_save(const char *key, struct stat64 *st, dircache_sum *sum)
+{
+	size_t size = sizeof(dircache_hdr);
+	for (auto &item : DirItem) size += 5 + strlen(flist_str(item.name)) + strlen(flist_str(item.altname)) + strlen(flist_str(item.datecode)) + 3;
+
+	uint8_t *buf = (uint8_t*)malloc(size);
+	if (!buf) return;
+
+	dircache_hdr *hdr = (dircache_hdr*)buf;
+	memset(hdr, 0, sizeof(dircache_hdr));
+	hdr->magic = DIRCACHE_MAGIC;
+	hdr->count = DirItem.size();
+	hdr->sum = *sum;
+	hdr->mtime_sec = st->st_mtim.tv_sec;
+	hdr->mtime_nsec = st->st_mtim.tv_nsec;
+	hdr->size = st->st_size;
+	snprintf(hdr->key, sizeof(hdr->key), "%s", key);
+
+	uint8_t *p = buf + sizeof(dircache_hdr);
+	for (auto &item : DirItem)
+	{
+		*p++ = item.type;
+		memcpy(p, &item.cookie, sizeof(item.cookie));
+		p += sizeof(item.cookie);
+		p = (uint8_t*)stpcpy((char*)p, flist_str(item.name)) + 1;
+		p = (uint8_t*)stpcpy((char*)p, flist_str(item.altname)) + 1;
+		p = (uint8_t*)stpcpy((char*)p, flist_str(item.datecode)) + 1;
+	}
+
+	FileSaveConfig(dircache_name(key), buf, size);
+	free(buf);
+	dircache_trim();
+}
+
 int ScanDirectory(char* path, int mode, const char *extension, int options, const char *prefix, const char *filter)
 {
 	static char file_name[1024];
@@ -1269,7 +1780,7 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 	{
 		iFirstEntry = 0;
 		iSelectedEntry = 0;
-		DirItem.clear();
+		flist_clear();
 
 		file_name[0] = 0;
 		if ((options & SCANO_NOENTER) || isPathRegularFile(path))
@@ -1304,12 +1815,29 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 		printf("Start to scan %sdir: %s\n", is_zipped ? "zipped " : "", full_path);
 		printf("Position on item: %s\n", file_name);
 
+		// names.txt and NeoGeo romsets change display names, so don't cache these.
+		// Filtered lists are one-off results of typing in the file browser.
+		static char cache_key[1024 + 256];
+		snprintf(cache_key, sizeof(cache_key), "%s|%s|%X|%s|%d", full_path, extension, options,
+			prefix ? prefix : "", is_minimig());
+
 		char *zip_path, *file_path_in_zip = (char*)"";
 		FileIsZipped(full_path, &zip_path, &file_path_in_zip);
 
+		// folders inside a zip have no stat of their own, the zip file stands for them
+		struct stat64 dir_st;
+		dircache_sum dir_sum = {};
+		int use_cache = !(options & (SCANO_NEOGEO | SCANO_CORES)) && !(filter && *filter) &&
+			!stat64(is_zipped ? zip_path : full_path, &dir_st) && (is_zipped || dircache_sum_dir(full_path, &dir_sum));
+		int cached = use_cache && dircache_load(cache_key, &dir_st, &dir_sum);
+
 		DIR *d = nullptr;
 		mz_zip_archive *z = nullptr;
-		if (is_zipped)
+		if (cached)
+		{
+			// DirItem is filled already
+		}
+		else if (is_zipped)
 		{
 			mz_zip_archive _z = {};
 			if (!mz_zip_reader_init_file(&_z, zip_path, 0))
@@ -1435,7 +1963,7 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 					memcpy(dext.altname, altname, sizeof(dext.altname));
 				}
 
-				DirItem.push_back(dext);
+				flist_push(&dext);
 			}
 			else
 			{
@@ -1527,7 +2055,7 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 					memset(&dext, 0, sizeof(dext));
 					memcpy(&dext.de, de, sizeof(dext.de));
 					get_display_name(&dext, extension, options);
-					DirItem.push_back(dext);
+					flist_push(&dext);
 				}
 			}
 		}
@@ -1541,7 +2069,7 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 			dext.de.d_type = DT_DIR;
 			strcpy(dext.de.d_name, "..");
 			get_display_name(&dext, extension, options);
-			DirItem.push_back(dext);
+			flist_push(&dext);
 
 			mz_zip_reader_end(z);
 			delete z;
@@ -1555,18 +2083,23 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 		printf("Got %d dir entries\n", flist_nDirEntries());
 		if (!flist_nDirEntries()) return 0;
 
-		std::sort(DirItem.begin(), DirItem.end(), DirentComp());
+		if (!cached)
+		{
+			std::sort(DirItem.begin(), DirItem.end(), DirentComp());
+			flist_invalidate_view();
+			if (use_cache && flist_nDirEntries() >= DIRCACHE_MIN) dircache_save(cache_key, &dir_st, &dir_sum);
+		}
 		if (file_name[0])
 		{
 			int pos = -1;
 			for (int i = 0; i < flist_nDirEntries(); i++)
 			{
-				if (!strcmp(file_name, DirItem[i].de.d_name))
+				if (!strcmp(file_name, flist_str(DirItem[i].name)))
 				{
 					pos = i;
 					break;
 				}
-				else if (!strcasecmp(file_name, DirItem[i].de.d_name))
+				else if (!strcasecmp(file_name, flist_str(DirItem[i].name)))
 				{
 					pos = i;
 				}
@@ -1660,12 +2193,12 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 			int pos = -1;
 			for (int i = 0; i < flist_nDirEntries(); i++)
 			{
-				if ((DirItem[i].de.d_type == DT_DIR) && !strcmp(DirItem[i].altname, extension))
+				if ((DirItem[i].type == DT_DIR) && !strcmp(flist_str(DirItem[i].altname), extension))
 				{
 					pos = i;
 					break;
 				}
-				else if ((DirItem[i].de.d_type == DT_DIR) && !strcasecmp(DirItem[i].altname, extension))
+				else if ((DirItem[i].type == DT_DIR) && !strcasecmp(flist_str(DirItem[i].altname), extension))
 				{
 					pos = i;
 				}
@@ -1688,7 +2221,7 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 				int found = -1;
 				for (int i = iSelectedEntry+1; i < flist_nDirEntries(); i++)
 				{
-					if (toupper(DirItem[i].altname[0]) == mode)
+					if (toupper(flist_str(DirItem[i].altname)[0]) == mode)
 					{
 						found = i;
 						break;
@@ -1699,7 +2232,7 @@ int ScanDirectory(char* path, int mode, const char *extension, int options, cons
 				{
 					for (int i = 0; i < flist_nDirEntries(); i++)
 					{
-						if (toupper(DirItem[i].altname[0]) == mode)
+						if (toupper(flist_str(DirItem[i].altname)[0]) == mode)
 						{
 							found = i;
 							break;
@@ -1741,14 +2274,31 @@ int flist_iSelectedEntry()
 	return iSelectedEntry;
 }
 
+// Returned item stays valid until the list changes or
+// FLIST_VIEW_SIZE other items are requested.
 direntext_t* flist_DirItem(int n)
 {
-	return &DirItem[n];
+	int slot = n % FLIST_VIEW_SIZE;
+	direntext_t *item = &flist_view[slot];
+
+	if (flist_view_idx[slot] != n)
+	{
+		const flistEntry &e = DirItem[n];
+		memset(item, 0, sizeof(direntext_t));
+		item->de.d_type = e.type;
+		item->cookie = e.cookie;
+		snprintf(item->de.d_name, sizeof(item->de.d_name), "%s", flist_str(e.name));
+		snprintf(item->altname, sizeof(item->altname), "%s", flist_str(e.altname));
+		snprintf(item->datecode, sizeof(item->datecode), "%s", flist_str(e.datecode));
+		flist_view_idx[slot] = n;
+	}
+
+	return item;
 }
 
 direntext_t* flist_SelectedItem()
 {
-	return &DirItem[iSelectedEntry];
+	return flist_DirItem(iSelectedEntry);
 }
 
 bool isMraName(char *path)
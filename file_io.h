@@ -80,6 +80,14 @@ int FileWriteAdv(fileTYPE *file, void *pBuffer, int length, int failres = 0);
 int FileWriteSec(fileTYPE *file, void *pBuffer);
 int FileCreatePath(const char *dir);
 
+// Read-ahead: a worker thread reads the file into a ring of buffers,
+// so storage latency overlaps with processing of the previous block.
+// The file must not be touched by the caller until FileReadAheadStop.
+struct fileReadAhead;
+fileReadAhead *FileReadAheadStart(fileTYPE *file, __off64_t size, int block = 256 * 1024);
+int  FileReadAheadGet(fileReadAhead *ra, uint8_t **buf); // next block, valid until the next call. 0 at the end, -1 on a read error.
+void FileReadAheadStop(fileReadAhead *ra);
+
 int FileExists(const char *name, int use_zip = 1);
 int FileCanWrite(const char *name);
 int PathIsDir(const char *name, int use_zip = 1);
@@ -9,6 +9,9 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <pthread.h>
 
 #include "fpga_io.h"
 #include "file_io.h"
@@ -21,12 +24,18 @@
 #include "fpga_system_manager.h"
 #include "fpga_reset_manager.h"
 #include "fpga_nic301.h"
+#include "fpga_sim.h"
+#include "sdcache.h"
+#include "cfg.h"
+#include "trace.h"
+#include "rbf_cache.h"
+#include "video.h"
 
 #define FPGA_REG_BASE 0xFF000000
 #define FPGA_REG_SIZE 0x01000000
 
-#define MAP_ADDR(x) (volatile uint32_t*)(&map_base[(((uint32_t)(x)) & 0xFFFFFF)>>2])
-#define IS_REG(x) (((((uint32_t)(x))-1)>=(FPGA_REG_BASE - 1)) && ((((uint32_t)(x))-1)<(FPGA_REG_BASE + FPGA_REG_SIZE - 1)))
+#define MAP_ADDR(x) (volatile uint32_t*)(&map_base[(((uintptr_t)(x)) & 0xFFFFFF)>>2])
+#define IS_REG(x) (((((uintptr_t)(x))-1)>=(FPGA_REG_BASE - 1)) && ((((uintptr_t)(x))-1)<(FPGA_REG_BASE + FPGA_REG_SIZE - 1)))
 
 #define fatal(x) munmap((void*)map_base, FPGA_REG_SIZE); close(fd); exit(x)
 
@@ -231,8 +240,12 @@ static int fpgamgr_program_init(void)
 /* Write the RBF data to FPGA Manager */
 static void fpgamgr_program_write(const void *rbf_data, unsigned long rbf_size)
 {
-	uint32_t src = (uint32_t)rbf_data;
-	uint32_t dst = (uint32_t)MAP_ADDR(SOCFPGA_FPGAMGRDATA_ADDRESS);
+#ifdef FPGA_SIM
+	(void)rbf_data;
+	(void)rbf_size;
+#else
+	uintptr_t src = (uintptr_t)rbf_data;
+	uintptr_t dst = (uintptr_t)MAP_ADDR(SOCFPGA_FPGAMGRDATA_ADDRESS);
 
 	/* Number of loops for 32-byte long copying. */
 	uint32_t loops32 = rbf_size / 32;
@@ -240,12 +253,14 @@ static void fpgamgr_program_write(const void *rbf_data, unsigned long rbf_size)
 	uint32_t loops4 = DIV_ROUND_UP(rbf_size % 32, 4);
 
 	__asm volatile(
+		"	cmp   %2, #0        \n"
+		"	beq   4f            \n"
 		"1:	ldmia %0!,{r0-r7}   \n"
 		"	stmia %1!,{r0-r7}   \n"
 		"	sub	  %1, #32       \n"
 		"	subs  %2, #1        \n"
 		"	bne   1b            \n"
-		"	cmp   %3, #0        \n"
+		"4:	cmp   %3, #0        \n"
 		"	beq   3f            \n"
 		"2:	ldr	  %2, [%0], #4  \n"
 		"	str   %2, [%1]      \n"
@@ -254,6 +269,7 @@ static void fpgamgr_program_write(const void *rbf_data, unsigned long rbf_size)
 		"3:	nop                 \n"
 		: "+r"(src), "+r"(dst), "+r"(loops32), "+r"(loops4) :
 		: "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "cc");
+#endif
 }
 
 /* Ensure the FPGA entering config done */
@@ -340,24 +356,44 @@ static int fpgamgr_program_poll_usermode(void)
 
 /*
 * FPGA Manager to program the FPGA. This is the interface used by FPGA driver.
+* The bitstream is written in pieces as it is read: socfpga_load_begin(),
+* socfpga_load_data() for each piece, socfpga_load_end().
 * Return 0 for sucess, non-zero for error.
 */
-static int socfpga_load(const void *rbf_data, size_t rbf_size)
+static int socfpga_load_begin(void)
 {
-	unsigned long status;
+#ifdef FPGA_SIM
+	return 0;
+#endif
+
+	/* Initialize the FPGA Manager */
+	return fpgamgr_program_init();
+}
 
-	if ((uint32_t)rbf_data & 0x3) {
+/* Every piece but the last must be a multiple of 4 bytes */
+static int socfpga_load_data(const void *rbf_data, size_t rbf_size)
+{
+	if ((uintptr_t)rbf_data & 0x3) {
 		printf("FPGA: Unaligned data, realign to 32bit boundary.\n");
 		return -EINVAL;
 	}
 
-	/* Initialize the FPGA Manager */
-	status = fpgamgr_program_init();
-	if (status)
-		return status;
+#ifdef FPGA_SIM
+	return fpga_sim_program(rbf_data, rbf_size);
+#endif
 
 	/* Write the RBF data to FPGA Manager */
 	fpgamgr_program_write(rbf_data, rbf_size);
+	return 0;
+}
+
+static int socfpga_load_end(void)
+{
+	unsigned long status;
+
+#ifdef FPGA_SIM
+	return 0;
+#endif
 
 	/* Ensure the FPGA entering config done */
 	status = fpgamgr_program_poll_cd();
@@ -375,6 +411,10 @@ static int socfpga_load(const void *rbf_data, size_t rbf_size)
 
 static void do_bridge(uint32_t enable)
 {
+#ifdef FPGA_SIM
+	return;
+#endif
+
 	if (enable)
 	{
 		writel(0x00003FFF, (void*)(SOCFPGA_SDR_ADDRESS + 0x5080));
@@ -392,6 +432,11 @@ static void do_bridge(uint32_t enable)
 
 static int make_env(const char *name, const char *cfg)
 {
+#ifdef FPGA_SIM
+	printf("FPGA sim: core=\"%s\", cfg=%s\n", name, cfg);
+	return 0;
+#endif
+
 	if ((fd = open("/dev/mem", O_RDWR | O_SYNC)) == -1) return -1;
 
 	void* buf = mmap(0, 0x1000, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0x1FFFF000);
@@ -447,8 +492,10 @@ int fpga_load_rbf(const char *name, const char *cfg, const char *xml)
 	if(name[0] == '/') strcpy(path, name);
 	else sprintf(path, "%s/%s", !strcasecmp(name, "menu.rbf") ? getStorageDir(0) : getRootDir(), name);
 
-	int rbf = open(path, O_RDONLY);
-	if (rbf < 0)
+	rbf_cache_stop();
+
+	fileTYPE f = {};
+	if (!FileOpenEx(&f, path, O_RDONLY, 1, 0))
 	{
 		char error[4096];
 		snprintf(error,4096,"%s\nNot Found", name);
@@ -456,86 +503,182 @@ int fpga_load_rbf(const char *name, const char *cfg, const char *xml)
 		Info(error,5000);
 		return -1;
 	}
+
+	printf("Bitstream size: %lld bytes\n", (long long)f.size);
+
+	uint64_t t_start = trace_time();
+	uint64_t t_read = 0, t_prog = 0;
+
+	int cache_size = 0;
+	uint8_t *cache = rbf_cache_load(path, &cache_size);
+	t_read = trace_time() - t_start;
+
+	// program the FPGA while the next block is read
+	fileReadAhead *ra = cache ? 0 : FileReadAheadStart(&f, f.size);
+	if (!cache && !ra)
+	{
+		printf("Couldn't read file %s\n", name);
+		ret = -1;
+	}
 	else
 	{
-		struct stat64 st;
-		if (fstat64(rbf, &st)<0)
-		{
-			printf("Couldn't get info of file %s\n", path);
-			ret = -1;
-		}
-		else
-		{
-			printf("Bitstream size: %lld bytes\n", st.st_size);
+		// keep the input thread off the bus while the FPGA is reprogrammed
+		fpga_bus_pin();
+		fpga_core_reset(1);
 
-			void *buf = malloc(st.st_size);
-			if (!buf)
-			{
-				printf("Couldn't allocate %llu bytes.\n", st.st_size);
-				ret = -1;
-			}
-			else
+		int started = 0;
+		uint32_t remain = 0;
+		while (!ret)
+		{
+			uint64_t t = trace_time();
+			uint8_t *buf = cache;
+			int len = cache_size;
+			if (cache) cache_size = 0;
+			else len = FileReadAheadGet(ra, &buf);
+			t_read += trace_time() - t;
+			if (len <= 0) break;
+
+			if (!started)
 			{
-				fpga_core_reset(1);
-				if (read(rbf, buf, st.st_size)<st.st_size)
-				{
-					printf("Couldn't read file %s\n", name);
-					ret = -1;
-				}
-				else
+				remain = f.size;
+				if (len >= 16 && !memcmp(buf, "MiSTer", 6))
 				{
-					void *p = buf;
-					__off64_t sz = st.st_size;
-					if (!memcmp(buf, "MiSTer", 6))
-					{
-						sz = *(uint32_t*)(((uint8_t*)buf) + 12);
-						p = (void*)(((uint8_t*)buf) + 16);
-					}
-					do_bridge(0);
-					ret = socfpga_load(p, sz);
-					if (ret)
-					{
-						printf("Error %d while loading %s\n", ret, path);
-					}
-					else
-					{
-						do_bridge(1);
-					}
+					remain = *(uint32_t*)(buf + 12);
+					buf += 16;
+					len -= 16;
 				}
-				free(buf);
+
+				do_bridge(0);
+				ret = socfpga_load_begin();
+				started = 1;
+				if (ret) break;
 			}
+
+			if ((uint32_t)len > remain) len = remain;
+
+			t = trace_time();
+			if (len) ret = socfpga_load_data(buf, len);
+			t_prog += trace_time() - t;
+
+			remain -= len;
+			if (!remain) break;
+		}
+
+		if (!ret && (!started || remain))
+		{
+			printf("Couldn't read file %s\n", name);
+			ret = -1;
+		}
+
+		if (!ret)
+		{
+			uint64_t t = trace_time();
+			ret = socfpga_load_end();
+			t_prog += trace_time() - t;
+		}
+
+		if (ret)
+		{
+			printf("Error %d while loading %s\n", ret, path);
+		}
+		else
+		{
+			do_bridge(1);
+			printf("RBF from %s: read %llums, program %llums, total %llums\n", cache ? "cache" : "file",
+				(unsigned long long)(t_read / 1000), (unsigned long long)(t_prog / 1000),
+				(unsigned long long)((trace_time() - t_start) / 1000));
+			rbf_cache_used(path);
 		}
 	}
-	close(rbf);
+
+	FileReadAheadStop(ra);
+	free(cache);
+	FileClose(&f);
 
 	app_restart(!strcasecmp(name, "menu.rbf") ? "menu.rbf" : path, xml);
 	return ret;
 }
 
+// Bridge backend: all GPO/GPI and LW bridge traffic goes through these.
+// FPGA_SIM routes it to the software model in fpga_sim.cpp.
+#ifdef FPGA_SIM
+#define fpga_gpo_writeN(value) fpga_sim_gpo_write(value)
+#define fpga_gpi_read() (int)fpga_sim_gpi_read()
+#define fpga_lw_write(offset, value) fpga_sim_lw_write(offset, value)
+#define fpga_lw_read(offset) fpga_sim_lw_read(offset)
+#else
+#define fpga_gpo_writeN(value) writel((value), (void*)(SOCFPGA_MGR_ADDRESS + 0x10))
+#define fpga_gpi_read() (int)readl((void*)(SOCFPGA_MGR_ADDRESS + 0x14))
+#define fpga_lw_write(offset, value) writel((value), (void*)(SOCFPGA_LWFPGASLAVES_ADDRESS + (offset)))
+#define fpga_lw_read(offset) readl((void*)(SOCFPGA_LWFPGASLAVES_ADDRESS + (offset)))
+#endif
+
 static uint32_t gpo_copy = 0;
 void inline fpga_gpo_write(uint32_t value)
 {
 	gpo_copy = value;
-	writel(value, (void*)(SOCFPGA_MGR_ADDRESS + 0x10));
+	fpga_gpo_writeN(value);
 }
 
-#define fpga_gpo_writeN(value) writel((value), (void*)(SOCFPGA_MGR_ADDRESS + 0x10))
 #define fpga_gpo_read() gpo_copy //readl((void*)(SOCFPGA_MGR_ADDRESS + 0x10))
-#define fpga_gpi_read() (int)readl((void*)(SOCFPGA_MGR_ADDRESS + 0x14))
+
+// GPO is read-modify-written and SSPI transfers span several calls, so once
+// a second thread talks to the FPGA (input thread) the bus is owned from the
+// first chip select until the last one is dropped.
+#define SSPI_EN_MASK (7<<18)
+
+static int bus_shared = 0;
+static pthread_mutex_t bus_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int bus_held = 0;
+
+void fpga_bus_share(int on)
+{
+	bus_shared = on;
+}
+
+int fpga_bus_lock()
+{
+	if (!bus_shared || bus_held) return 0;
+
+	pthread_mutex_lock(&bus_mutex);
+	bus_held = 1;
+	return 1;
+}
+
+void fpga_bus_unlock()
+{
+	if (bus_held != 1) return;
+
+	bus_held = 0;
+	pthread_mutex_unlock(&bus_mutex);
+}
+
+// keep the bus for good: the process restarts or the board reboots
+void fpga_bus_pin()
+{
+	fpga_bus_lock();
+	if (bus_held) bus_held = 2;
+}
 
 void fpga_core_write(uint32_t offset, uint32_t value)
 {
-	if (offset <= 0x1FFFFF) writel(value, (void*)(SOCFPGA_LWFPGASLAVES_ADDRESS + (offset & ~3)));
+	if (offset <= 0x1FFFFF) fpga_lw_write(offset & ~3, value);
 }
 
 uint32_t fpga_core_read(uint32_t offset)
 {
-	if (offset <= 0x1FFFFF) return readl((void*)(SOCFPGA_LWFPGASLAVES_ADDRESS + (offset & ~3)));
+	if (offset <= 0x1FFFFF) return fpga_lw_read(offset & ~3);
 	return 0;
 }
 
 int fpga_io_init()
 {
+#ifdef FPGA_SIM
+	fpga_sim_init();
+	fpga_gpo_write(0);
+	return 0;
+#endif
+
 	if ((fd = open("/dev/mem", O_RDWR | O_SYNC)) == -1) return -1;
 
 	map_base = (uint32_t*)mmap(0, FPGA_REG_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, FPGA_REG_BASE);
@@ -574,29 +717,45 @@ int fpga_get_io_version()
 
 void fpga_set_led(uint32_t on)
 {
+	int lock = fpga_bus_lock();
 	uint32_t gpo = fpga_gpo_read();
 	fpga_gpo_write(on ? gpo | 0x20000000 : gpo & ~0x20000000);
+	if (lock) fpga_bus_unlock();
 }
 
 int fpga_get_buttons()
 {
+	int lock = fpga_bus_lock();
 	fpga_gpo_write(fpga_gpo_read() | 0x80000000);
 	int gpi = fpga_gpi_read();
+	if (lock) fpga_bus_unlock();
+
 	if (gpi < 0) gpi = 0; // FPGA is not in user mode. Ignore the data;
 	return (gpi >> 29) & 3;
 }
 
 int fpga_get_io_type()
 {
+	int lock = fpga_bus_lock();
 	fpga_gpo_write(fpga_gpo_read() | 0x80000000);
-	return (fpga_gpi_read() >> 28) & 1;
+	int gpi = fpga_gpi_read();
+	if (lock) fpga_bus_unlock();
+
+	return (gpi >> 28) & 1;
 }
 
 void reboot(int cold)
 {
+	fpga_bus_pin();
+	sdcache_flush_all();
 	sync();
 	fpga_core_reset(1);
 
+#ifdef FPGA_SIM
+	fpga_sim_print_stats("reboot");
+	exit(cold ? 1 : 0);
+#endif
+
 	usleep(500000);
 
 	writel(cold ? 0 : 0x1, &reset_regs->tstscratch);
@@ -616,13 +775,27 @@ char *getappname()
 	return dest;
 }
 
-void app_restart(const char *path, const char *xml)
+// Core switch request from the running core to the host process (app_host).
+struct app_switch
 {
-	sync();
-	fpga_core_reset(1);
+	int      pending;
+	int      fast;
+	int      has_xml;
+	uint64_t time;
+	char     path[1024];
+	char     xml[1024];
+};
 
-	input_switch(0);
-	input_uinp_destroy();
+#define APP_SWITCH_ENV "MISTER_SWITCH_US"
+
+static app_switch *app_sw = 0;
+static uint64_t switch_time = 0;
+
+static void app_exec(const char *path, const char *xml, uint64_t time)
+{
+	char str[32];
+	sprintf(str, "%llu", (unsigned long long)time);
+	setenv(APP_SWITCH_ENV, str, 1);
 
 	char *appname = getappname();
 	printf("restarting the %s\n", appname);
@@ -632,10 +805,136 @@ void app_restart(const char *path, const char *xml)
 	reboot(0);
 }
 
+void app_restart(const char *path, const char *xml)
+{
+	uint64_t time = trace_time();
+
+	fpga_bus_pin();
+	sdcache_flush_all();
+	sync();
+	fpga_core_reset(1);
+
+	input_switch(0);
+
+	if (app_sw)
+	{
+		// the host forks (or execs) the next core. uinput device belongs to the host.
+		app_sw->fast = cfg.fast_core_switch;
+		app_sw->time = time;
+		app_sw->has_xml = (xml != NULL);
+		snprintf(app_sw->path, sizeof(app_sw->path), "%s", path);
+		snprintf(app_sw->xml, sizeof(app_sw->xml), "%s", xml ? xml : "");
+		app_sw->pending = 1;
+
+		fflush(stdout);
+		_exit(0);
+	}
+
+	input_uinp_destroy();
+	app_exec(path, xml, time);
+}
+
+static int app_threads()
+{
+	int num = 0;
+	FILE *f = fopen("/proc/self/status", "r");
+	if (f)
+	{
+		char line[128];
+		while (fgets(line, sizeof(line), f)) if (sscanf(line, "Threads: %d", &num) == 1) break;
+		fclose(f);
+	}
+	return num;
+}
+
+void app_host(const char **path, const char **xml)
+{
+	static char cur_path[1024], cur_xml[1024];
+
+	const char *env = getenv(APP_SWITCH_ENV);
+	if (env)
+	{
+		switch_time = strtoull(env, NULL, 10);
+		unsetenv(APP_SWITCH_ENV);
+	}
+
+	// only the global section: no core is known yet.
+	// user_io_init() parses it again for the core.
+	cfg_parse();
+	if (!cfg.fast_core_switch) return;
+
+	// fork() keeps only the calling thread
+	if (app_threads() != 1) return;
+
+	app_sw = (app_switch*)mmap(NULL, sizeof(app_switch), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (app_sw == MAP_FAILED)
+	{
+		app_sw = 0;
+		return;
+	}
+
+	// core independent setup, shared by all the cores
+	input_init();
+	video_logo_preload();
+
+	int first = 1;
+	while (1)
+	{
+		app_sw->pending = 0;
+		fflush(stdout);
+
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			printf("app_host: fork failed, running in place.\n");
+			munmap(app_sw, sizeof(app_switch));
+			app_sw = 0;
+			return;
+		}
+
+		if (!pid)
+		{
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+			// as fpga_io_init() leaves it in a new process
+			if (!first) fpga_gpo_write(0);
+			return;
+		}
+
+		first = 0;
+
+		int status = 0;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+		// core process quit or crashed on its own
+		if (!app_sw->pending) exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+
+		switch_time = app_sw->time;
+		strcpy(cur_path, app_sw->path);
+		strcpy(cur_xml, app_sw->xml);
+		*path = cur_path;
+		*xml = app_sw->has_xml ? cur_xml : NULL;
+
+		if (!app_sw->fast)
+		{
+			input_uinp_destroy();
+			app_exec(*path, *xml, switch_time);
+		}
+		printf("switching to %s\n", cur_path);
+	}
+}
+
+uint64_t app_switch_time()
+{
+	return switch_time;
+}
+
 void fpga_core_reset(int reset)
 {
+	int lock = fpga_bus_lock();
 	uint32_t gpo = fpga_gpo_read() & ~0xC0000000;
 	fpga_gpo_write(reset ? gpo | 0x40000000 : gpo | 0x80000000);
+	if (lock) fpga_bus_unlock();
 }
 
 int is_fpga_ready(int quick)
@@ -645,6 +944,10 @@ int is_fpga_ready(int quick)
 		return (fpga_gpi_read() >= 0);
 	}
 
+#ifdef FPGA_SIM
+	return 1;
+#endif
+
 	return fpgamgr_test_fpga_ready();
 }
 
@@ -653,8 +956,13 @@ int is_fpga_ready(int quick)
 
 void fpga_spi_en(uint32_t mask, uint32_t en)
 {
+	if (en) fpga_bus_lock();
+
 	uint32_t gpo = fpga_gpo_read() | 0x80000000;
-	fpga_gpo_write(en ? gpo | mask : gpo & ~mask);
+	gpo = en ? gpo | mask : gpo & ~mask;
+	fpga_gpo_write(gpo);
+
+	if (!(gpo & SSPI_EN_MASK)) fpga_bus_unlock();
 }
 
 void fpga_wait_to_reset()
@@ -671,8 +979,12 @@ void fpga_wait_to_reset()
 	reboot(0);
 }
 
+// words strobed over SSPI, sampled by the tracer
+uint32_t fpga_spi_words = 0;
+
 uint16_t fpga_spi(uint16_t word)
 {
+	fpga_spi_words++;
 	uint32_t gpo = (fpga_gpo_read() & ~(0xFFFF | SSPI_STROBE)) | word;
 
 	fpga_gpo_write(gpo);
@@ -708,6 +1020,7 @@ uint16_t fpga_spi(uint16_t word)
 
 uint16_t fpga_spi_fast(uint16_t word)
 {
+	fpga_spi_words++;
 	uint32_t gpo = (fpga_gpo_read() & ~(0xFFFF | SSPI_STROBE)) | word;
 	fpga_gpo_write(gpo);
 	fpga_gpo_write(gpo | SSPI_STROBE);
@@ -717,6 +1030,7 @@ uint16_t fpga_spi_fast(uint16_t word)
 
 void fpga_spi_fast_block_write(const uint16_t *buf, uint32_t length)
 {
+	fpga_spi_words += length;
 	uint32_t gpoH = (fpga_gpo_read() & ~(0xFFFF | SSPI_STROBE));
 	uint32_t gpo = gpoH;
 
@@ -732,6 +1046,7 @@ void fpga_spi_fast_block_write(const uint16_t *buf, uint32_t length)
 
 void fpga_spi_fast_block_read(uint16_t *buf, uint32_t length)
 {
+	fpga_spi_words += length;
 	uint32_t gpo = (fpga_gpo_read() & ~(0xFFFF | SSPI_STROBE));
 	uint32_t rem = length % 16;
 	length /= 16;
@@ -815,6 +1130,7 @@ void fpga_spi_fast_block_read(uint16_t *buf, uint32_t length)
 
 void fpga_spi_fast_block_write_8(const uint8_t *buf, uint32_t length)
 {
+	fpga_spi_words += length;
 	uint32_t gpoH = (fpga_gpo_read() & ~(0xFFFF | SSPI_STROBE));
 	uint32_t gpo = gpoH;
 	uint32_t rem = length % 16;
@@ -901,6 +1217,7 @@ void fpga_spi_fast_block_write_8(const uint8_t *buf, uint32_t length)
 
 void fpga_spi_fast_block_read_8(uint8_t *buf, uint32_t length)
 {
+	fpga_spi_words += length;
 	uint32_t gpo = (fpga_gpo_read() & ~(0xFFFF | SSPI_STROBE));
 	uint32_t rem = length % 16;
 	length /= 16;
@@ -984,6 +1301,7 @@ void fpga_spi_fast_block_read_8(uint8_t *buf, uint32_t length)
 
 void fpga_spi_fast_block_write_be(const uint16_t *buf, uint32_t length)
 {
+	fpga_spi_words += length;
 	uint32_t gpoH = (fpga_gpo_read() & ~(0xFFFF | SSPI_STROBE));
 	uint32_t gpo = gpoH;
 
@@ -1001,6 +1319,7 @@ void fpga_spi_fast_block_write_be(const uint16_t *buf, uint32_t length)
 
 void fpga_spi_fast_block_read_be(uint16_t *buf, uint32_t length)
 {
+	fpga_spi_words += length;
 	uint32_t gpo = (fpga_gpo_read() & ~(0xFFFF | SSPI_STROBE));
 
 	// should be optimized for speed by compiler automatically
@@ -9,8 +9,15 @@
 
 int fpga_io_init();
 
+// serialize GPO/SSPI access once another thread talks to the FPGA
+void fpga_bus_share(int on);
+int  fpga_bus_lock();
+void fpga_bus_unlock();
+void fpga_bus_pin();
+
 void fpga_spi_en(uint32_t mask, uint32_t en);
 uint16_t fpga_spi(uint16_t word);
+extern uint32_t fpga_spi_words;
 uint16_t fpga_spi_fast(uint16_t word);
 
 void fpga_spi_fast_block_write(const uint16_t *buf, uint32_t length);
@@ -37,6 +44,16 @@ int fpga_load_rbf(const char *name, const char *cfg = 0, const char *xml = 0);
 
 void reboot(int cold);
 void app_restart(const char *path, const char *xml = 0);
+
+// Keeps the process as it is after the core independent startup and forks
+// a fresh copy of it for every core. Returns in the child running the core,
+// with path/xml of the core to start. Returns at once (no fork) unless
+// fast_core_switch is set in the global section of the ini.
+void app_host(const char **path, const char **xml);
+
+// trace_time() of the switch request that started this core, 0 at boot
+uint64_t app_switch_time();
+
 char *getappname();
 
 void fpga_wait_to_reset();
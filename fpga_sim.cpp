@@ -0,0 +1,140 @@
+// fpga_sim.cpp
+// Software model of the HPS<->FPGA bridge (GPO/GPI handshake, SSPI strobe/ack
+// and lightweight bridge registers) with a scriptable core responder.
+
+#ifdef FPGA_SIM
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "fpga_sim.h"
+
+#define SSPI_STROBE  (1<<17)
+#define SSPI_EN_MASK (7<<18)
+
+#define LW_SIZE      0x200000
+
+static uint32_t gpo = 0;
+static uint16_t sspi_data = 0;
+
+static uint8_t sim_core_type = 0xA4; // CORE_TYPE_8BIT
+static uint8_t sim_io_version = 1;
+static uint8_t sim_fio_size = 1;
+static uint8_t sim_io_type = 0;
+static uint8_t sim_buttons = 0;
+
+static fpga_sim_responder_t responder = 0;
+
+static uint32_t lw_regs[LW_SIZE / 4];
+
+static fpga_sim_stats_t stats;
+static struct timespec stats_start;
+
+void fpga_sim_init()
+{
+	gpo = 0;
+	sspi_data = 0;
+	memset(lw_regs, 0, sizeof(lw_regs));
+	fpga_sim_reset_stats();
+	printf("FPGA: using software bridge model.\n");
+}
+
+void fpga_sim_set_core(uint8_t core_type, uint8_t io_version, uint8_t fio_size, uint8_t io_type)
+{
+	sim_core_type = core_type;
+	sim_io_version = io_version;
+	sim_fio_size = fio_size;
+	sim_io_type = io_type;
+}
+
+void fpga_sim_set_buttons(uint8_t buttons)
+{
+	sim_buttons = buttons;
+}
+
+void fpga_sim_set_responder(fpga_sim_responder_t cb)
+{
+	responder = cb;
+}
+
+void fpga_sim_gpo_write(uint32_t value)
+{
+	stats.gpo_writes++;
+
+	uint32_t old = gpo;
+	gpo = value;
+
+	if ((value & SSPI_EN_MASK) & ~(old & SSPI_EN_MASK)) stats.selects++;
+
+	// core latches the word on the rising edge of the strobe
+	if ((value & SSPI_STROBE) && !(old & SSPI_STROBE))
+	{
+		stats.strobes++;
+		sspi_data = responder ? responder(value & SSPI_EN_MASK, (uint16_t)value) : 0;
+	}
+}
+
+uint32_t fpga_sim_gpi_read()
+{
+	stats.gpi_reads++;
+
+	if (!(gpo & 0x80000000)) return 0x5CA62300 | sim_core_type;
+
+	// ack follows the strobe immediately: the model never stalls the HPS
+	return ((sim_buttons & 3) << 29) | ((sim_io_type & 1) << 28) | ((sim_io_version & 3) << 18) |
+		(gpo & SSPI_STROBE) | ((sim_fio_size & 1) << 16) | sspi_data;
+}
+
+void fpga_sim_lw_write(uint32_t offset, uint32_t value)
+{
+	stats.lw_writes++;
+	if (offset < LW_SIZE) lw_regs[offset >> 2] = value;
+}
+
+uint32_t fpga_sim_lw_read(uint32_t offset)
+{
+	stats.lw_reads++;
+	return (offset < LW_SIZE) ? lw_regs[offset >> 2] : 0;
+}
+
+int fpga_sim_program(const void *rbf_data, uint32_t rbf_size)
+{
+	if (!rbf_data) return -1;
+	stats.rbf_bytes += rbf_size;
+	return 0;
+}
+
+void fpga_sim_get_stats(fpga_sim_stats_t *out)
+{
+	*out = stats;
+}
+
+void fpga_sim_reset_stats()
+{
+	memset(&stats, 0, sizeof(stats));
+	clock_gettime(CLOCK_MONOTONIC, &stats_start);
+}
+
+void fpga_sim_print_stats(const char *label)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double us = (now.tv_sec - stats_start.tv_sec) * 1000000.0 + (now.tv_nsec - stats_start.tv_nsec) / 1000.0;
+
+	printf("FPGA sim [%s]: %.0fus, words: %llu, selects: %llu, gpo: %llu, gpi: %llu, lw: %llu/%llu\n",
+		label ? label : "", us,
+		(unsigned long long)stats.strobes, (unsigned long long)stats.selects,
+		(unsigned long long)stats.gpo_writes, (unsigned long long)stats.gpi_reads,
+		(unsigned long long)stats.lw_reads, (unsigned long long)stats.lw_writes);
+
+	if (stats.strobes)
+	{
+		printf("FPGA sim [%s]: %.2f gpo writes/word, %.2f gpi reads/word, %.1fns/word\n",
+			label ? label : "",
+			(double)stats.gpo_writes / stats.strobes, (double)stats.gpi_reads / stats.strobes,
+			us * 1000.0 / stats.strobes);
+	}
+}
+
+#endif
@@ -0,0 +1,46 @@
+// fpga_sim.h
+// Software model of the HPS<->FPGA bridge.
+// Built instead of the mmapped registers when compiled with FPGA_SIM
+// (make FPGA_SIM=1), so SPI hot paths can be run and profiled off the board.
+// tests/spi_check.cpp drives the file download, SD sector and OSD transfers
+// through it.
+
+#ifndef FPGA_SIM_H
+#define FPGA_SIM_H
+
+#include <stdint.h>
+
+// Called on every SSPI strobe. en holds the active SSPI_*_EN bits of GPO
+// (bits 18..20), word is the value put on the bus. The returned value is
+// presented on GPI[15:0] until the next strobe.
+typedef uint16_t (*fpga_sim_responder_t)(uint32_t en, uint16_t word);
+
+typedef struct
+{
+	uint64_t gpo_writes;
+	uint64_t gpi_reads;
+	uint64_t strobes;      // words transferred over SSPI
+	uint64_t selects;      // chip select assertions (FPGA/OSD/IO)
+	uint64_t lw_writes;
+	uint64_t lw_reads;
+	uint64_t rbf_bytes;
+} fpga_sim_stats_t;
+
+void fpga_sim_init();
+
+// core identity as reported through GPI when GPO[31]==0
+void fpga_sim_set_core(uint8_t core_type, uint8_t io_version, uint8_t fio_size, uint8_t io_type);
+void fpga_sim_set_buttons(uint8_t buttons);
+void fpga_sim_set_responder(fpga_sim_responder_t responder);
+
+void fpga_sim_gpo_write(uint32_t value);
+uint32_t fpga_sim_gpi_read();
+void fpga_sim_lw_write(uint32_t offset, uint32_t value);
+uint32_t fpga_sim_lw_read(uint32_t offset);
+int fpga_sim_program(const void *rbf_data, uint32_t rbf_size);
+
+void fpga_sim_get_stats(fpga_sim_stats_t *stats);
+void fpga_sim_reset_stats();
+void fpga_sim_print_stats(const char *label);
+
+#endif
@@ -16,6 +16,9 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
 
 #include "input.h"
 #include "user_io.h"
@@ -23,6 +26,8 @@
 #include "hardware.h"
 #include "cfg.h"
 #include "fpga_io.h"
+#include "scheduler.h"
+#include "trace.h"
 #include "osd.h"
 #include "video.h"
 #include "joymapping.h"
@@ -910,6 +915,83 @@ static devInput player_pdsp[NUMPLAYERS] = {};
 
 #define BTN_NUM (sizeof(devInput::map) / sizeof(devInput::map[0]))
 
+//#define MAP_LUT_CHECK
+
+// map[] compiled into code -> button lookups, so a key event is not matched
+// against every map entry. Rebuilt on first use after the map changes.
+#define MAP_LUT_SIZE 1024
+
+typedef struct
+{
+	uint8_t  valid;
+	uint32_t btn[MAP_LUT_SIZE]; // mask of map entries having the code in either set
+	int8_t   kbd[256];          // first map entry equal to the key (keyboard as joystick)
+} mapLut;
+
+static mapLut map_lut[NUMDEV] = {};
+static int map_lut_off = 0; // replay bench compares against the scan
+
+static uint32_t map_scan_btn(int dev, uint16_t code)
+{
+	uint32_t mask = 0;
+	for (uint i = 0; i < BTN_NUM; i++)
+	{
+		if (code == (input[dev].map[i] & 0xFFFF) || code == (input[dev].map[i] >> 16)) mask |= 1u << i;
+	}
+	return mask;
+}
+
+static int map_scan_kbd(int dev, uint16_t code)
+{
+	for (uint i = 0; i < BTN_NUM; i++) if (code == input[dev].map[i]) return i;
+	return -1;
+}
+
+static void map_lut_build(int dev)
+{
+	mapLut *lut = &map_lut[dev];
+	memset(lut->btn, 0, sizeof(lut->btn));
+	memset(lut->kbd, -1, sizeof(lut->kbd));
+
+	// backwards, so the first entry wins in kbd[]
+	for (int i = BTN_NUM - 1; i >= 0; i--)
+	{
+		uint32_t code = input[dev].map[i];
+		if ((code & 0xFFFF) < MAP_LUT_SIZE) lut->btn[code & 0xFFFF] |= 1u << i;
+		if ((code >> 16) < MAP_LUT_SIZE) lut->btn[code >> 16] |= 1u << i;
+		if (code < 256) lut->kbd[code] = i;
+	}
+
+	lut->valid = 1;
+
+#ifdef MAP_LUT_CHECK
+	for (int code = 0; code < MAP_LUT_SIZE; code++)
+	{
+		if (lut->btn[code] != map_scan_btn(dev, code)) printf("map_lut: dev %d btn %d mismatch\n", dev, code);
+		if (code < 256 && lut->kbd[code] != map_scan_kbd(dev, code)) printf("map_lut: dev %d kbd %d mismatch\n", dev, code);
+	}
+#endif
+}
+
+static void map_lut_reset()
+{
+	for (int i = 0; i < NUMDEV; i++) map_lut[i].valid = 0;
+}
+
+static uint32_t map_btn(int dev, uint16_t code)
+{
+	if (code >= MAP_LUT_SIZE || map_lut_off) return map_scan_btn(dev, code);
+	if (!map_lut[dev].valid) map_lut_build(dev);
+	return map_lut[dev].btn[code];
+}
+
+static int map_kbd(int dev, uint16_t code)
+{
+	if (code >= 256 || map_lut_off) return map_scan_kbd(dev, code);
+	if (!map_lut[dev].valid) map_lut_build(dev);
+	return map_lut[dev].kbd[code];
+}
+
 int mfd = -1;
 int mwd = -1;
 
@@ -937,12 +1019,52 @@ static int set_watch()
 #define EVENT_SIZE  ( sizeof (struct inotify_event) )
 #define BUF_LEN     ( 1024 * ( EVENT_SIZE + 16 ) )
 
+// device nodes created/deleted since the last check_devs()
+#define HOTPLUG_MAX 32
+
+typedef struct
+{
+	char name[32];
+	int  add;
+} hotplugEvent;
+
+static hotplugEvent hotplug[HOTPLUG_MAX];
+static int hotplug_num = 0;
+
+// maps of unplugged devices, so a reconnect doesn't reload them
+#define MAP_CACHE_NUM 8
+
+typedef struct
+{
+	char     idstr[256];
+	uint8_t  has_map, has_mmap, has_kbdmap;
+	uint32_t map[NUMBUTTONS];
+	uint32_t mmap[NUMBUTTONS];
+	uint8_t  kbdmap[256];
+} mapCache;
+
+static mapCache map_cache[MAP_CACHE_NUM];
+static int map_cache_num = 0;
+
+static int hotplug_put(const char *name, int add)
+{
+	if (strncmp(name, "event", 5) && strncmp(name, "mouse", 5)) return 0;
+	if (hotplug_num >= HOTPLUG_MAX || strlen(name) >= sizeof(hotplug[0].name)) return 2;
+
+	strcpy(hotplug[hotplug_num].name, name);
+	hotplug[hotplug_num].add = add;
+	hotplug_num++;
+	return 1;
+}
+
+// 0 - nothing to do, 1 - devices in hotplug[], 2 - reopen all devices
 static int check_devs()
 {
 	int result = 0;
 	int length, i = 0;
 	char buffer[BUF_LEN];
 	length = read(mfd, buffer, BUF_LEN);
+	hotplug_num = 0;
 
 	if (length < 0)
 	{
@@ -953,29 +1075,32 @@ static int check_devs()
 	while (i<length)
 	{
 		struct inotify_event *event = (struct inotify_event *) &buffer[i];
+		if (event->mask & IN_Q_OVERFLOW) result = 2;
 		if (event->len)
 		{
 			if (event->mask & IN_CREATE)
 			{
-				result = 1;
 				if (event->mask & IN_ISDIR)
 				{
 					printf("The directory %s was created.\n", event->name);
 				}
 				else
 				{
+					int ret = hotplug_put(event->name, 1);
+					if (result < ret) result = ret;
 					printf("The file %s was created.\n", event->name);
 				}
 			}
 			else if (event->mask & IN_DELETE)
 			{
-				result = 1;
 				if (event->mask & IN_ISDIR)
 				{
 					printf("The directory %s was deleted.\n", event->name);
 				}
 				else
 				{
+					int ret = hotplug_put(event->name, 0);
+					if (result < ret) result = ret;
 					printf("The file %s was deleted.\n", event->name);
 				}
 			}
@@ -1148,6 +1273,7 @@ static char *get_kbdmap_name(int dev)
 void finish_map_setting(int dismiss)
 {
 	mapping = 0;
+	map_cache_num = 0;
 	if (mapping_dev<0) return;
 
 	if (mapping_type == 2)
@@ -1246,6 +1372,149 @@ static char kr_fn_table[] =
 	KEY_ENTER,      KEY_KPENTER
 };
 
+// replay bench: what would be sent to the core, the OSD or the menu is
+// hashed instead (and printed with verbose replay)
+enum
+{
+	SINK_KBD = 1,
+	SINK_ANALOG,
+	SINK_MOUSE,
+	SINK_JOY,
+	SINK_UINP,
+	SINK_INFO,
+	SINK_MENU_KEY,
+	SINK_INI,
+	SINK_RESET,
+	SINK_MAP_SHOW
+};
+
+static const char *sink_name[] = { "", "kbd", "analog", "mouse", "joy", "uinput", "info", "menu_key", "ini", "reset", "map_show" };
+
+static int play_sink = 0;
+static int play_verbose = 0;
+static uint32_t play_sum = 0;
+static uint32_t play_out = 0;
+static uint32_t play_cur = 0;
+
+static void play_sink_put(uint32_t type, uint32_t a, uint32_t b, const char *msg = 0)
+{
+	play_sum = ((play_sum * 31 + ((type << 16) | a)) * 31) + b;
+	for (const char *c = msg; c && *c; c++) play_sum = play_sum * 31 + (uint8_t)*c;
+	play_out++;
+
+	if (play_verbose)
+	{
+		printf("%8u %-8s %04X %08X", play_cur, sink_name[type], a, b);
+		if (msg)
+		{
+			printf(" \"");
+			for (const char *c = msg; *c; c++) putchar((*c == '\n') ? ' ' : *c);
+			putchar('"');
+		}
+		putchar('\n');
+	}
+}
+
+// The input thread (input_thread=1) only sends joystick and keyboard state
+// to the core. The rest of what input_cb() produces (mouse, OSD messages,
+// menu keys, hotkeys, ini switch, reset combo) works on main thread state,
+// so the thread queues it and input_poll() runs it. The main loop sleeps at
+// most SCHED_CORE_US while the thread is active. input_mutex guards the queue.
+static __thread int rt_self = 0;
+
+#define RT_QUEUE_SIZE 256
+
+struct rt_call
+{
+	int  type;     // SINK_*
+	int  a, b;
+	int  x, y, w;  // mouse moves, merged while the buttons don't change
+	char msg[64];
+};
+
+static rt_call rt_queue[RT_QUEUE_SIZE];
+static int rt_queue_num = 0;
+static uint32_t rt_queue_lost = 0;
+
+static rt_call *rt_queue_put(int type, int a, int b, const char *msg = 0)
+{
+	if (rt_queue_num >= RT_QUEUE_SIZE)
+	{
+		rt_queue_lost++;
+		return 0;
+	}
+
+	rt_call *c = &rt_queue[rt_queue_num++];
+	memset(c, 0, sizeof(rt_call));
+	c->type = type;
+	c->a = a;
+	c->b = b;
+	if (msg) snprintf(c->msg, sizeof(c->msg), "%s", msg);
+	return c;
+}
+
+static void out_kbd(uint16_t key, int press)
+{
+	if (play_sink) play_sink_put(SINK_KBD, key, press);
+	else if (rt_self && !user_io_kbd_core_only(key, press)) rt_queue_put(SINK_KBD, key, press);
+	else user_io_kbd(key, press);
+}
+
+static void out_analog(unsigned char num, char x, char y)
+{
+	if (play_sink) play_sink_put(SINK_ANALOG, num, ((uint8_t)x << 8) | (uint8_t)y);
+	else user_io_analog_joystick(num, x, y);
+}
+
+static void out_info(const char *msg, int timeout = 2000)
+{
+	if (play_sink) play_sink_put(SINK_INFO, 0, timeout, msg);
+	else if (rt_self) rt_queue_put(SINK_INFO, 0, timeout, msg);
+	else Info(msg, timeout);
+}
+
+static void out_info_msg(const char *msg)
+{
+	if (play_sink) play_sink_put(SINK_INFO, 1, 0, msg);
+	else if (rt_self) rt_queue_put(SINK_INFO, 1, 0, msg);
+	else InfoMessage(msg);
+}
+
+static void out_menu_key(uint32_t key)
+{
+	if (play_sink) play_sink_put(SINK_MENU_KEY, 0, key);
+	else if (rt_self) rt_queue_put(SINK_MENU_KEY, 0, key);
+	else menu_key_set(key);
+}
+
+static void out_set_ini(int num)
+{
+	if (play_sink) play_sink_put(SINK_INI, 0, num);
+	else if (rt_self) rt_queue_put(SINK_INI, 0, num);
+	else user_io_set_ini(num);
+}
+
+static void out_check_reset(uint16_t modifiers, char use_keys)
+{
+	if (play_sink) play_sink_put(SINK_RESET, modifiers, use_keys);
+	else if (rt_self) rt_queue_put(SINK_RESET, modifiers, use_keys);
+	else user_io_check_reset(modifiers, use_keys);
+}
+
+static void out_map_show(int dev)
+{
+	if (play_sink) play_sink_put(SINK_MAP_SHOW, dev, input[dev].num);
+	else if (rt_self) rt_queue_put(SINK_MAP_SHOW, dev, input[dev].num);
+	else map_joystick_show(input[dev].map, input[dev].mmap, input[dev].num);
+}
+
+// gun position for the calibration page, which runs with the OSD open
+// while the input thread is parked
+static int out_lightgun(int idx, uint16_t type, uint16_t code, int value)
+{
+	return rt_self ? 0 : menu_lightgun_cb(idx, type, code, value);
+}
+
 static int keyrah_trans(int key, int press)
 {
 	static int fn = 0;
@@ -1256,7 +1525,7 @@ static int keyrah_trans(int key, int press)
 
 	if (key == KEY_102ND)
 	{
-		if (!press && fn == 1) menu_key_set(KEY_MENU);
+		if (!press && fn == 1) out_menu_key(KEY_MENU);
 		fn = press ? 1 : 0;
 		return 0;
 	}
@@ -1345,7 +1614,9 @@ static unsigned long uinp_repeat = 0;
 static struct input_event uinp_ev;
 static void uinp_send_key(uint16_t key, int press)
 {
-	if (uinp_fd > 0)
+	if (play_sink) play_sink_put(SINK_UINP, key, press);
+	else if (rt_self) rt_queue_put(SINK_UINP, key, press);
+	else if (uinp_fd > 0)
 	{
 		if (!uinp_ev.value && press)
 		{
@@ -1392,7 +1663,19 @@ static void uinp_check_key()
 
 static void mouse_cb(unsigned char b, int16_t x = 0, int16_t y = 0, int16_t w = 0)
 {
-	if (grabbed) user_io_mouse(b, x, y, w);
+	if (play_sink) play_sink_put(SINK_MOUSE, b, ((uint16_t)x << 16) | (uint16_t)(y ^ w));
+	else if (rt_self)
+	{
+		rt_call *c = rt_queue_num ? &rt_queue[rt_queue_num - 1] : 0;
+		if (!c || c->type != SINK_MOUSE || c->a != b) c = rt_queue_put(SINK_MOUSE, b, 0);
+		if (c)
+		{
+			c->x += x;
+			c->y += y;
+			c->w += w;
+		}
+	}
+	else if (grabbed) user_io_mouse(b, x, y, w);
 }
 
 static void joy_digital(int jnum, uint32_t mask, uint32_t code, char press, int bnum, int dont_save = 0)
@@ -1448,9 +1731,9 @@ static void joy_digital(int jnum, uint32_t mask, uint32_t code, char press, int
 						{
 							if (!found) sprintf(str, "Auto fire: %dms", af_delay[num] * 2);
 							else sprintf(str, "Auto fire: OFF");
-							Info(str);
+							out_info(str);
 						}
-						else InfoMessage((!found) ? "\n\n          Auto fire\n             ON" :
+						else out_info_msg((!found) ? "\n\n          Auto fire\n             ON" :
 							"\n\n          Auto fire\n             OFF");
 
 						return;
@@ -1473,12 +1756,12 @@ static void joy_digital(int jnum, uint32_t mask, uint32_t code, char press, int
 						if (hasAPI1_5())
 						{
 							sprintf(str, "Auto fire period: %dms", af_delay[num] * 2);
-							Info(str);
+							out_info(str);
 						}
 						else
 						{
 							sprintf(str, "\n\n       Auto fire period\n            %dms", af_delay[num] * 2);
-							InfoMessage(str);
+							out_info_msg(str);
 						}
 
 						return;
@@ -1505,8 +1788,8 @@ static void joy_digital(int jnum, uint32_t mask, uint32_t code, char press, int
 				mouse_cb(mice_btn);
 
 				mouse_emu ^= 2;
-				if (hasAPI1_5()) Info((mouse_emu & 2) ? "Mouse mode ON" : "Mouse mode OFF");
-				else InfoMessage((mouse_emu & 2) ? "\n\n       Mouse mode lock\n             ON" :
+				if (hasAPI1_5()) out_info((mouse_emu & 2) ? "Mouse mode ON" : "Mouse mode OFF");
+				else out_info_msg((mouse_emu & 2) ? "\n\n       Mouse mode lock\n             ON" :
 					"\n\n       Mouse mode lock\n             OFF");
 			}
 			return;
@@ -1561,7 +1844,7 @@ static void joy_digital(int jnum, uint32_t mask, uint32_t code, char press, int
 			case JOY_RIGHT:
 				if (cfg_switch)
 				{
-					user_io_set_ini(0);
+					out_set_ini(0);
 					osdbtn = 0;
 					return;
 				}
@@ -1571,7 +1854,7 @@ static void joy_digital(int jnum, uint32_t mask, uint32_t code, char press, int
 			case JOY_LEFT:
 				if (cfg_switch)
 				{
-					user_io_set_ini(1);
+					out_set_ini(1);
 					osdbtn = 0;
 					return;
 				}
@@ -1581,7 +1864,7 @@ static void joy_digital(int jnum, uint32_t mask, uint32_t code, char press, int
 			case JOY_UP:
 				if (cfg_switch)
 				{
-					user_io_set_ini(2);
+					out_set_ini(2);
 					osdbtn = 0;
 					return;
 				}
@@ -1591,7 +1874,7 @@ static void joy_digital(int jnum, uint32_t mask, uint32_t code, char press, int
 			case JOY_DOWN:
 				if (cfg_switch)
 				{
-					user_io_set_ini(3);
+					out_set_ini(3);
 					osdbtn = 0;
 					return;
 				}
@@ -1685,7 +1968,7 @@ static void joy_analog(int num, int axis, int offset)
 	{
 		num--;
 		pos[num][axis] = offset;
-		user_io_analog_joystick(num, (char)(pos[num][0]), (char)(pos[num][1]));
+		out_analog(num, (char)(pos[num][0]), (char)(pos[num][1]));
 	}
 }
 
@@ -1749,34 +2032,21 @@ void unflag_players()
 	}
 }
 
-static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int dev)
+static void input_kbdmap_load(int dev)
 {
-	if (ev->type != EV_KEY && ev->type != EV_ABS && ev->type != EV_REL) return;
-	if (ev->type == EV_KEY && (!ev->code || ev->code == KEY_UNKNOWN)) return;
-
-	static uint16_t last_axis = 0;
-
-	int sub_dev = dev;
-
-	//check if device is a part of multifunctional device
-	if (input[dev].bind >= 0) dev = input[dev].bind;
-
-	//mouse
-	if (ev->type == EV_KEY && ev->code >= BTN_MOUSE && ev->code < BTN_JOYSTICK)
+	if (!input[dev].has_kbdmap)
 	{
-		//skip it. we use /dev/input/mice
-		return;
+		if (!FileLoadConfig(get_kbdmap_name(dev), &input[dev].kbdmap, sizeof(input[dev].kbdmap)))
+		{
+			memset(input[dev].kbdmap, 0, sizeof(input[dev].kbdmap));
+		}
+		input[dev].has_kbdmap = 1;
 	}
+}
 
-	static int key_mapped = 0;
-
-	if (ev->type == EV_KEY && mapping && mapping_type == 3 && ev->code == input[dev].mmap[SYS_BTN_OSD_KTGL + 1]) ev->code = KEY_ENTER;
-
-	int map_skip = (ev->type == EV_KEY && ((ev->code == KEY_SPACE && mapping_type == 1) || ev->code == KEY_ALTERASE) && (mapping_dev >= 0 || mapping_button<0));
-	int cancel   = (ev->type == EV_KEY && ev->code == KEY_ESC);
-	int enter    = (ev->type == EV_KEY && ev->code == KEY_ENTER);
-	int origcode = ev->code;
-
+// load the maps of a device (or guess them) before its first event
+static void input_map_load(int dev)
+{
 	if (!input[dev].has_mmap)
 	{
 		if (input[dev].quirk == QUIRK_TOUCHGUN)
@@ -1801,6 +2071,7 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 
 	if (!input[dev].has_map)
 	{
+		map_lut[dev].valid = 0;
 		if (input[dev].quirk == QUIRK_PDSP || input[dev].quirk == QUIRK_MSSP)
 		{
 			memset(input[dev].map, 0, sizeof(input[dev].map));
@@ -1825,6 +2096,48 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 		}
 		input[dev].has_map++;
 	}
+}
+
+// the input thread doesn't touch the config files: maps of the devices
+// it reads are loaded before it gets them
+static void input_rt_map_load(int i)
+{
+	if (input[i].mouse) return;
+
+	int dev = (input[i].bind >= 0) ? input[i].bind : i;
+	input_map_load(dev);
+	input_kbdmap_load(dev);
+}
+
+static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int dev)
+{
+	if (ev->type != EV_KEY && ev->type != EV_ABS && ev->type != EV_REL) return;
+	if (ev->type == EV_KEY && (!ev->code || ev->code == KEY_UNKNOWN)) return;
+
+	static uint16_t last_axis = 0;
+
+	int sub_dev = dev;
+
+	//check if device is a part of multifunctional device
+	if (input[dev].bind >= 0) dev = input[dev].bind;
+
+	//mouse
+	if (ev->type == EV_KEY && ev->code >= BTN_MOUSE && ev->code < BTN_JOYSTICK)
+	{
+		//skip it. we use /dev/input/mice
+		return;
+	}
+
+	static int key_mapped = 0;
+
+	if (ev->type == EV_KEY && mapping && mapping_type == 3 && ev->code == input[dev].mmap[SYS_BTN_OSD_KTGL + 1]) ev->code = KEY_ENTER;
+
+	int map_skip = (ev->type == EV_KEY && ((ev->code == KEY_SPACE && mapping_type == 1) || ev->code == KEY_ALTERASE) && (mapping_dev >= 0 || mapping_button<0));
+	int cancel   = (ev->type == EV_KEY && ev->code == KEY_ESC);
+	int enter    = (ev->type == EV_KEY && ev->code == KEY_ENTER);
+	int origcode = ev->code;
+
+	input_map_load(dev);
 
 	if (!input[dev].num)
 	{
@@ -1874,11 +2187,11 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 			{
 				char str[32];
 				sprintf(str, "P%d paddle/spinner", input[dev].num);
-				Info(str, cfg.controller_info * 1000);
+				out_info(str, cfg.controller_info * 1000);
 			}
 			else
 			{
-				map_joystick_show(input[dev].map, input[dev].mmap, input[dev].num);
+				out_map_show(dev);
 			}
 		}
 	}
@@ -1933,6 +2246,7 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 		&& input[dev].quirk != QUIRK_MSSP)
 	{
 		int idx = 0;
+		map_lut_reset();
 
 		if (is_menu())
 		{
@@ -2255,7 +2569,7 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 					if (osd_event == 1)
 					{
 						input[dev].lightgun = !input[dev].lightgun;
-						Info(input[dev].lightgun ? "Light Gun mode is ON" : "Light Gun mode is OFF");
+						out_info(input[dev].lightgun ? "Light Gun mode is ON" : "Light Gun mode is OFF");
 					}
 				}
 				else
@@ -2375,13 +2689,14 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 
 					if (input[dev].has_map >= 2)
 					{
-						if (input[dev].has_map == 3) Info("This joystick is not defined");
+						if (input[dev].has_map == 3) out_info("This joystick is not defined");
 						input[dev].has_map = 1;
 					}
 
-					for (uint i = 0; i < BTN_NUM; i++)
+					uint32_t mask = map_btn(dev, ev->code);
+					for (uint i = 0; mask; i++, mask >>= 1)
 					{
-						if (ev->code == (input[dev].map[i] & 0xFFFF) || ev->code == (input[dev].map[i] >> 16))
+						if (mask & 1)
 						{
 							if (i <= 3 && origcode == ev->code) origcode = 0; // prevent autofire for original dpad
 							if (ev->value <= 1) joy_digital(input[dev].num, 1 << i, origcode, ev->value, i, (ev->code == input[dev].mmap[SYS_BTN_OSD_KTGL + 1] || ev->code == input[dev].mmap[SYS_BTN_OSD_KTGL + 2]));
@@ -2414,14 +2729,7 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 			// keyboard
 			else
 			{
-				if (!input[dev].has_kbdmap)
-				{
-					if (!FileLoadConfig(get_kbdmap_name(dev), &input[dev].kbdmap, sizeof(input[dev].kbdmap)))
-					{
-						memset(input[dev].kbdmap, 0, sizeof(input[dev].kbdmap));
-					}
-					input[dev].has_kbdmap = 1;
-				}
+				input_kbdmap_load(dev);
 
 				uint16_t code = ev->code;
 				if (code < 256 && input[dev].kbdmap[code]) code = input[dev].kbdmap[code];
@@ -2440,20 +2748,18 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 
 				uint16_t reset_m = (modifier & MODMASK) >> 8;
 				if (code == 111) reset_m |= 0x100;
-				user_io_check_reset(reset_m, (keyrah && !cfg.reset_combo) ? 1 : cfg.reset_combo);
+				out_check_reset(reset_m, (keyrah && !cfg.reset_combo) ? 1 : cfg.reset_combo);
 
 				if(!user_io_osd_is_visible() && ((user_io_get_kbdemu() == EMU_JOY0) || (user_io_get_kbdemu() == EMU_JOY1)) && !video_fb_state())
 				{
 					if (!kbd_toggle)
 					{
-						for (uint i = 0; i < BTN_NUM; i++)
+						int i = map_kbd(dev, ev->code);
+						if (i >= 0)
 						{
-							if (ev->code == input[dev].map[i])
-							{
-								if (i <= 3 && origcode == ev->code) origcode = 0; // prevent autofire for original dpad
-								if (ev->value <= 1) joy_digital((user_io_get_kbdemu() == EMU_JOY0) ? 1 : 2, 1 << i, origcode, ev->value, i);
-								return;
-							}
+							if (i <= 3 && origcode == ev->code) origcode = 0; // prevent autofire for original dpad
+							if (ev->value <= 1) joy_digital((user_io_get_kbdemu() == EMU_JOY0) ? 1 : 2, 1 << i, origcode, ev->value, i);
+							return;
 						}
 					}
 
@@ -2525,7 +2831,7 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 				}
 
 				if (code == KEY_HOMEPAGE) code = KEY_MENU;
-				user_io_kbd(code, ev->value);
+				out_kbd(code, ev->value);
 				return;
 			}
 			break;
@@ -2544,7 +2850,7 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 					{
 						value -= absinfo->minimum;
 						value = (value * 255) / (absinfo->maximum - absinfo->minimum);
-						user_io_analog_joystick(((input[dev].num - 1) << 4) | 0xF, value, 0);
+						out_analog(((input[dev].num - 1) << 4) | 0xF, value, 0);
 					}
 					break;
 				}
@@ -2632,7 +2938,7 @@ static void input_cb(struct input_event *ev, struct input_absinfo *absinfo, int
 					if (ev->value < -128) value = -128;
 					else if (ev->value > 127) value = 127;
 
-					user_io_analog_joystick(((input[dev].num - 1) << 4) | 0x8F, value, 0);
+					out_analog(((input[dev].num - 1) << 4) | 0x8F, value, 0);
 				}
 			}
 			break;
@@ -2656,6 +2962,68 @@ void send_map_cmd(int key)
 #define LED_MONITOR "/sys/class/leds/hps_led0/brightness_hw_changed"
 
 static struct pollfd pool[NUMDEV + 3];
+static uint32_t pool_gen = 0;
+static struct timeval input_ev_time = {};
+
+// Optional input thread (input_thread=1). While a core runs with the OSD
+// closed it owns the device fds and sends joystick/keyboard state as soon as
+// an event arrives; everything else goes through rt_queue to input_poll().
+// input_mutex serializes it with input_poll().
+#define INPUT_RT_PRIO    40   // below the IRQ threads
+#define INPUT_RT_CPU     0    // main loop is pinned to core 1
+#define INPUT_RT_WAIT_MS 10
+
+static pthread_mutex_t input_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t input_rt_cond = PTHREAD_COND_INITIALIZER;
+static int rt_started = 0;
+static int rt_active = 0;
+
+struct input_lat
+{
+	uint64_t num;
+	uint64_t sum_us;
+	uint32_t max_us;
+};
+
+static input_lat lat_stat[2] = {};  // main loop, input thread
+
+// evdev stamps events with CLOCK_REALTIME
+static void input_lat_done()
+{
+	trace_input(TRACE_INPUT_LAT, &input_ev_time);
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	int64_t lat = (int64_t)(now.tv_sec - input_ev_time.tv_sec) * 1000000 + (now.tv_usec - input_ev_time.tv_usec);
+	input_ev_time.tv_sec = 0;
+	if (lat < 0 || lat > 1000000) return;
+
+	input_lat *st = &lat_stat[rt_self];
+	st->num++;
+	st->sum_us += lat;
+	if (st->max_us < lat) st->max_us = lat;
+}
+
+// CMD_FIFO "input_stats"
+static void input_print_stats()
+{
+	static const char *name[2] = { "main loop", "input thread" };
+
+	for (int i = 0; i < 2; i++)
+	{
+		input_lat *st = &lat_stat[i];
+		if (!st->num) continue;
+		printf("input: %s latency: events: %llu, avg: %lluus, max: %uus\n", name[i],
+			(unsigned long long)st->num, (unsigned long long)(st->sum_us / st->num), st->max_us);
+	}
+}
+
+const struct pollfd *input_pollfds(int *num, uint32_t *gen)
+{
+	*num = NUMDEV + 3;
+	*gen = pool_gen;
+	return pool;
+}
 
 // add sequential suffixes for non-merged devices
 void make_unique(uint16_t vid, uint16_t pid, int type)
@@ -2932,7 +3300,7 @@ void touchscreen_proc(int dev, input_event *ev)
 
 			if (input[dev].lightgun)
 			{
-				menu_lightgun_cb(i, EV_KEY, 0x131, 0);
+				out_lightgun(i, EV_KEY, 0x131, 0);
 			}
 			else
 			{
@@ -2952,7 +3320,7 @@ void touchscreen_proc(int dev, input_event *ev)
 		mice_btn = 0;
 		mouse_cb(mice_btn);
 		input[dev].lightgun = !input[dev].lightgun;
-		Info(input[dev].lightgun ? "Light Gun mode is ON" : "Light Gun mode is OFF");
+		out_info(input[dev].lightgun ? "Light Gun mode is ON" : "Light Gun mode is OFF");
 	}
 
 	if (input[dev].lightgun)
@@ -2961,7 +3329,7 @@ void touchscreen_proc(int dev, input_event *ev)
 		{
 			mice_btn |= 1;
 			mouse_cb(mice_btn);
-			menu_lightgun_cb(i, EV_KEY, 0x131, 1);
+			out_lightgun(i, EV_KEY, 0x131, 1);
 		}
 		else if (ev->type == EV_ABS)
 		{
@@ -2970,7 +3338,7 @@ void touchscreen_proc(int dev, input_event *ev)
 				ev->code = ABS_X;
 				absinfo.minimum = input[i].guncal[2];
 				absinfo.maximum = input[i].guncal[3];
-				menu_lightgun_cb(i, ev->type, ev->code, ev->value);
+				out_lightgun(i, ev->type, ev->code, ev->value);
 				input_cb(ev, &absinfo, i);
 			}
 			else if (ev->code == ABS_MT_POSITION_Y)
@@ -2978,7 +3346,7 @@ void touchscreen_proc(int dev, input_event *ev)
 				ev->code = ABS_Y;
 				absinfo.minimum = input[i].guncal[0];
 				absinfo.maximum = input[i].guncal[1];
-				menu_lightgun_cb(i, ev->type, ev->code, ev->value);
+				out_lightgun(i, ev->type, ev->code, ev->value);
 				input_cb(ev, &absinfo, i);
 			}
 			else if (ev->code == ABS_MT_SLOT && (input[i].misc_flags & 0x80))
@@ -3038,731 +3406,1336 @@ void touchscreen_proc(int dev, input_event *ev)
 
 }
 
-int input_test(int getchar)
+// open /dev/input/<name> into slot n, 0 if the device is not used
+static int input_open_dev(int n, const char *name)
 {
-	static char cur_leds = 0;
-	static int state = 0;
-	struct input_absinfo absinfo;
-	struct input_event ev;
-
-	if (touch_rel && CheckTimer(touch_rel))
-	{
-		touch_rel = 0;
-		mice_btn = 0;
-		mouse_cb(mice_btn);
-	}
+	memset(&input[n], 0, sizeof(input[n]));
+	sprintf(input[n].devname, "/dev/input/%s", name);
+	int fd = open(input[n].devname, O_RDWR);
+	//printf("open(%s): %d\n", input[n].devname, fd);
 
-	if (state == 0)
+	if (fd > 0)
 	{
-		input_uinp_setup();
-		memset(pool, -1, sizeof(pool));
+		pool[n].fd = fd;
+		pool[n].events = POLLIN;
+		input[n].mouse = !strncmp(name, "mouse", 5);
 
-		signal(SIGINT, INThandler);
-		pool[NUMDEV].fd = set_watch();
-		pool[NUMDEV].events = POLLIN;
-
-		unlink(CMD_FIFO);
-		mkfifo(CMD_FIFO, 0666);
+		char uniq[32] = {};
+		if (!input[n].mouse)
+		{
+			struct input_id id;
+			memset(&id, 0, sizeof(id));
+			ioctl(pool[n].fd, EVIOCGID, &id);
+			input[n].vid = id.vendor;
+			input[n].pid = id.product;
+
+			ioctl(pool[n].fd, EVIOCGUNIQ(sizeof(uniq)), uniq);
+			ioctl(pool[n].fd, EVIOCGNAME(sizeof(input[n].name)), input[n].name);
+			input[n].led = has_led(pool[n].fd);
+		}
 
-		pool[NUMDEV+1].fd = open(CMD_FIFO, O_RDWR | O_NONBLOCK);
-		pool[NUMDEV+1].events = POLLIN;
+		//skip our virtual device
+		if (!strcmp(input[n].name, UINPUT_NAME))
+		{
+			close(pool[n].fd);
+			pool[n].fd = -1;
+			return 0;
+		}
 
-		pool[NUMDEV + 2].fd = open(LED_MONITOR, O_RDONLY);
-		pool[NUMDEV + 2].events = POLLPRI;
+		input[n].bind = -1;
 
-		state++;
-	}
+		// enable scroll wheel reading
+		if (input[n].mouse)
+		{
+			unsigned char buffer[4];
+			static const unsigned char mousedev_imps_seq[] = { 0xf3, 200, 0xf3, 100, 0xf3, 80 };
+			if (write(pool[n].fd, mousedev_imps_seq, sizeof(mousedev_imps_seq)) != sizeof(mousedev_imps_seq))
+			{
+				printf("Cannot switch %s to ImPS/2 protocol(1)\n", input[n].devname);
+			}
+			else if (read(pool[n].fd, buffer, sizeof buffer) != 1 || buffer[0] != 0xFA)
+			{
+				printf("Failed to switch %s to ImPS/2 protocol(2)\n", input[n].devname);
+			}
+		}
 
-	if (state == 1)
-	{
-		printf("Open up to %d input devices.\n", NUMDEV);
-		for (int i = 0; i < NUMDEV; i++)
+		if (strcasestr(input[n].name, "Wiimote") && input[n].vid == 1 && input[n].pid == 1)
 		{
-			pool[i].fd = -1;
-			pool[i].events = 0;
+			input[n].quirk = QUIRK_CWIID;
+			input[n].lightgun = 1;
 		}
 
-		memset(input, 0, sizeof(input));
+		// RasPad3 touchscreen
+		if (input[n].vid == 0x222a && input[n].pid == 1)
+		{
+			input[n].quirk = QUIRK_TOUCHGUN;
+			input[n].num = 1;
+			input[n].map_shown = 1;
+
+			input[n].lightgun = 0;
+			input[n].guncal[0] = 0;
+			input[n].guncal[1] = 16383;
+			input[n].guncal[2] = 2047;
+			input[n].guncal[3] = 14337;
+			input_lightgun_load(n);
+		}
 
-		int n = 0;
-		DIR *d = opendir("/dev/input");
-		if (d)
+		if (input[n].vid == 0x054c)
 		{
-			struct dirent *de;
-			while ((de = readdir(d)))
+			if (input[n].pid == 0x0268)  input[n].quirk = QUIRK_DS3;
+			else if (input[n].pid == 0x05c4 || input[n].pid == 0x09cc || input[n].pid == 0x0ba0 || input[n].pid == 0x0ce6)
 			{
-				if (!strncmp(de->d_name, "event", 5) || !strncmp(de->d_name, "mouse", 5))
+				input[n].quirk = QUIRK_DS4;
+				if (strcasestr(input[n].name, "Touchpad"))
 				{
-					memset(&input[n], 0, sizeof(input[n]));
-					sprintf(input[n].devname, "/dev/input/%s", de->d_name);
-					int fd = open(input[n].devname, O_RDWR);
-					//printf("open(%s): %d\n", input[n].devname, fd);
-
-					if (fd > 0)
-					{
-						pool[n].fd = fd;
-						pool[n].events = POLLIN;
-						input[n].mouse = !strncmp(de->d_name, "mouse", 5);
-
-						char uniq[32] = {};
-						if (!input[n].mouse)
-						{
-							struct input_id id;
-							memset(&id, 0, sizeof(id));
-							ioctl(pool[n].fd, EVIOCGID, &id);
-							input[n].vid = id.vendor;
-							input[n].pid = id.product;
-
-							ioctl(pool[n].fd, EVIOCGUNIQ(sizeof(uniq)), uniq);
-							ioctl(pool[n].fd, EVIOCGNAME(sizeof(input[n].name)), input[n].name);
-							input[n].led = has_led(pool[n].fd);
-						}
-
-						//skip our virtual device
-						if (!strcmp(input[n].name, UINPUT_NAME))
-						{
-							close(pool[n].fd);
-							pool[n].fd = -1;
-							continue;
-						}
+					input[n].quirk = QUIRK_DS4TOUCH;
+				}
+			}
+		}
 
-						input[n].bind = -1;
+		if (input[n].vid == 0x0079 && input[n].pid == 0x1802)
+		{
+			input[n].lightgun = 1;
+			input[n].num = 2; // force mayflash mode 1/2 as second joystick.
+		}
 
-						// enable scroll wheel reading
-						if (input[n].mouse)
-						{
-							unsigned char buffer[4];
-							static const unsigned char mousedev_imps_seq[] = { 0xf3, 200, 0xf3, 100, 0xf3, 80 };
-							if (write(pool[n].fd, mousedev_imps_seq, sizeof(mousedev_imps_seq)) != sizeof(mousedev_imps_seq))
-							{
-								printf("Cannot switch %s to ImPS/2 protocol(1)\n", input[n].devname);
-							}
-							else if (read(pool[n].fd, buffer, sizeof buffer) != 1 || buffer[0] != 0xFA)
+		if (input[n].vid == 0x057e && (input[n].pid == 0x0306 || input[n].pid == 0x0330))
+		{
+			if (strcasestr(input[n].name, "Accelerometer"))
+			{
+				// don't use Accelerometer
+				close(pool[n].fd);
+				pool[n].fd = -1;
+				return 0;
+			}
+			else if (strcasestr(input[n].name, "Motion Plus"))
+			{
+				// don't use Accelerometer
+				close(pool[n].fd);
+				pool[n].fd = -1;
+				return 0;
+			}
+			else
+			{
+				input[n].quirk = QUIRK_WIIMOTE;
+				input[n].guncal[0] = 0;
+				input[n].guncal[1] = 767;
+				input[n].guncal[2] = 1;
+				input[n].guncal[3] = 1023;
+				input_lightgun_load(n);
+			}
+		}
+
+		//Ultimarc lightgun
+		if (input[n].vid == 0xd209 && input[n].pid == 0x1601)
+		{
+			input[n].lightgun = 1;
+		}
+
+		//Madcatz Arcade Stick 360
+		if (input[n].vid == 0x0738 && input[n].pid == 0x4758) input[n].quirk = QUIRK_MADCATZ360;
+
+		// mr.Spinner
+		// 0x120  - Button
+		// Axis 7 - EV_REL is spinner
+		// Axis 8 - EV_ABS is Paddle
+		// Overlays on other existing gamepads
+		if (strstr(uniq, "MiSTer-S1")) input[n].quirk = QUIRK_PDSP;
+
+		// Arcade with spinner and/or paddle:
+		// Axis 7 - EV_REL is spinner
+		// Axis 8 - EV_ABS is Paddle
+		// Includes other buttons and axes, works as a full featured gamepad.
+		if (strstr(uniq, "MiSTer-A1")) input[n].quirk = QUIRK_PDSP_ARCADE;
+
+		//Jamma
+		if (cfg.jamma_vid && cfg.jamma_pid && input[n].vid == cfg.jamma_vid && input[n].pid == cfg.jamma_pid)
+		{
+			input[n].quirk = QUIRK_JAMMA;
+		}
+
+		//Arduino and Teensy devices may share the same VID:PID, so additional field UNIQ is used to differentiate them
+		if ((input[n].vid == 0x2341 || (input[n].vid == 0x16C0 && (input[n].pid>>8) == 0x4)) && strlen(uniq))
+		{
+			snprintf(input[n].idstr, sizeof(input[n].idstr), "%04x_%04x_%s", input[n].vid, input[n].pid, uniq);
+			char *p;
+			while ((p = strchr(input[n].idstr, '/'))) *p = '_';
+			while ((p = strchr(input[n].idstr, ' '))) *p = '_';
+			while ((p = strchr(input[n].idstr, '*'))) *p = '_';
+			while ((p = strchr(input[n].idstr, ':'))) *p = '_';
+			strcpy(input[n].name, uniq);
+		}
+		else
+		{
+			snprintf(input[n].idstr, sizeof(input[n].idstr), "%04x_%04x", input[n].vid, input[n].pid);
+		}
+
+		ioctl(pool[n].fd, EVIOCGRAB, (grabbed | user_io_osd_is_visible()) ? 1 : 0);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static void map_cache_put(int dev)
+{
+	if (input[dev].mouse || !input[dev].idstr[0] || (!input[dev].has_map && !input[dev].has_mmap)) return;
+
+	int n = 0;
+	while (n < map_cache_num && strcmp(map_cache[n].idstr, input[dev].idstr)) n++;
+	if (n == MAP_CACHE_NUM)
+	{
+		// drop the oldest
+		memmove(map_cache, map_cache + 1, sizeof(mapCache) * (MAP_CACHE_NUM - 1));
+		n--;
+	}
+	if (n == map_cache_num) map_cache_num++;
+
+	mapCache *mc = &map_cache[n];
+	strcpy(mc->idstr, input[dev].idstr);
+	mc->has_map = input[dev].has_map;
+	mc->has_mmap = input[dev].has_mmap;
+	mc->has_kbdmap = input[dev].has_kbdmap;
+	memcpy(mc->map, input[dev].map, sizeof(mc->map));
+	memcpy(mc->mmap, input[dev].mmap, sizeof(mc->mmap));
+	memcpy(mc->kbdmap, input[dev].kbdmap, sizeof(mc->kbdmap));
+}
+
+static void map_cache_get(int dev)
+{
+	for (int n = 0; n < map_cache_num; n++)
+	{
+		mapCache *mc = &map_cache[n];
+		if (strcmp(mc->idstr, input[dev].idstr)) continue;
+
+		input[dev].has_map = mc->has_map;
+		input[dev].has_mmap = mc->has_mmap;
+		input[dev].has_kbdmap = mc->has_kbdmap;
+		memcpy(input[dev].map, mc->map, sizeof(mc->map));
+		memcpy(input[dev].mmap, mc->mmap, sizeof(mc->mmap));
+		memcpy(input[dev].kbdmap, mc->kbdmap, sizeof(mc->kbdmap));
+		return;
+	}
+}
+
+static void input_close_dev(int dev)
+{
+	map_cache_put(dev);
+
+	ioctl(pool[dev].fd, EVIOCGRAB, 0);
+	close(pool[dev].fd);
+	pool[dev].fd = -1;
+	pool[dev].events = 0;
+
+	memset(&input[dev], 0, sizeof(input[dev]));
+	input[dev].bind = -1;
+	map_lut[dev].valid = 0;
+}
+
+// open/close only the devices in hotplug[], 0 if all have to be reopened
+static int input_hotplug()
+{
+	int added[NUMDEV] = {};
+	int changed = 0;
+
+	for (int k = 0; k < hotplug_num; k++)
+	{
+		char devname[64];
+		sprintf(devname, "/dev/input/%s", hotplug[k].name);
+
+		int dev = -1;
+		for (int i = 0; i < NUMDEV; i++) if (pool[i].fd >= 0 && !strcmp(input[i].devname, devname)) dev = i;
+
+		if (!hotplug[k].add)
+		{
+			if (dev < 0) continue;
+
+			printf("closed %d: %s \"%s\"\n", dev, input[dev].devname, input[dev].name);
+			input_close_dev(dev);
+			added[dev] = 0;
+			changed = 1;
+		}
+		else if (dev < 0)
+		{
+			int n = 0;
+			while (n < NUMDEV && pool[n].fd >= 0) n++;
+			if (n >= NUMDEV) return 0;
+
+			if (input_open_dev(n, hotplug[k].name))
+			{
+				map_cache_get(n);
+				map_lut[n].valid = 0;
+				if (rt_active) pool[n].events = 0;
+				added[n] = 1;
+				changed = 1;
+			}
+		}
+	}
+
+	if (!changed) return 1;
+
+	// bindings of the other devices are kept, player numbers stay with their devices
+	mergedevs();
+	for (int i = 0; i < NUMDEV; i++)
+	{
+		if (!added[i]) continue;
+
+		printf("opened %d(%2d): %s (%04x:%04x) %d \"%s\" \"%s\"\n", i, input[i].bind, input[i].devname, input[i].vid, input[i].pid, input[i].quirk, input[i].id, input[i].name);
+		restore_player(i);
+	}
+	unflag_players();
+
+	// with the bindings known, before pool_gen hands the new fds to the thread
+	if (rt_active) for (int i = 0; i < NUMDEV; i++) if (added[i]) input_rt_map_load(i);
+
+	pool_gen++;
+	return 1;
+}
+
+// Input record/replay through CMD_FIFO:
+//   input_rec [file] | input_rec stop
+//   input_play [file] | input_play stop | input_play bench [file]
+// Recording keeps every event passed from the devices to input_cb() with its
+// absinfo and the identity of the devices. Replay feeds them to input_cb()
+// again, in real time (autofire and input_poll() timing included) or as fast
+// as possible with the core output hashed (bench). The bench runs the stream
+// with and without the map tables and compares the output, then times
+// mergedevs().
+// The file also holds the input state, cfg and UI state at the start of the
+// recording, so it can be replayed off the board by input_replay() (FPGA_SIM
+// build, tests/input_replay.cpp). Fields have fixed sizes for that reason.
+#define REC_FILE "/tmp/MiSTer_input.rec"
+
+struct play_state
+{
+	devInput input[NUMDEV];
+	devInput player_pad[NUMPLAYERS];
+	devInput player_pdsp[NUMPLAYERS];
+	uint32_t joy[NUMPLAYERS];
+	uint32_t autofire[NUMPLAYERS];
+	uint32_t autofirecodes[NUMPLAYERS][BTN_NUM];
+	int      af_delay[NUMPLAYERS];
+	uint32_t modifier;
+	int      kbd_toggle;
+	int      mouse_emu, kbd_mouse_emu, mouse_sniper;
+	int      mouse_emu_x, mouse_emu_y;
+	unsigned char mouse_btn;
+	uint32_t mouse_timer;
+};
+
+struct rec_header
+{
+	char     magic[4];
+	uint32_t devs;
+	uint32_t state_size; // play_state and cfg_t follow the header,
+	uint32_t cfg_size;   // then devs x rec_dev, then the events
+	input_rec_ui ui;
+};
+
+struct rec_dev
+{
+	int32_t  idx;
+	uint16_t vid, pid;
+	int32_t  quirk;
+	char     idstr[256];
+};
+
+struct rec_event
+{
+	uint64_t ts;      // us from the start of the recording
+	int32_t  dev;
+	int32_t  has_abs;
+	uint16_t type, code;
+	int32_t  value;
+	struct input_absinfo abs;
+};
+
+static FILE *rec_file = 0;
+static uint64_t rec_start = 0;
+static uint32_t rec_num = 0;
+
+static rec_event *play_ev = 0;
+static uint32_t play_num = 0;
+static uint32_t play_pos = 0;
+static uint32_t play_skip = 0;
+static uint64_t play_start = 0;
+static int play_dev[NUMDEV];
+
+static void play_state_save(play_state *st)
+{
+	memcpy(st->input, input, sizeof(input));
+	memcpy(st->player_pad, player_pad, sizeof(player_pad));
+	memcpy(st->player_pdsp, player_pdsp, sizeof(player_pdsp));
+	memcpy(st->joy, joy, sizeof(joy));
+	memcpy(st->autofire, autofire, sizeof(autofire));
+	memcpy(st->autofirecodes, autofirecodes, sizeof(autofirecodes));
+	memcpy(st->af_delay, af_delay, sizeof(af_delay));
+	st->modifier = modifier;
+	st->kbd_toggle = kbd_toggle;
+	st->mouse_emu = mouse_emu;
+	st->kbd_mouse_emu = kbd_mouse_emu;
+	st->mouse_sniper = mouse_sniper;
+	st->mouse_emu_x = mouse_emu_x;
+	st->mouse_emu_y = mouse_emu_y;
+	st->mouse_btn = mouse_btn;
+	st->mouse_timer = mouse_timer;
+}
+
+static void play_state_restore(const play_state *st)
+{
+	memcpy(input, st->input, sizeof(input));
+	memcpy(player_pad, st->player_pad, sizeof(player_pad));
+	memcpy(player_pdsp, st->player_pdsp, sizeof(player_pdsp));
+	memcpy(joy, st->joy, sizeof(joy));
+	memcpy(autofire, st->autofire, sizeof(autofire));
+	memcpy(autofirecodes, st->autofirecodes, sizeof(autofirecodes));
+	memcpy(af_delay, st->af_delay, sizeof(af_delay));
+	modifier = st->modifier;
+	kbd_toggle = st->kbd_toggle;
+	mouse_emu = st->mouse_emu;
+	kbd_mouse_emu = st->kbd_mouse_emu;
+	mouse_sniper = st->mouse_sniper;
+	mouse_emu_x = st->mouse_emu_x;
+	mouse_emu_y = st->mouse_emu_y;
+	mouse_btn = st->mouse_btn;
+	mouse_timer = st->mouse_timer;
+	map_lut_reset();
+}
+
+static void input_dev_cb(struct input_event *ev, struct input_absinfo *absinfo, int dev)
+{
+	if (rec_file)
+	{
+		rec_event rec = {};
+		rec.ts = trace_time() - rec_start;
+		rec.dev = dev;
+		rec.type = ev->type;
+		rec.code = ev->code;
+		rec.value = ev->value;
+		if (absinfo)
+		{
+			rec.has_abs = 1;
+			rec.abs = *absinfo;
+		}
+		fwrite(&rec, sizeof(rec), 1, rec_file);
+		rec_num++;
+	}
+
+	input_cb(ev, absinfo, dev);
+}
+
+static void input_rec_stop()
+{
+	if (!rec_file) return;
+
+	fclose(rec_file);
+	rec_file = 0;
+	printf("input_rec: %u events recorded.\n", rec_num);
+}
+
+static void input_rec_start(const char *name)
+{
+	input_rec_stop();
+
+	play_state *st = (play_state*)malloc(sizeof(play_state));
+	if (!st)
+	{
+		printf("input_rec: no memory\n");
+		return;
+	}
+
+	rec_file = fopen(name, "wb");
+	if (!rec_file)
+	{
+		printf("input_rec: cannot create %s\n", name);
+		free(st);
+		return;
+	}
+
+	rec_header hdr = {};
+	memcpy(hdr.magic, "MIR2", 4);
+	for (int i = 0; i < NUMDEV; i++) if (pool[i].fd >= 0 && !input[i].mouse) hdr.devs++;
+	hdr.state_size = sizeof(play_state);
+	hdr.cfg_size = sizeof(cfg_t);
+	hdr.ui.menu = is_menu();
+	hdr.ui.osd = user_io_osd_is_visible();
+	hdr.ui.fb = video_fb_state();
+	hdr.ui.api1_5 = hasAPI1_5();
+	hdr.ui.cfg_switch = menu_allow_cfg_switch();
+	hdr.ui.kbdemu = user_io_get_kbdemu();
+	fwrite(&hdr, sizeof(hdr), 1, rec_file);
+
+	play_state_save(st);
+	fwrite(st, sizeof(play_state), 1, rec_file);
+	fwrite(&cfg, sizeof(cfg_t), 1, rec_file);
+	free(st);
+
+	for (int i = 0; i < NUMDEV; i++)
+	{
+		if (pool[i].fd < 0 || input[i].mouse) continue;
+
+		rec_dev dev = {};
+		dev.idx = i;
+		dev.vid = input[i].vid;
+		dev.pid = input[i].pid;
+		dev.quirk = input[i].quirk;
+		strcpy(dev.idstr, input[i].idstr);
+		fwrite(&dev, sizeof(dev), 1, rec_file);
+	}
+
+	rec_num = 0;
+	rec_start = trace_time();
+	printf("input_rec: recording to %s\n", name);
+}
+
+static void input_play_stop()
+{
+	if (!play_ev) return;
+
+	free(play_ev);
+	play_ev = 0;
+	printf("input_play: %u of %u events played, %u for missing devices.\n", play_pos, play_num, play_skip);
+}
+
+// Recorded devices are matched by idstr (VID/PID/uniq), then by VID/PID.
+// offline: no devices are open, the recorded state is restored instead.
+static int input_play_load(const char *name, int offline)
+{
+	input_play_stop();
+
+	FILE *f = fopen(name, "rb");
+	if (!f)
+	{
+		printf("input_play: cannot open %s\n", name);
+		return 0;
+	}
+
+	rec_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, "MIR2", 4) || hdr.devs > NUMDEV)
+	{
+		printf("input_play: %s is not a recording.\n", name);
+		fclose(f);
+		return 0;
+	}
+
+	if (offline)
+	{
+		play_state *st = (hdr.state_size == sizeof(play_state) && hdr.cfg_size == sizeof(cfg_t)) ? (play_state*)malloc(sizeof(play_state)) : 0;
+		if (!st || fread(st, sizeof(play_state), 1, f) != 1 || fread(&cfg, sizeof(cfg_t), 1, f) != 1)
+		{
+			printf("input_play: %s was recorded by a different build.\n", name);
+			free(st);
+			fclose(f);
+			return 0;
+		}
+
+		play_state_restore(st);
+		free(st);
+#ifdef FPGA_SIM
+		input_replay_ui = hdr.ui;
+#endif
+	}
+	else
+	{
+		fseek(f, hdr.state_size + hdr.cfg_size, SEEK_CUR);
+	}
+
+	int used[NUMDEV] = {};
+	for (int i = 0; i < NUMDEV; i++) play_dev[i] = -1;
+
+	for (uint32_t k = 0; k < hdr.devs; k++)
+	{
+		rec_dev dev;
+		if (fread(&dev, sizeof(dev), 1, f) != 1) break;
+		if (dev.idx < 0 || dev.idx >= NUMDEV) continue;
+		dev.idstr[sizeof(dev.idstr) - 1] = 0;
+
+		if (offline)
+		{
+			play_dev[dev.idx] = dev.idx;
+			printf("input_play: %s -> recorded state\n", dev.idstr);
+			continue;
+		}
+
+		int found = -1;
+		for (int i = 0; i < NUMDEV && found < 0; i++)
+		{
+			if (pool[i].fd >= 0 && !input[i].mouse && !used[i] && !strcmp(input[i].idstr, dev.idstr)) found = i;
+		}
+
+		for (int i = 0; i < NUMDEV && found < 0; i++)
+		{
+			if (pool[i].fd >= 0 && !input[i].mouse && !used[i] && input[i].vid == dev.vid && input[i].pid == dev.pid) found = i;
+		}
+
+		if (found >= 0) used[found] = 1;
+		play_dev[dev.idx] = found;
+		printf("input_play: %s -> %s\n", dev.idstr, (found >= 0) ? input[found].devname : "not connected");
+	}
+
+	long pos = ftell(f);
+	fseek(f, 0, SEEK_END);
+	uint32_t num = (ftell(f) - pos) / sizeof(rec_event);
+	fseek(f, pos, SEEK_SET);
+
+	play_ev = num ? (rec_event*)malloc(num * sizeof(rec_event)) : 0;
+	if (play_ev) num = fread(play_ev, sizeof(rec_event), num, f);
+	fclose(f);
+
+	if (!play_ev || !num)
+	{
+		printf("input_play: no events in %s\n", name);
+		free(play_ev);
+		play_ev = 0;
+		return 0;
+	}
+
+	play_num = num;
+	play_pos = 0;
+	play_skip = 0;
+	return 1;
+}
+
+static void input_play_event(rec_event *rec)
+{
+	int dev = (rec->dev >= 0 && rec->dev < NUMDEV) ? play_dev[rec->dev] : -1;
+	if (dev < 0)
+	{
+		play_skip++;
+		return;
+	}
+
+	struct input_event ev = {};
+	ev.type = rec->type;
+	ev.code = rec->code;
+	ev.value = rec->value;
+	struct input_absinfo abs = rec->abs;
+	input_cb(&ev, rec->has_abs ? &abs : 0, dev);
+}
+
+// called from input_poll(): deliver the events that are due
+static void input_play_poll()
+{
+	if (!play_ev) return;
+
+	uint64_t t = trace_time() - play_start;
+	while (play_pos < play_num && play_ev[play_pos].ts <= t) input_play_event(&play_ev[play_pos++]);
+
+	if (play_pos >= play_num) input_play_stop();
+	else scheduler_wake_at(GetTimer((play_ev[play_pos].ts - t) / 1000));
+}
+
+// returns 0 when both passes produced the same output.
+// offline: no devices to merge, verbose: print the output of the first pass.
+static int input_play_bench(int offline, int verbose)
+{
+	play_state *st = (play_state*)malloc(sizeof(play_state));
+	if (!st)
+	{
+		printf("input_play: no memory\n");
+		return 1;
+	}
+
+	static const char *name[2] = { "tables", "scan" };
+	uint32_t sum[2];
+
+	play_state_save(st);
+	play_sink = 1;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		play_state_restore(st);
+		map_lut_off = pass;
+		play_verbose = verbose && !pass;
+		play_sum = 0;
+		play_out = 0;
+		play_skip = 0;
+
+		// joystick state is hashed on change, like input_poll() sends it
+		uint32_t prev[NUMPLAYERS];
+		memcpy(prev, joy, sizeof(prev));
+
+		uint64_t t = trace_time();
+		for (play_cur = 0; play_cur < play_num; play_cur++)
+		{
+			input_play_event(&play_ev[play_cur]);
+			for (int n = 0; n < NUMPLAYERS; n++)
+			{
+				if (joy[n] != prev[n]) play_sink_put(SINK_JOY, n, joy[n]);
+				prev[n] = joy[n];
+			}
+		}
+		t = trace_time() - t;
+
+		sum[pass] = play_sum;
+		printf("input_play: %s: %u events in %lluus (%llu/s), %u outputs, hash %08X\n", name[pass], play_num,
+			(unsigned long long)t, (unsigned long long)(t ? (uint64_t)play_num * 1000000 / t : 0), play_out, play_sum);
+	}
+
+	printf("input_play: output %s, %u events for missing devices.\n", (sum[0] == sum[1]) ? "matches" : "DIFFERS", play_skip);
+
+	if (!offline)
+	{
+		uint64_t t = trace_time();
+		for (int i = 0; i < 10; i++) mergedevs();
+		printf("input_play: mergedevs: %lluus\n", (unsigned long long)((trace_time() - t) / 10));
+	}
+
+	map_lut_off = 0;
+	play_verbose = 0;
+	play_sink = 0;
+	play_state_restore(st);
+	free(st);
+
+	return sum[0] != sum[1];
+}
+
+static const char *rec_arg(const char *arg)
+{
+	while (*arg == ' ') arg++;
+	return *arg ? arg : REC_FILE;
+}
+
+static void input_rec_cmd(const char *arg)
+{
+	while (*arg == ' ') arg++;
+	if (!strcmp(arg, "stop")) input_rec_stop();
+	else input_rec_start(rec_arg(arg));
+}
+
+static void input_play_cmd(const char *arg)
+{
+	while (*arg == ' ') arg++;
+	if (!strcmp(arg, "stop"))
+	{
+		input_play_stop();
+	}
+	else if (!strncmp(arg, "bench", 5))
+	{
+		if (input_play_load(rec_arg(arg + 5), 0))
+		{
+			input_play_bench(0, 0);
+			free(play_ev);
+			play_ev = 0;
+		}
+	}
+	else if (input_play_load(rec_arg(arg), 0))
+	{
+		printf("input_play: playing %u events.\n", play_num);
+		play_start = trace_time();
+	}
+}
+
+#ifdef FPGA_SIM
+input_rec_ui input_replay_ui = {};
+
+int input_replay(const char *name, int verbose)
+{
+	if (!input_play_load(name, 1)) return 1;
+
+	int ret = input_play_bench(1, verbose);
+	free(play_ev);
+	play_ev = 0;
+	return ret;
+}
+#endif
+
+// read and dispatch one pending event (or mouse packet) of device i
+static int input_read_dev(int i, int getchar)
+{
+	struct input_absinfo absinfo;
+	struct input_event ev;
+
+	if (!input[i].mouse)
+	{
+		memset(&ev, 0, sizeof(ev));
+		if (read(pool[i].fd, &ev, sizeof(ev)) == sizeof(ev))
+		{
+			if (getchar)
+			{
+				if (ev.type == EV_KEY && ev.value >= 1)
+				{
+					return ev.code;
+				}
+			}
+			else if (ev.type)
+			{
+				int dev = i;
+				if (input[dev].bind >= 0) dev = input[dev].bind;
+
+				if (ev.type != EV_SYN) input_ev_time = ev.time;
+
+				int noabs = 0;
+
+				if (input[i].quirk == QUIRK_DS4TOUCH && ev.type == EV_KEY)
+				{
+					if (ev.code == BTN_TOOL_FINGER || ev.code == BTN_TOUCH || ev.code == BTN_TOOL_DOUBLETAP) return 0;
+				}
+
+				if (input[i].quirk == QUIRK_MADCATZ360 && ev.type == EV_KEY)
+				{
+					if (ev.code == BTN_THUMBR) input[i].misc_flags = ev.value ? (input[i].misc_flags | 1) : (input[i].misc_flags & ~1);
+					else if (ev.code == BTN_MODE && !user_io_osd_is_visible())
+					{
+						if (input[i].misc_flags & 1)
+						{
+							if (ev.value)
 							{
-								printf("Failed to switch %s to ImPS/2 protocol(2)\n", input[n].devname);
+								if ((input[i].misc_flags & 0x6) == 0) input[i].misc_flags = 0x3; // X
+								else if ((input[i].misc_flags & 0x6) == 2) input[i].misc_flags = 0x5; // Y
+								else input[i].misc_flags = 0x1; // None
+
+								out_info(((input[i].misc_flags & 0x6) == 2) ? "Paddle mode" :
+									((input[i].misc_flags & 0x6) == 4) ? "Spinner mode" :
+									"Normal mode");
 							}
+							return 0;
 						}
+					}
+				}
 
-						if (strcasestr(input[n].name, "Wiimote") && input[n].vid == 1 && input[n].pid == 1)
-						{
-							input[n].quirk = QUIRK_CWIID;
-							input[n].lightgun = 1;
-						}
+				if (input[i].quirk == QUIRK_TOUCHGUN)
+				{
+					touchscreen_proc(i, &ev);
+					return 0;
+				}
 
-						// RasPad3 touchscreen
-						if (input[n].vid == 0x222a && input[n].pid == 1)
-						{
-							input[n].quirk = QUIRK_TOUCHGUN;
-							input[n].num = 1;
-							input[n].map_shown = 1;
-
-							input[n].lightgun = 0;
-							input[n].guncal[0] = 0;
-							input[n].guncal[1] = 16383;
-							input[n].guncal[2] = 2047;
-							input[n].guncal[3] = 14337;
-							input_lightgun_load(n);
-						}
+				if (ev.type == EV_ABS)
+				{
+					if (input[i].quirk == QUIRK_WIIMOTE)
+					{
+						//nunchuck accel events
+						if (ev.code >= 3 && ev.code <= 5) return 0;
+					}
 
-						if (input[n].vid == 0x054c)
+					//Dualshock: drop accelerator and raw touchpad events
+					if (input[i].quirk == QUIRK_DS4TOUCH && ev.code == 57)
+					{
+						input[dev].lightgun_req = (ev.value >= 0);
+					}
+
+					if ((input[i].quirk == QUIRK_DS4TOUCH || input[i].quirk == QUIRK_DS4 || input[i].quirk == QUIRK_DS3) && ev.code > 40)
+					{
+						return 0;
+					}
+
+					if (ioctl(pool[i].fd, EVIOCGABS(ev.code), &absinfo) < 0) memset(&absinfo, 0, sizeof(absinfo));
+					else
+					{
+						//DS4 specific: touchpad as lightgun
+						if (input[i].quirk == QUIRK_DS4TOUCH && ev.code <= 1)
 						{
-							if (input[n].pid == 0x0268)  input[n].quirk = QUIRK_DS3;
-							else if (input[n].pid == 0x05c4 || input[n].pid == 0x09cc || input[n].pid == 0x0ba0 || input[n].pid == 0x0ce6)
+							if (!input[dev].lightgun || user_io_osd_is_visible()) return 0;
+
+							if (ev.code == 1)
 							{
-								input[n].quirk = QUIRK_DS4;
-								if (strcasestr(input[n].name, "Touchpad"))
-								{
-									input[n].quirk = QUIRK_DS4TOUCH;
-								}
+								absinfo.minimum = 300;
+								absinfo.maximum = 850;
+							}
+							else if (ev.code == 0)
+							{
+								absinfo.minimum = 200;
+								absinfo.maximum = 1720;
 							}
+							else return 0;
 						}
 
-						if (input[n].vid == 0x0079 && input[n].pid == 0x1802)
+						if (input[i].quirk == QUIRK_DS4 && ev.code <= 1)
 						{
-							input[n].lightgun = 1;
-							input[n].num = 2; // force mayflash mode 1/2 as second joystick.
+							if (input[dev].lightgun) noabs = 1;
 						}
 
-						if (input[n].vid == 0x057e && (input[n].pid == 0x0306 || input[n].pid == 0x0330))
+						if (input[i].quirk == QUIRK_WIIMOTE)
 						{
-							if (strcasestr(input[n].name, "Accelerometer"))
+							input[dev].lightgun = 0;
+							if (absinfo.maximum == 1023 || absinfo.maximum == 767)
 							{
-								// don't use Accelerometer
-								close(pool[n].fd);
-								pool[n].fd = -1;
-								continue;
+								if (ev.code == 16)
+								{
+									ev.value = absinfo.maximum - ev.value;
+									ev.code = 0;
+									input[dev].lightgun = 1;
+								}
+								else if (ev.code == 17)
+								{
+									ev.code = 1;
+									input[dev].lightgun = 1;
+								}
+								// other 3 IR tracking aren't used
+								else return 0;
 							}
-							else if (strcasestr(input[n].name, "Motion Plus"))
+							else if (absinfo.maximum == 62)
 							{
-								// don't use Accelerometer
-								close(pool[n].fd);
-								pool[n].fd = -1;
-								continue;
+								//LT/RT analog
+								return 0;
 							}
-							else
+							else if (ev.code & 1)
 							{
-								input[n].quirk = QUIRK_WIIMOTE;
-								input[n].guncal[0] = 0;
-								input[n].guncal[1] = 767;
-								input[n].guncal[2] = 1;
-								input[n].guncal[3] = 1023;
-								input_lightgun_load(n);
+								//Y axes on wiimote and accessories are inverted
+								ev.value = -ev.value;
 							}
 						}
+					}
 
-						//Ultimarc lightgun
-						if (input[n].vid == 0xd209 && input[n].pid == 0x1601)
+					if (input[i].quirk == QUIRK_MADCATZ360 && (input[i].misc_flags & 0x6) && (ev.code == 16) && !user_io_osd_is_visible())
+					{
+						if (ev.value)
 						{
-							input[n].lightgun = 1;
-						}
-
-						//Madcatz Arcade Stick 360
-						if (input[n].vid == 0x0738 && input[n].pid == 0x4758) input[n].quirk = QUIRK_MADCATZ360;
-
-						// mr.Spinner
-						// 0x120  - Button
-						// Axis 7 - EV_REL is spinner
-						// Axis 8 - EV_ABS is Paddle
-						// Overlays on other existing gamepads
-						if (strstr(uniq, "MiSTer-S1")) input[n].quirk = QUIRK_PDSP;
+							if ((input[i].misc_flags & 0x6) == 2)
+							{
+								if (ev.value > 0) input[i].paddle_val += 4;
+								if (ev.value < 0) input[i].paddle_val -= 4;
 
-						// Arcade with spinner and/or paddle:
-						// Axis 7 - EV_REL is spinner
-						// Axis 8 - EV_ABS is Paddle
-						// Includes other buttons and axes, works as a full featured gamepad.
-						if (strstr(uniq, "MiSTer-A1")) input[n].quirk = QUIRK_PDSP_ARCADE;
+								if (input[i].paddle_val > 256) input[i].paddle_val = 256;
+								if (input[i].paddle_val < 0)   input[i].paddle_val = 0;
 
-						//Jamma
-						if (cfg.jamma_vid && cfg.jamma_pid && input[n].vid == cfg.jamma_vid && input[n].pid == cfg.jamma_pid)
-						{
-							input[n].quirk = QUIRK_JAMMA;
+								absinfo.maximum = 255;
+								absinfo.minimum = 0;
+								ev.code = 8;
+								ev.value = input[i].paddle_val;
+							}
+							else
+							{
+								ev.type = EV_REL;
+								ev.code = 7;
+							}
 						}
+						else return 0;
+					}
 
-						//Arduino and Teensy devices may share the same VID:PID, so additional field UNIQ is used to differentiate them
-						if ((input[n].vid == 0x2341 || (input[n].vid == 0x16C0 && (input[n].pid>>8) == 0x4)) && strlen(uniq))
+					if (input[i].quirk == QUIRK_CWIID)
+					{
+						if (ev.code == 3 || ev.code == 4)
 						{
-							snprintf(input[n].idstr, sizeof(input[n].idstr), "%04x_%04x_%s", input[n].vid, input[n].pid, uniq);
-							char *p;
-							while ((p = strchr(input[n].idstr, '/'))) *p = '_';
-							while ((p = strchr(input[n].idstr, ' '))) *p = '_';
-							while ((p = strchr(input[n].idstr, '*'))) *p = '_';
-							while ((p = strchr(input[n].idstr, ':'))) *p = '_';
-							strcpy(input[n].name, uniq);
+							absinfo.minimum = 30;
+							absinfo.maximum = 225;
 						}
-						else
+					}
+				}
+
+				if (input[dev].quirk == QUIRK_JAMMA && ev.type == EV_KEY)
+				{
+					input[dev].num = 0;
+					for (uint32_t i = 0; i <= sizeof(jamma2joy) / sizeof(jamma2joy[0]); i++)
+					{
+						if (jamma2joy[i].key == ev.code)
 						{
-							snprintf(input[n].idstr, sizeof(input[n].idstr), "%04x_%04x", input[n].vid, input[n].pid);
+							ev.code = jamma2joy[i].btn;
+							input[dev].num = jamma2joy[i].player;
+							break;
 						}
-
-						ioctl(pool[n].fd, EVIOCGRAB, (grabbed | user_io_osd_is_visible()) ? 1 : 0);
-
-						n++;
-						if (n >= NUMDEV) break;
 					}
 				}
-			}
-			closedir(d);
-
-			mergedevs();
-			for (int i = 0; i < n; i++)
-			{
-				printf("opened %d(%2d): %s (%04x:%04x) %d \"%s\" \"%s\"\n", i, input[i].bind, input[i].devname, input[i].vid, input[i].pid, input[i].quirk, input[i].id, input[i].name);
-				restore_player(i);
-			}
-			unflag_players();
-		}
-		cur_leds |= 0x80;
-		state++;
-	}
 
-	if (state == 2)
-	{
-		int timeout = 0;
-		if (is_menu() && video_fb_state()) timeout = 25;
-
-		while (1)
-		{
-			int return_value = poll(pool, NUMDEV + 3, timeout);
-			if (!return_value) break;
+				//Menu combo on 8BitDo receiver in PSC mode
+				if (input[dev].vid == 0x054c && input[dev].pid == 0x0cda && ev.type == EV_KEY)
+				{
+					//in PSC mode these keys coming from separate virtual keyboard device
+					//so it's impossible to use joystick codes as keyboards aren't personalized
+					if (ev.code == 164) ev.code = KEY_MENU;
+					if (ev.code == 1)   ev.code = KEY_MENU;
+				}
 
-			if (return_value < 0)
-			{
-				printf("ERR: poll\n");
-				break;
-			}
+				if (ev.type == EV_KEY && ev.code == KEY_BACK && input[dev].vid == 0x45E)
+				{
+					ev.code = BTN_SELECT;
+				}
 
-			if ((pool[NUMDEV].revents & POLLIN) && check_devs())
-			{
-				printf("Close all devices.\n");
-				for (int i = 0; i < NUMDEV; i++) if (pool[i].fd >= 0)
+				//Menu button quirk of 8BitDo gamepad in X-Input mode
+				if (input[dev].vid == 0x045e && input[dev].pid == 0x02e0 && ev.type == EV_KEY)
 				{
-					ioctl(pool[i].fd, EVIOCGRAB, 0);
-					close(pool[i].fd);
+					if (ev.code == KEY_MENU) ev.code = BTN_MODE;
 				}
-				state = 1;
-				return 0;
-			}
 
-			for (int i = 0; i < NUMDEV; i++)
-			{
-				if ((pool[i].fd >= 0) && (pool[i].revents & POLLIN))
+				if (is_menu() && !video_fb_state())
 				{
-					if (!input[i].mouse)
+					/*
+					if (mapping && mapping_type <= 1 && !(ev.type==EV_KEY && ev.value>1))
 					{
-						memset(&ev, 0, sizeof(ev));
-						if (read(pool[i].fd, &ev, sizeof(ev)) == sizeof(ev))
+						static char str[64], str2[64];
+						OsdWrite(12, "\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81");
+						sprintf(str, "     VID=%04X PID=%04X", input[i].vid, input[i].pid);
+						OsdWrite(13, str);
+
+						sprintf(str, "Type=%d Code=%d Value=%d", ev.type, ev.code, ev.value);
+						str2[0] = 0;
+						int len = (29 - (strlen(str))) / 2;
+						while (len-- > 0) strcat(str2, " ");
+						strcat(str2, str);
+						OsdWrite(14, str2);
+
+						str2[0] = 0;
+						if (ev.type == EV_ABS)
 						{
-							if (getchar)
+							sprintf(str, "Min=%d Max=%d", absinfo.minimum, absinfo.maximum);
+							int len = (29 - (strlen(str))) / 2;
+							while (len-- > 0) strcat(str2, " ");
+							strcat(str2, str);
+						}
+						OsdWrite(15, str2);
+					}
+					*/
+
+					switch (ev.type)
+					{
+						//keyboard, buttons
+					case EV_KEY:
+						printf("Input event: type=EV_KEY, code=%d(0x%x), value=%d, jnum=%d, ID:%04x:%04x:%02d\n", ev.code, ev.code, ev.value, input[dev].num, input[dev].vid, input[dev].pid, i);
+						break;
+
+					case EV_REL:
+						{
+							//limit the amount of EV_REL messages, so Menu core won't be laggy
+							static unsigned long timeout = 0;
+							if (!timeout || CheckTimer(timeout))
 							{
-								if (ev.type == EV_KEY && ev.value >= 1)
-								{
-									return ev.code;
-								}
+								timeout = GetTimer(20);
+								printf("Input event: type=EV_REL, Axis=%d, Offset=%d, jnum=%d, ID:%04x:%04x:%02d\n", ev.code, ev.value, input[dev].num, input[dev].vid, input[dev].pid, i);
 							}
-							else if (ev.type)
-							{
-								int dev = i;
-								if (input[dev].bind >= 0) dev = input[dev].bind;
+						}
+						break;
 
-								int noabs = 0;
+					case EV_SYN:
+					case EV_MSC:
+						break;
 
-								if (input[i].quirk == QUIRK_DS4TOUCH && ev.type == EV_KEY)
-								{
-									if (ev.code == BTN_TOOL_FINGER || ev.code == BTN_TOUCH || ev.code == BTN_TOOL_DOUBLETAP) continue;
-								}
+						//analog joystick
+					case EV_ABS:
+						{
+							//limit the amount of EV_ABS messages, so Menu core won't be laggy
+							static unsigned long timeout = 0;
+							if (!timeout || CheckTimer(timeout))
+							{
+								timeout = GetTimer(20);
 
-								if (input[i].quirk == QUIRK_MADCATZ360 && ev.type == EV_KEY)
+								//reduce flood from DUALSHOCK 3/4
+								if ((input[i].quirk == QUIRK_DS4 || input[i].quirk == QUIRK_DS3) && ev.code <= 5 && ev.value > 118 && ev.value < 138)
 								{
-									if (ev.code == BTN_THUMBR) input[i].misc_flags = ev.value ? (input[i].misc_flags | 1) : (input[i].misc_flags & ~1);
-									else if (ev.code == BTN_MODE && !user_io_osd_is_visible())
-									{
-										if (input[i].misc_flags & 1)
-										{
-											if (ev.value)
-											{
-												if ((input[i].misc_flags & 0x6) == 0) input[i].misc_flags = 0x3; // X
-												else if ((input[i].misc_flags & 0x6) == 2) input[i].misc_flags = 0x5; // Y
-												else input[i].misc_flags = 0x1; // None
-
-												Info(((input[i].misc_flags & 0x6) == 2) ? "Paddle mode" :
-													((input[i].misc_flags & 0x6) == 4) ? "Spinner mode" :
-													"Normal mode");
-											}
-											continue;
-										}
-									}
+									break;
 								}
 
-								if (input[i].quirk == QUIRK_TOUCHGUN)
+								//aliexpress USB encoder floods messages
+								if (input[dev].vid == 0x0079 && input[dev].pid == 0x0006)
 								{
-									touchscreen_proc(i, &ev);
-									continue;
+									if (ev.code == 2) break;
 								}
 
-								if (ev.type == EV_ABS)
-								{
-									if (input[i].quirk == QUIRK_WIIMOTE)
-									{
-										//nunchuck accel events
-										if (ev.code >= 3 && ev.code <= 5) continue;
-									}
+								printf("Input event: type=EV_ABS, Axis=%d, Offset=%d, jnum=%d, ID:%04x:%04x:%02d,", ev.code, ev.value, input[dev].num, input[dev].vid, input[dev].pid, i);
+								printf(" abs_min = %d, abs_max = %d", absinfo.minimum, absinfo.maximum);
+								if (absinfo.fuzz) printf(", fuzz = %d", absinfo.fuzz);
+								if (absinfo.resolution) printf(", res = %d", absinfo.resolution);
+								printf("\n");
+							}
+						}
+						break;
 
-									//Dualshock: drop accelerator and raw touchpad events
-									if (input[i].quirk == QUIRK_DS4TOUCH && ev.code == 57)
-									{
-										input[dev].lightgun_req = (ev.value >= 0);
-									}
+					default:
+						printf("Input event: type=%d, code=%d(0x%x), value=%d(0x%x), jnum=%d, ID:%04x:%04x:%02d\n", ev.type, ev.code, ev.code, ev.value, ev.value, input[dev].num, input[dev].vid, input[dev].pid, i);
+					}
+				}
 
-									if ((input[i].quirk == QUIRK_DS4TOUCH || input[i].quirk == QUIRK_DS4 || input[i].quirk == QUIRK_DS3) && ev.code > 40)
-									{
-										continue;
-									}
+				if (input[i].quirk == QUIRK_CWIID && ev.type == EV_ABS)
+				{
+					if (ev.code <= 1 && user_io_osd_is_visible())
+					{
+						// don't pass IR tracking to OSD
+						return 0;
+					}
+				}
 
-									if (ioctl(pool[i].fd, EVIOCGABS(ev.code), &absinfo) < 0) memset(&absinfo, 0, sizeof(absinfo));
-									else
-									{
-										//DS4 specific: touchpad as lightgun
-										if (input[i].quirk == QUIRK_DS4TOUCH && ev.code <= 1)
-										{
-											if (!input[dev].lightgun || user_io_osd_is_visible()) continue;
-
-											if (ev.code == 1)
-											{
-												absinfo.minimum = 300;
-												absinfo.maximum = 850;
-											}
-											else if (ev.code == 0)
-											{
-												absinfo.minimum = 200;
-												absinfo.maximum = 1720;
-											}
-											else continue;
-										}
+				if (ev.type == EV_ABS && input[i].quirk == QUIRK_WIIMOTE && input[dev].lightgun)
+				{
+					out_lightgun(i, ev.type, ev.code, ev.value);
 
-										if (input[i].quirk == QUIRK_DS4 && ev.code <= 1)
-										{
-											if (input[dev].lightgun) noabs = 1;
-										}
+					// don't pass IR tracking to OSD
+					if (user_io_osd_is_visible()) return 0;
 
-										if (input[i].quirk == QUIRK_WIIMOTE)
-										{
-											input[dev].lightgun = 0;
-											if (absinfo.maximum == 1023 || absinfo.maximum == 767)
-											{
-												if (ev.code == 16)
-												{
-													ev.value = absinfo.maximum - ev.value;
-													ev.code = 0;
-													input[dev].lightgun = 1;
-												}
-												else if (ev.code == 17)
-												{
-													ev.code = 1;
-													input[dev].lightgun = 1;
-												}
-												// other 3 IR tracking aren't used
-												else continue;
-											}
-											else if (absinfo.maximum == 62)
-											{
-												//LT/RT analog
-												continue;
-											}
-											else if (ev.code & 1)
-											{
-												//Y axes on wiimote and accessories are inverted
-												ev.value = -ev.value;
-											}
-										}
-									}
+					if (!ev.code)
+					{
+						absinfo.minimum = input[i].guncal[2];
+						absinfo.maximum = input[i].guncal[3];
+					}
+					else
+					{
+						absinfo.minimum = input[i].guncal[0];
+						absinfo.maximum = input[i].guncal[1];
+					}
+				}
 
-									if (input[i].quirk == QUIRK_MADCATZ360 && (input[i].misc_flags & 0x6) && (ev.code == 16) && !user_io_osd_is_visible())
-									{
-										if (ev.value)
-										{
-											if ((input[i].misc_flags & 0x6) == 2)
-											{
-												if (ev.value > 0) input[i].paddle_val += 4;
-												if (ev.value < 0) input[i].paddle_val -= 4;
-
-												if (input[i].paddle_val > 256) input[i].paddle_val = 256;
-												if (input[i].paddle_val < 0)   input[i].paddle_val = 0;
-
-												absinfo.maximum = 255;
-												absinfo.minimum = 0;
-												ev.code = 8;
-												ev.value = input[i].paddle_val;
-											}
-											else
-											{
-												ev.type = EV_REL;
-												ev.code = 7;
-											}
-										}
-										else continue;
-									}
+				if (ev.type == EV_KEY && user_io_osd_is_visible())
+				{
+					if (input[i].quirk == QUIRK_WIIMOTE)
+					{
+						if (out_lightgun(i, ev.type, ev.code, ev.value)) return 0;
+					}
+				}
 
-									if (input[i].quirk == QUIRK_CWIID)
-									{
-										if (ev.code == 3 || ev.code == 4)
-										{
-											absinfo.minimum = 30;
-											absinfo.maximum = 225;
-										}
-									}
-								}
+				if (!noabs) input_dev_cb(&ev, &absinfo, i);
 
-								if (input[dev].quirk == QUIRK_JAMMA && ev.type == EV_KEY)
-								{
-									input[dev].num = 0;
-									for (uint32_t i = 0; i <= sizeof(jamma2joy) / sizeof(jamma2joy[0]); i++)
-									{
-										if (jamma2joy[i].key == ev.code)
-										{
-											ev.code = jamma2joy[i].btn;
-											input[dev].num = jamma2joy[i].player;
-											break;
-										}
-									}
-								}
+				//sumulate digital directions from analog
+				if (ev.type == EV_ABS && !(mapping && mapping_type <= 1 && mapping_button < -4) && !(ev.code <= 1 && input[dev].lightgun) && input[dev].quirk != QUIRK_PDSP && input[dev].quirk != QUIRK_MSSP)
+				{
+					input_absinfo *pai = 0;
+					uint8_t axis_edge = 0;
+					if ((absinfo.maximum == 1 && absinfo.minimum == -1) || (absinfo.maximum == 2 && absinfo.minimum == 0))
+					{
+						if (ev.value == absinfo.minimum) axis_edge = 1;
+						if (ev.value == absinfo.maximum) axis_edge = 2;
+					}
+					else
+					{
+						pai = &absinfo;
+						int range = absinfo.maximum - absinfo.minimum + 1;
+						int center = absinfo.minimum + (range / 2);
+						int treshold = range / 4;
 
-								//Menu combo on 8BitDo receiver in PSC mode
-								if (input[dev].vid == 0x054c && input[dev].pid == 0x0cda && ev.type == EV_KEY)
-								{
-									//in PSC mode these keys coming from separate virtual keyboard device
-									//so it's impossible to use joystick codes as keyboards aren't personalized
-									if (ev.code == 164) ev.code = KEY_MENU;
-									if (ev.code == 1)   ev.code = KEY_MENU;
-								}
+						int only_max = 1;
+						for (int n = 0; n < 4; n++) if (input[dev].mmap[SYS_AXIS1_X + n] && ((input[dev].mmap[SYS_AXIS1_X + n] & 0xFFFF) == ev.code)) only_max = 0;
 
-								if (ev.type == EV_KEY && ev.code == KEY_BACK && input[dev].vid == 0x45E)
-								{
-									ev.code = BTN_SELECT;
-								}
+						if (ev.value < center - treshold && !only_max) axis_edge = 1;
+						if (ev.value > center + treshold) axis_edge = 2;
+					}
 
-								//Menu button quirk of 8BitDo gamepad in X-Input mode
-								if (input[dev].vid == 0x045e && input[dev].pid == 0x02e0 && ev.type == EV_KEY)
-								{
-									if (ev.code == KEY_MENU) ev.code = BTN_MODE;
-								}
+					uint8_t last_state = input[dev].axis_edge[ev.code & 255];
+					input[dev].axis_edge[ev.code & 255] = axis_edge;
 
-								if (is_menu() && !video_fb_state())
-								{
-									/*
-									if (mapping && mapping_type <= 1 && !(ev.type==EV_KEY && ev.value>1))
-									{
-										static char str[64], str2[64];
-										OsdWrite(12, "\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81\x81");
-										sprintf(str, "     VID=%04X PID=%04X", input[i].vid, input[i].pid);
-										OsdWrite(13, str);
-
-										sprintf(str, "Type=%d Code=%d Value=%d", ev.type, ev.code, ev.value);
-										str2[0] = 0;
-										int len = (29 - (strlen(str))) / 2;
-										while (len-- > 0) strcat(str2, " ");
-										strcat(str2, str);
-										OsdWrite(14, str2);
-
-										str2[0] = 0;
-										if (ev.type == EV_ABS)
-										{
-											sprintf(str, "Min=%d Max=%d", absinfo.minimum, absinfo.maximum);
-											int len = (29 - (strlen(str))) / 2;
-											while (len-- > 0) strcat(str2, " ");
-											strcat(str2, str);
-										}
-										OsdWrite(15, str2);
-									}
-									*/
+					//printf("last_state=%d, axis_edge=%d\n", last_state, axis_edge);
+					if (last_state != axis_edge)
+					{
+						uint16_t ecode = KEY_EMU + (ev.code << 1) - 1;
+						ev.type = EV_KEY;
+						if (last_state)
+						{
+							ev.value = 0;
+							ev.code = ecode + last_state;
+							input_dev_cb(&ev, pai, i);
+						}
 
-									switch (ev.type)
-									{
-										//keyboard, buttons
-									case EV_KEY:
-										printf("Input event: type=EV_KEY, code=%d(0x%x), value=%d, jnum=%d, ID:%04x:%04x:%02d\n", ev.code, ev.code, ev.value, input[dev].num, input[dev].vid, input[dev].pid, i);
-										break;
+						if (axis_edge)
+						{
+							ev.value = 1;
+							ev.code = ecode + axis_edge;
+							input_dev_cb(&ev, pai, i);
+						}
+					}
 
-									case EV_REL:
-										{
-											//limit the amount of EV_REL messages, so Menu core won't be laggy
-											static unsigned long timeout = 0;
-											if (!timeout || CheckTimer(timeout))
-											{
-												timeout = GetTimer(20);
-												printf("Input event: type=EV_REL, Axis=%d, Offset=%d, jnum=%d, ID:%04x:%04x:%02d\n", ev.code, ev.value, input[dev].num, input[dev].vid, input[dev].pid, i);
-											}
-										}
-										break;
+					// Menu button on 8BitDo Receiver in D-Input mode
+					if (ev.code == 9 && input[dev].vid == 0x2dc8 && (input[dev].pid == 0x3100 || input[dev].pid == 0x3104))
+					{
+						ev.type = EV_KEY;
+						ev.code = KEY_EMU + (ev.code << 1);
+						input_dev_cb(&ev, pai, i);
+					}
+				}
+			}
+		}
+	}
+	else
+	{
+		uint8_t data[4] = {};
+		if (read(pool[i].fd, data, sizeof(data)))
+		{
+			int edev = i;
+			int dev = i;
+			if (input[i].bind >= 0) edev = input[i].bind; // mouse to event
+			if (input[edev].bind >= 0) dev = input[edev].bind; // event to base device
 
-									case EV_SYN:
-									case EV_MSC:
-										break;
+			if (input[i].quirk == QUIRK_DS4TOUCH && input[dev].lightgun)
+			{
+				//disable DS4 mouse in lightgun mode
+				return 0;
+			}
 
-										//analog joystick
-									case EV_ABS:
-										{
-											//limit the amount of EV_ABS messages, so Menu core won't be laggy
-											static unsigned long timeout = 0;
-											if (!timeout || CheckTimer(timeout))
-											{
-												timeout = GetTimer(20);
-
-												//reduce flood from DUALSHOCK 3/4
-												if ((input[i].quirk == QUIRK_DS4 || input[i].quirk == QUIRK_DS3) && ev.code <= 5 && ev.value > 118 && ev.value < 138)
-												{
-													break;
-												}
-
-												//aliexpress USB encoder floods messages
-												if (input[dev].vid == 0x0079 && input[dev].pid == 0x0006)
-												{
-													if (ev.code == 2) break;
-												}
-
-												printf("Input event: type=EV_ABS, Axis=%d, Offset=%d, jnum=%d, ID:%04x:%04x:%02d,", ev.code, ev.value, input[dev].num, input[dev].vid, input[dev].pid, i);
-												printf(" abs_min = %d, abs_max = %d", absinfo.minimum, absinfo.maximum);
-												if (absinfo.fuzz) printf(", fuzz = %d", absinfo.fuzz);
-												if (absinfo.resolution) printf(", res = %d", absinfo.resolution);
-												printf("\n");
-											}
-										}
-										break;
+			if (input[i].quirk == QUIRK_TOUCHGUN)
+			{
+				//don't use original raspad3 emulated mouse
+				return 0;
+			}
 
-									default:
-										printf("Input event: type=%d, code=%d(0x%x), value=%d(0x%x), jnum=%d, ID:%04x:%04x:%02d\n", ev.type, ev.code, ev.code, ev.value, ev.value, input[dev].num, input[dev].vid, input[dev].pid, i);
-									}
-								}
+			int xval, yval;
+			xval = ((data[0] & 0x10) ? -256 : 0) | data[1];
+			yval = ((data[0] & 0x20) ? -256 : 0) | data[2];
 
-								if (input[i].quirk == QUIRK_CWIID && ev.type == EV_ABS)
-								{
-									if (ev.code <= 1 && user_io_osd_is_visible())
-									{
-										// don't pass IR tracking to OSD
-										continue;
-									}
-								}
+			input_absinfo absinfo = {};
+			absinfo.maximum = 255;
+			absinfo.minimum = 0;
+
+			if (input[dev].quirk == QUIRK_MSSP)
+			{
+				int btn = (data[0] & 7) ? 1 : 0;
+				if (input[i].misc_flags != btn)
+				{
+					input[i].misc_flags = btn;
+					ev.value = btn;
+					ev.type = EV_KEY;
+					ev.code = 0x120;
+					input_dev_cb(&ev, &absinfo, i);
+				}
+
+				int throttle = (cfg.spinner_throttle ? abs(cfg.spinner_throttle) : 100) * input[i].spinner_prediv;
+				int inv = cfg.spinner_throttle < 0;
+
+				input[i].spinner_acc += (xval * 100);
+				int spinner = (input[i].spinner_acc <= -throttle || input[i].spinner_acc >= throttle) ? (input[i].spinner_acc / throttle) : 0;
+				input[i].spinner_acc -= spinner * throttle;
+
+				if (spinner)
+				{
+					ev.value = inv ? -spinner : spinner;
+					ev.type = EV_REL;
+					ev.code = 7;
+					input_dev_cb(&ev, &absinfo, i);
+
+					input[i].paddle_val += ev.value;
+					if (input[i].paddle_val < 0) input[i].paddle_val = 0;
+					if (input[i].paddle_val > 255) input[i].paddle_val = 255;
+
+					ev.value = input[i].paddle_val;
+					ev.type = EV_ABS;
+					ev.code = 8;
+					input_dev_cb(&ev, &absinfo, i);
+				}
 
-								if (ev.type == EV_ABS && input[i].quirk == QUIRK_WIIMOTE && input[dev].lightgun)
-								{
-									menu_lightgun_cb(i, ev.type, ev.code, ev.value);
+				if (is_menu() && !video_fb_state()) printf("%s: xval=%d, btn=%d, spinner=%d, paddle=%d\n", input[i].devname, xval, btn, spinner, input[i].paddle_val);
+			}
+			else
+			{
+				send_mouse_with_throttle(i, xval, yval, data[0], data[3]);
+			}
+		}
+	}
 
-									// don't pass IR tracking to OSD
-									if (user_io_osd_is_visible()) continue;
+	return 0;
+}
 
-									if (!ev.code)
-									{
-										absinfo.minimum = input[i].guncal[2];
-										absinfo.maximum = input[i].guncal[3];
-									}
-									else
-									{
-										absinfo.minimum = input[i].guncal[0];
-										absinfo.maximum = input[i].guncal[1];
-									}
-								}
+static int input_inited = 0;
 
-								if (ev.type == EV_KEY && user_io_osd_is_visible())
-								{
-									if (input[i].quirk == QUIRK_WIIMOTE)
-									{
-										if (menu_lightgun_cb(i, ev.type, ev.code, ev.value)) continue;
-									}
-								}
+void input_init()
+{
+	if (input_inited) return;
+	input_inited = 1;
 
-								if (!noabs) input_cb(&ev, &absinfo, i);
+	input_uinp_setup();
+	memset(pool, -1, sizeof(pool));
 
-								//sumulate digital directions from analog
-								if (ev.type == EV_ABS && !(mapping && mapping_type <= 1 && mapping_button < -4) && !(ev.code <= 1 && input[dev].lightgun) && input[dev].quirk != QUIRK_PDSP && input[dev].quirk != QUIRK_MSSP)
-								{
-									input_absinfo *pai = 0;
-									uint8_t axis_edge = 0;
-									if ((absinfo.maximum == 1 && absinfo.minimum == -1) || (absinfo.maximum == 2 && absinfo.minimum == 0))
-									{
-										if (ev.value == absinfo.minimum) axis_edge = 1;
-										if (ev.value == absinfo.maximum) axis_edge = 2;
-									}
-									else
-									{
-										pai = &absinfo;
-										int range = absinfo.maximum - absinfo.minimum + 1;
-										int center = absinfo.minimum + (range / 2);
-										int treshold = range / 4;
+	signal(SIGINT, INThandler);
+	pool[NUMDEV].fd = set_watch();
+	pool[NUMDEV].events = POLLIN;
 
-										int only_max = 1;
-										for (int n = 0; n < 4; n++) if (input[dev].mmap[SYS_AXIS1_X + n] && ((input[dev].mmap[SYS_AXIS1_X + n] & 0xFFFF) == ev.code)) only_max = 0;
+	unlink(CMD_FIFO);
+	mkfifo(CMD_FIFO, 0666);
 
-										if (ev.value < center - treshold && !only_max) axis_edge = 1;
-										if (ev.value > center + treshold) axis_edge = 2;
-									}
+	pool[NUMDEV+1].fd = open(CMD_FIFO, O_RDWR | O_NONBLOCK);
+	pool[NUMDEV+1].events = POLLIN;
 
-									uint8_t last_state = input[dev].axis_edge[ev.code & 255];
-									input[dev].axis_edge[ev.code & 255] = axis_edge;
+	pool[NUMDEV + 2].fd = open(LED_MONITOR, O_RDONLY);
+	pool[NUMDEV + 2].events = POLLPRI;
+}
 
-									//printf("last_state=%d, axis_edge=%d\n", last_state, axis_edge);
-									if (last_state != axis_edge)
-									{
-										uint16_t ecode = KEY_EMU + (ev.code << 1) - 1;
-										ev.type = EV_KEY;
-										if (last_state)
-										{
-											ev.value = 0;
-											ev.code = ecode + last_state;
-											input_cb(&ev, pai, i);
-										}
+int input_test(int getchar)
+{
+	static char cur_leds = 0;
+	static int state = 0;
+	struct input_event ev;
 
-										if (axis_edge)
-										{
-											ev.value = 1;
-											ev.code = ecode + axis_edge;
-											input_cb(&ev, pai, i);
-										}
-									}
+	if (touch_rel && CheckTimer(touch_rel))
+	{
+		touch_rel = 0;
+		mice_btn = 0;
+		mouse_cb(mice_btn);
+	}
 
-									// Menu button on 8BitDo Receiver in D-Input mode
-									if (ev.code == 9 && input[dev].vid == 0x2dc8 && (input[dev].pid == 0x3100 || input[dev].pid == 0x3104))
-									{
-										ev.type = EV_KEY;
-										ev.code = KEY_EMU + (ev.code << 1);
-										input_cb(&ev, pai, i);
-									}
-								}
-							}
-						}
-					}
-					else
-					{
-						uint8_t data[4] = {};
-						if (read(pool[i].fd, data, sizeof(data)))
-						{
-							int edev = i;
-							int dev = i;
-							if (input[i].bind >= 0) edev = input[i].bind; // mouse to event
-							if (input[edev].bind >= 0) dev = input[edev].bind; // event to base device
+	if (state == 0)
+	{
+		input_init();
+		state++;
+	}
 
-							if (input[i].quirk == QUIRK_DS4TOUCH && input[dev].lightgun)
-							{
-								//disable DS4 mouse in lightgun mode
-								continue;
-							}
+	if (state == 1)
+	{
+		printf("Open up to %d input devices.\n", NUMDEV);
+		for (int i = 0; i < NUMDEV; i++)
+		{
+			pool[i].fd = -1;
+			pool[i].events = 0;
+		}
 
-							if (input[i].quirk == QUIRK_TOUCHGUN)
-							{
-								//don't use original raspad3 emulated mouse
-								continue;
-							}
+		memset(input, 0, sizeof(input));
+		map_lut_reset();
 
-							int xval, yval;
-							xval = ((data[0] & 0x10) ? -256 : 0) | data[1];
-							yval = ((data[0] & 0x20) ? -256 : 0) | data[2];
+		int n = 0;
+		DIR *d = opendir("/dev/input");
+		if (d)
+		{
+			struct dirent *de;
+			while ((de = readdir(d)))
+			{
+				if (!strncmp(de->d_name, "event", 5) || !strncmp(de->d_name, "mouse", 5))
+				{
+					if (input_open_dev(n, de->d_name))
+					{
+						n++;
+						if (n >= NUMDEV) break;
+					}
+				}
+			}
+			closedir(d);
 
-							input_absinfo absinfo = {};
-							absinfo.maximum = 255;
-							absinfo.minimum = 0;
+			mergedevs();
+			for (int i = 0; i < n; i++)
+			{
+				printf("opened %d(%2d): %s (%04x:%04x) %d \"%s\" \"%s\"\n", i, input[i].bind, input[i].devname, input[i].vid, input[i].pid, input[i].quirk, input[i].id, input[i].name);
+				restore_player(i);
+			}
+			unflag_players();
+		}
+		cur_leds |= 0x80;
+		rt_active = 0; // input_rt_update() hands the reopened devices over again
+		pool_gen++;
+		state++;
+	}
 
-							if (input[dev].quirk == QUIRK_MSSP)
-							{
-								int btn = (data[0] & 7) ? 1 : 0;
-								if (input[i].misc_flags != btn)
-								{
-									input[i].misc_flags = btn;
-									ev.value = btn;
-									ev.type = EV_KEY;
-									ev.code = 0x120;
-									input_cb(&ev, &absinfo, i);
-								}
+	if (state == 2)
+	{
+		int timeout = 0;
+		if (is_menu() && video_fb_state()) timeout = 25;
 
-								int throttle = (cfg.spinner_throttle ? abs(cfg.spinner_throttle) : 100) * input[i].spinner_prediv;
-								int inv = cfg.spinner_throttle < 0;
+		while (1)
+		{
+			// the input thread reads the devices while it is active
+			int return_value = rt_active ? poll(pool + NUMDEV, 3, timeout) : poll(pool, NUMDEV + 3, timeout);
+			if (!return_value) break;
 
-								input[i].spinner_acc += (xval * 100);
-								int spinner = (input[i].spinner_acc <= -throttle || input[i].spinner_acc >= throttle) ? (input[i].spinner_acc / throttle) : 0;
-								input[i].spinner_acc -= spinner * throttle;
+			if (return_value < 0)
+			{
+				printf("ERR: poll\n");
+				break;
+			}
 
-								if (spinner)
-								{
-									ev.value = inv ? -spinner : spinner;
-									ev.type = EV_REL;
-									ev.code = 7;
-									input_cb(&ev, &absinfo, i);
-
-									input[i].paddle_val += ev.value;
-									if (input[i].paddle_val < 0) input[i].paddle_val = 0;
-									if (input[i].paddle_val > 255) input[i].paddle_val = 255;
-
-									ev.value = input[i].paddle_val;
-									ev.type = EV_ABS;
-									ev.code = 8;
-									input_cb(&ev, &absinfo, i);
-								}
+			int hotplug_req = (pool[NUMDEV].revents & POLLIN) ? check_devs() : 0;
+			if (hotplug_req == 1 && input_hotplug())
+			{
+				cur_leds |= 0x80;
+			}
+			else if (hotplug_req)
+			{
+				printf("Close all devices.\n");
+				for (int i = 0; i < NUMDEV; i++) if (pool[i].fd >= 0)
+				{
+					ioctl(pool[i].fd, EVIOCGRAB, 0);
+					close(pool[i].fd);
+				}
+				state = 1;
+				return 0;
+			}
 
-								if (is_menu() && !video_fb_state()) printf("%s: xval=%d, btn=%d, spinner=%d, paddle=%d\n", input[i].devname, xval, btn, spinner, input[i].paddle_val);
-							}
-							else
-							{
-								send_mouse_with_throttle(i, xval, yval, data[0], data[3]);
-							}
-						}
-					}
+			for (int i = 0; i < NUMDEV && !rt_active; i++)
+			{
+				if ((pool[i].fd >= 0) && (pool[i].revents & POLLIN))
+				{
+					int key = input_read_dev(i, getchar);
+					if (key) return key;
 				}
 			}
 
@@ -3776,6 +4749,11 @@ int input_test(int getchar)
 					cmd[len] = 0;
 					printf("MiSTer_cmd: %s\n", cmd);
 					if (!strncmp(cmd, "fb_cmd", 6)) video_cmd(cmd);
+					else if (!strcmp(cmd, "sched_stats")) scheduler_print_stats();
+					else if (!strcmp(cmd, "input_stats")) input_print_stats();
+					else if (!strncmp(cmd, "input_rec", 9)) input_rec_cmd(cmd + 9);
+					else if (!strncmp(cmd, "input_play", 10)) input_play_cmd(cmd + 10);
+					else if (!strncmp(cmd, "trace", 5)) trace_cmd(cmd + 5);
 					else if (!strncmp(cmd, "load_core ", 10))
 					{
 						len = strlen(cmd);
@@ -3821,15 +4799,250 @@ int input_test(int getchar)
 	return 0;
 }
 
+static int joy_af[NUMPLAYERS] = {};
+static uint32_t joy_time[NUMPLAYERS] = {};
+static uint32_t joy_prev[NUMPLAYERS] = {};
+
+static void input_joy_send()
+{
+	for (int i = 0; i < NUMPLAYERS; i++)
+	{
+		if (af_delay[i] < AF_MIN) af_delay[i] = AF_MIN;
+
+		if (!joy_time[i]) joy_time[i] = GetTimer(af_delay[i]);
+		int send = 0;
+		int changed = 0;
+
+		int newdir = ((joy[i] & 0xF) != (joy_prev[i] & 0xF));
+		if (joy[i] != joy_prev[i])
+		{
+			if ((joy[i] ^ joy_prev[i]) & autofire[i])
+			{
+				joy_time[i] = GetTimer(af_delay[i]);
+				joy_af[i] = 0;
+			}
+
+			send = 1;
+			changed = 1;
+			joy_prev[i] = joy[i];
+		}
+
+		if (CheckTimer(joy_time[i]))
+		{
+			joy_time[i] = GetTimer(af_delay[i]);
+			joy_af[i] = !joy_af[i];
+			if (joy[i] & autofire[i]) send = 1;
+		}
+
+		if (send)
+		{
+			user_io_digital_joystick(i, joy_af[i] ? joy[i] & ~autofire[i] : joy[i], newdir);
+
+			// latency of the event that changed the state, autofire toggles are not counted
+			if (changed && input_ev_time.tv_sec) input_lat_done();
+		}
+
+		// autofire is timed by the main loop
+		if (!rt_self && (joy[i] & autofire[i])) scheduler_wake_at(joy_time[i]);
+	}
+}
+
+static void *input_rt_thread(void *)
+{
+	rt_self = 1;
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	if (ep < 0)
+	{
+		printf("input: no epoll for the input thread.\n");
+		return NULL;
+	}
+
+	uint32_t gen = 0;
+	int reg[NUMDEV];
+	for (int i = 0; i < NUMDEV; i++) reg[i] = -1;
+
+	pthread_mutex_lock(&input_mutex);
+	while (1)
+	{
+		while (!rt_active) pthread_cond_wait(&input_rt_cond, &input_mutex);
+
+		// devices were reopened
+		if (gen != pool_gen)
+		{
+			for (int i = 0; i < NUMDEV; i++)
+			{
+				if (reg[i] >= 0) epoll_ctl(ep, EPOLL_CTL_DEL, reg[i], NULL);
+				reg[i] = -1;
+
+				if (pool[i].fd < 0) continue;
+
+				struct epoll_event ev = {};
+				ev.events = EPOLLIN;
+				ev.data.u32 = i;
+				if (!epoll_ctl(ep, EPOLL_CTL_ADD, pool[i].fd, &ev)) reg[i] = pool[i].fd;
+			}
+			gen = pool_gen;
+		}
+		pthread_mutex_unlock(&input_mutex);
+
+		struct epoll_event ev[NUMDEV];
+		int n = epoll_wait(ep, ev, NUMDEV, INPUT_RT_WAIT_MS);
+
+		pthread_mutex_lock(&input_mutex);
+		if (n <= 0 || !rt_active || gen != pool_gen) continue;
+
+		for (int k = 0; k < n; k++)
+		{
+			int i = ev[k].data.u32;
+
+			// unplugged: the main loop reopens the devices after inotify
+			if (ev[k].events & (EPOLLERR | EPOLLHUP))
+			{
+				epoll_ctl(ep, EPOLL_CTL_DEL, reg[i], NULL);
+				reg[i] = -1;
+				continue;
+			}
+
+			struct pollfd pfd = { pool[i].fd, POLLIN, 0 };
+			for (int cnt = 0; cnt < 64 && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN); cnt++) input_read_dev(i, 0);
+		}
+
+		if (grabbed) input_joy_send();
+	}
+
+	return NULL;
+}
+
+static void input_rt_start()
+{
+	rt_started = 1;
+	fpga_bus_share(1);
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(INPUT_RT_CPU, &set);
+
+	struct sched_param param = {};
+	param.sched_priority = INPUT_RT_PRIO;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	pthread_t th;
+	int ret = pthread_create(&th, &attr, input_rt_thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	if (ret)
+	{
+		printf("input: SCHED_FIFO not permitted, input thread runs at normal priority.\n");
+		ret = pthread_create(&th, NULL, input_rt_thread, NULL);
+	}
+
+	if (ret)
+	{
+		printf("input: cannot create the input thread.\n");
+		fpga_bus_share(0);
+		rt_started = 0;
+		return;
+	}
+
+	pthread_detach(th);
+	printf("input: input thread started.\n");
+}
+
+// run what the input thread queued for the main loop
+static void rt_queue_run()
+{
+	static rt_call run[RT_QUEUE_SIZE];
+	int num = rt_queue_num;
+	memcpy(run, rt_queue, num * sizeof(rt_call));
+	rt_queue_num = 0;
+
+	if (rt_queue_lost)
+	{
+		printf("input: %u calls of the input thread lost.\n", rt_queue_lost);
+		rt_queue_lost = 0;
+	}
+
+	for (int i = 0; i < num; i++)
+	{
+		rt_call *c = &run[i];
+		switch (c->type)
+		{
+		case SINK_KBD:
+			user_io_kbd(c->a, c->b);
+			break;
+
+		case SINK_MOUSE:
+			if (grabbed) user_io_mouse(c->a, c->x, c->y, c->w);
+			break;
+
+		case SINK_UINP:
+			uinp_send_key(c->a, c->b);
+			break;
+
+		case SINK_INFO:
+			if (c->a) InfoMessage(c->msg);
+			else Info(c->msg, c->b);
+			break;
+
+		case SINK_MENU_KEY:
+			menu_key_set(c->b);
+			break;
+
+		case SINK_INI:
+			user_io_set_ini(c->b);
+			break;
+
+		case SINK_RESET:
+			user_io_check_reset(c->a, c->b);
+			break;
+
+		case SINK_MAP_SHOW:
+			map_joystick_show(input[c->a].map, input[c->a].mmap, c->b);
+			break;
+		}
+	}
+}
+
+// hand the devices to the input thread while a core has the input
+static void input_rt_update()
+{
+	int on = rt_started && !is_menu() && !user_io_osd_is_visible();
+	if (on == rt_active) return;
+
+	if (on) for (int i = 0; i < NUMDEV; i++) if (pool[i].fd >= 0) input_rt_map_load(i);
+
+	rt_active = on;
+
+	// keep the scheduler from waking up on fds it doesn't read
+	for (int i = 0; i < NUMDEV; i++) if (pool[i].fd >= 0) pool[i].events = on ? 0 : POLLIN;
+	pool_gen++;
+
+	if (on) pthread_cond_signal(&input_rt_cond);
+}
+
 int input_poll(int getchar)
 {
-	static int af[NUMPLAYERS] = {};
-	static uint32_t time[NUMPLAYERS] = {};
-	static uint32_t joy_prev[NUMPLAYERS] = {};
+	if (cfg.input_thread && !rt_started) input_rt_start();
+
+	pthread_mutex_lock(&input_mutex);
 
 	int ret = input_test(getchar);
-	if (getchar) return ret;
+	if (getchar)
+	{
+		pthread_mutex_unlock(&input_mutex);
+		return ret;
+	}
 
+	rt_queue_run();
+	input_rt_update();
+	input_play_poll();
 	uinp_check_key();
 
 	static int prev_dx = 0;
@@ -3855,45 +5068,13 @@ int input_poll(int getchar)
 			prev_dx = mouse_emu_x;
 			prev_dy = mouse_emu_y;
 		}
+
+		if (mouse_emu_x || mouse_emu_y) scheduler_wake_at(mouse_timer);
 	}
 
 	if (!mouse_emu_x && !mouse_emu_y) mouse_timer = 0;
 
-	if (grabbed)
-	{
-		for (int i = 0; i < NUMPLAYERS; i++)
-		{
-			if (af_delay[i] < AF_MIN) af_delay[i] = AF_MIN;
-
-			if (!time[i]) time[i] = GetTimer(af_delay[i]);
-			int send = 0;
-
-			int newdir = ((joy[i] & 0xF) != (joy_prev[i] & 0xF));
-			if (joy[i] != joy_prev[i])
-			{
-				if ((joy[i] ^ joy_prev[i]) & autofire[i])
-				{
-					time[i] = GetTimer(af_delay[i]);
-					af[i] = 0;
-				}
-
-				send = 1;
-				joy_prev[i] = joy[i];
-			}
-
-			if (CheckTimer(time[i]))
-			{
-				time[i] = GetTimer(af_delay[i]);
-				af[i] = !af[i];
-				if (joy[i] & autofire[i]) send = 1;
-			}
-
-			if (send)
-			{
-				user_io_digital_joystick(i, af[i] ? joy[i] & ~autofire[i] : joy[i], newdir);
-			}
-		}
-	}
+	if (grabbed) input_joy_send();
 
 	if (!grabbed || user_io_osd_is_visible())
 	{
@@ -3902,11 +5083,12 @@ int input_poll(int getchar)
 			if(joy[i]) user_io_digital_joystick(i, 0, 1);
 
 			joy[i] = 0;
-			af[i] = 0;
+			joy_af[i] = 0;
 			autofire[i] = 0;
 		}
 	}
 
+	pthread_mutex_unlock(&input_mutex);
 	return 0;
 }
 
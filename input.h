@@ -77,6 +77,9 @@ int  toggle_kbdled(int mask);
 
 void input_notify_mode();
 int input_poll(int getchar);
+
+// descriptors polled by input_poll. gen changes when they are reopened.
+const struct pollfd *input_pollfds(int *num, uint32_t *gen);
 int is_key_pressed(int key);
 
 void start_map_setting(int cnt, int set = 0);
@@ -103,6 +106,24 @@ void input_switch(int grab);
 int input_state();
 void input_uinp_destroy();
 
+// Core independent part of the input setup (uinput device, hotplug watch,
+// command FIFO, LED monitor). Done by the first input_poll, or once by the
+// host process of the fast core switch for all the cores it forks.
+void input_init();
+
+// UI state input_cb() depends on, stored at the start of an input recording
+struct input_rec_ui
+{
+	uint8_t menu, osd, fb, api1_5, cfg_switch, kbdemu, pad[2];
+};
+
+#ifdef FPGA_SIM
+// offline replay of a recording (tests/input_replay.cpp). The stubs of the
+// menu and user_io queries there return input_replay_ui.
+extern input_rec_ui input_replay_ui;
+int input_replay(const char *name, int verbose);
+#endif
+
 extern char joy_bnames[NUMBUTTONS][32];
 extern int  joy_bcount;
 
@@ -32,11 +32,44 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "fpga_io.h"
 #include "scheduler.h"
 #include "osd.h"
+#include "trace.h"
+#include "startup.h"
+#include "video.h"
 
 const char *version = "$VER:" VDATE;
 
+#define STARTUP_LOG_ENV "MISTER_STARTUP_LOG"
+
+static const char *core_path = "";
+static const char *core_xml = NULL;
+
+static void step_user_io_init()
+{
+	user_io_init(core_path, core_xml);
+}
+
+// menu_bg runs next to user_io_init, video_menu_bg() waits for it
+static const startup_step startup_steps[] =
+{
+	{ "user_io_init", step_user_io_init, 0, 0 },
+	{ "menu_bg", video_menu_bg_preload, 0, 1 },
+};
+
 int main(int argc, char *argv[])
 {
+	uint64_t t = startup_start();
+
+	// --startup-log anywhere, the rest are core path and xml.
+	// Passed on through the environment when the binary restarts.
+	const char *args[2] = {};
+	int argn = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--startup-log")) setenv(STARTUP_LOG_ENV, "1", 1);
+		else if (argn < 2) args[argn++] = argv[i];
+	}
+	startup_log = getenv(STARTUP_LOG_ENV) != NULL;
+
 	// Always pin main worker process to core #1 as core #0 is the
 	// hardware interrupt handler in Linux.  This reduces idle latency
 	// in the main loop by about 6-7x.
@@ -55,9 +88,6 @@ int main(int argc, char *argv[])
 
 	printf("Version %s\n\n", version + 5);
 
-	if (argc > 1) printf("Core path: %s\n", argv[1]);
-	if (argc > 2) printf("XML path: %s\n", argv[2]);
-
 	if (!is_fpga_ready(1))
 	{
 		printf("\nGPI[31]==1. FPGA is uninitialized or incompatible core loaded.\n");
@@ -65,8 +95,33 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
+	startup_end("fpga_io_init", t);
+
+	t = startup_start();
 	FindStorage();
-	user_io_init((argc > 1) ? argv[1] : "",(argc > 2) ? argv[2] : NULL);
+	startup_end("FindStorage", t);
+
+	if (args[0]) core_path = args[0];
+	if (args[1]) core_xml = args[1];
+	app_host(&core_path, &core_xml);
+
+	// a forked core starts from the log of the boot
+	uint64_t sw = app_switch_time();
+	if (sw)
+	{
+		startup_clear();
+		startup_end("core_switch", sw);
+	}
+
+	if (*core_path) printf("Core path: %s\n", core_path);
+	if (core_xml) printf("XML path: %s\n", core_xml);
+
+	// the menu background is only drawn by the menu core
+	int menu = !*core_path || !strcasecmp(core_path, "menu.rbf");
+	startup_run(startup_steps, menu ? 2 : 1);
+
+	if (sw) printf("startup: core switch took %llums\n", (unsigned long long)((trace_time() - sw) / 1000));
+	startup_print();
 
 #ifdef USE_SCHEDULER
 	scheduler_init();
@@ -57,8 +57,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "audio.h"
 #include "joymapping.h"
 #include "recent.h"
+#include "rbf_cache.h"
 #include "support.h"
 #include "bootcore.h"
+#include "shmem.h"
+#include "scheduler.h"
 
 /*menu states*/
 enum MENU
@@ -339,6 +342,20 @@ static int changeDir(char *dir)
 	return 1;
 }
 
+// cache the highlighted core while the core list is shown
+static void prefetchCore()
+{
+	if (!(fs_Options & SCANO_CORES) || !flist_nDirEntries()) return;
+
+	direntext_t *item = flist_SelectedItem();
+	int len = strlen(item->de.d_name);
+	if (item->de.d_type == DT_DIR || len < 4 || strcasecmp(item->de.d_name + len - 4, ".rbf")) return;
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s%s%s", selPath, selPath[0] ? "/" : "", item->de.d_name);
+	rbf_cache_prefetch(getFullPath(path));
+}
+
 static const char *home_dir = NULL;
 static char filter[256] = {};
 static unsigned long filter_typing_timer = 0;
@@ -535,6 +552,12 @@ static uint32_t menu_key_get(void)
 				hold_cnt++;
 			}
 		}
+
+		if (c1 && !(c1 & UPSTROKE)) scheduler_wake_at(repeat);
+	}
+	else
+	{
+		scheduler_wake_at(db_time);
 	}
 
 	// currently no key pressed
@@ -545,6 +568,7 @@ static uint32_t menu_key_get(void)
 		unsigned char but = user_io_menu_button();
 
 		if (but && !last_but) longpress = GetTimer(3000);
+		if (but && !longpress_consumed) scheduler_wake_at(longpress);
 		if (but && CheckTimer(longpress) && !longpress_consumed)
 		{
 			longpress_consumed = 1;
@@ -566,6 +590,7 @@ static uint32_t menu_key_get(void)
 		if (user_io_osd_is_visible())
 		{
 			if (but && !last_but) longpress = GetTimer(1500);
+			if (but && !longpress_consumed) scheduler_wake_at(longpress);
 			if (but && CheckTimer(longpress) && !longpress_consumed)
 			{
 				longpress_consumed = 1;
@@ -995,6 +1020,7 @@ void HandleUI(void)
 
 	static char opensave;
 	static char ioctl_index;
+	static uint32_t load_addr;
 	char *p;
 	static char s[256];
 	unsigned char m = 0, up, down, select, menu, back, right, left, plus, minus, recent;
@@ -1082,6 +1108,7 @@ void HandleUI(void)
 				if (!cfg.osd_timeout) cfg.osd_timeout = 30;
 				timeout = GetTimer(cfg.osd_timeout * 1000);
 			}
+			scheduler_wake_at(timeout);
 		}
 		else
 		{
@@ -1206,6 +1233,7 @@ void HandleUI(void)
 				OsdShiftDown(OsdGetSize() - 1);
 				++helpstate;
 			}
+			scheduler_wake_at(helptext_timer);
 		}
 		else if (helpstate == 9)
 		{
@@ -1304,6 +1332,7 @@ void HandleUI(void)
 
 	case MENU_INFO:
 		if (CheckTimer(menu_timer)) menustate = MENU_NONE1;
+		scheduler_wake_at(menu_timer);
 		// fall through
 	case MENU_ERROR:
 	case MENU_NONE2:
@@ -1870,6 +1899,7 @@ void HandleUI(void)
 			menu_save_timer = 0;
 			menustate = MENU_GENERIC_MAIN1;
 		}
+		scheduler_wake_at(menu_save_timer);
 		break;
 
 	case MENU_GENERIC_MAIN2:
@@ -1991,6 +2021,20 @@ void HandleUI(void)
 
 						if (p[idx] >= '0' && p[idx] <= '9') ioctl_index = p[idx] - '0';
 						substrcpy(ext, p, 1);
+
+						// optional DDR3 load address: core takes the file from memory
+						load_addr = 0;
+						substrcpy(s, p, 3);
+						if (s[0])
+						{
+							load_addr = strtoul(s, NULL, 16);
+							if (load_addr < FPGA_MEM_BASE || load_addr >= (FPGA_MEM_BASE + FPGA_MEM_SIZE))
+							{
+								printf("Load address 0x%X is out of range. Using normal load.\n", load_addr);
+								load_addr = 0;
+							}
+						}
+
 						if (is_gba() && FileExists(user_io_make_filepath(HomeDir(), "goomba.rom"))) strcat(ext, "GB GBC");
 						while (strlen(ext) % 3) strcat(ext, " ");
 
@@ -2197,7 +2241,7 @@ void HandleUI(void)
 					pcecd_reset();
 				}
 				user_io_store_filename(selPath);
-				user_io_file_tx(selPath, idx, opensave);
+				user_io_file_tx(selPath, idx, opensave, 0, 0, load_addr);
 				if (user_io_use_cheats()) cheats_init(selPath, user_io_get_file_crc());
 			}
 
@@ -3329,6 +3373,7 @@ void HandleUI(void)
 			if(is_menu() && joy_bcount && get_map_button() >= SYS_BTN_RIGHT && get_map_button() <= SYS_BTN_START)
 			{
 				// draw an on-screen gamepad to help with central button mapping
+				scheduler_wake_at(flash_timer);
 				if (!flash_timer || CheckTimer(flash_timer))
 				{
 					flash_timer = GetTimer(100);
@@ -4614,11 +4659,13 @@ void HandleUI(void)
 		helptext_idx = (fs_Options & SCANO_UMOUNT) ? HELPTEXT_EJECT : 0;
 		OsdSetTitle((fs_Options & SCANO_CORES) ? "Cores" : "Select", 0);
 		PrintDirectory(hold_cnt<2);
+		if (fs_Options & SCANO_CORES) rbf_cache_prefetch_recent();
 		menustate = MENU_FILE_SELECT2;
 		break;
 
 	case MENU_FILE_SELECT2:
 		menumask = 0;
+		prefetchCore();
 
 		if (c == KEY_BACKSPACE && (fs_Options & SCANO_UMOUNT) && !strlen(filter))
 		{
@@ -5812,6 +5859,7 @@ void HandleUI(void)
 
 	case MENU_WMPAIR1:
 		if (CheckTimer(menu_timer)) menustate = MENU_NONE1;
+		scheduler_wake_at(menu_timer);
 		break;
 
 	case MENU_LGCAL:
@@ -5840,6 +5888,7 @@ void HandleUI(void)
 				blink = GetTimer(300);
 				state = !state;
 			}
+			scheduler_wake_at(blink);
 
 			m = !state;
 		}
@@ -6158,6 +6207,7 @@ void HandleUI(void)
 		static unsigned long rtc_timer = 0;
 		static int init_wait = 0;
 
+		scheduler_wake_at(rtc_timer);
 		if (!rtc_timer || CheckTimer(rtc_timer))
 		{
 			rtc_timer = GetTimer(cfg.bootcore[0] != '\0' ? 100 : 1000);
@@ -6218,7 +6268,7 @@ void HandleUI(void)
 					strftime(str + strlen(str), sizeof(str) - 1 - strlen(str), "%b %d %a%H:%M:%S", &tm);
 				}
 
-				int netType = (int)getNet(0);
+				int netType = (int)(intptr_t)getNet(0);
 				if (netType) str[8] = 0x1b + netType;
 				if (has_bt()) str[9] = 4;
 				if (user_io_get_sdram_cfg() & 0x8000)
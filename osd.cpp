@@ -45,6 +45,7 @@ as rotated copies of the first 128 entries.  -- AMR
 #include "logo.h"
 #include "user_io.h"
 #include "hardware.h"
+#include "scheduler.h"
 
 #include "support.h"
 
@@ -127,6 +128,7 @@ void StarsUpdate()
 
 static unsigned long scroll_offset = 0; // file/dir name scrolling position
 static unsigned long scroll_timer = 0;  // file/dir name scrolling timer
+static int scroll_active = 0;           // last check found a name that needs scrolling
 
 static int arrow;
 static unsigned char titlebuffer[256];
@@ -621,7 +623,8 @@ void ScrollText(char n, const char *str, int off, int len, int max_len, unsigned
 
 		if (!len) len = strlen(str); // get name length
 
-		if (off+2+len > max_len) // scroll name if longer than display size
+		scroll_active = (off+2+len > max_len);
+		if (scroll_active) // scroll name if longer than display size
 		{
 			// reset scroll position if it exceeds predefined maximum
 			if (scroll_offset >= (uint)(len + BLANKSPACE) << 3) scroll_offset = 0;
@@ -639,12 +642,15 @@ void ScrollText(char n, const char *str, int off, int len, int max_len, unsigned
 			print_line(n, hdr, s, (max_len - 1) << 3, (scroll_offset & 0x7), invert); // OSD print function with pixel precision
 		}
 	}
+
+	if (str && str[0] && scroll_active) scheduler_wake_at(scroll_timer);
 }
 
 void ScrollReset()
 {
 	scroll_timer = GetTimer(SCROLL_DELAY); // set timer to start name scrolling after predefined time delay
 	scroll_offset = 0; // start scrolling from the start
+	scroll_active = 1;
 }
 
 /* core currently loaded */
@@ -0,0 +1,417 @@
+// rbf_cache.cpp
+// Compressed cache of core bitstreams in tmpfs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "cfg.h"
+#include "lib/miniz/miniz.h"
+#include "rbf_cache.h"
+
+#define RBF_CACHE_DIR  "/tmp/rbf_cache"
+#define RBF_HISTORY    RBF_CACHE_DIR "/history"
+#define RBF_RECENT     8
+#define RBF_QUEUE      16
+#define RBF_MAX_FILES  64
+#define RBF_MAX_SIZE   (32 * 1024 * 1024)
+#define RBF_CHUNK      (64 * 1024)
+#define RBF_DEBOUNCE   500  // ms the highlighted core has to stay selected
+
+struct rbf_header
+{
+	char     magic[4];
+	uint32_t size;     // .rbf size
+	uint32_t packed;
+	int64_t  mtime;
+	char     path[1024];
+};
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+static int stop = 0;
+
+static char queue[RBF_QUEUE][1024];
+static int queue_num = 0;
+static char last[1024] = {};
+static char pending[1024] = {};
+static struct timespec pending_at;
+
+static const char *entry_path(const char *path, const char *ext)
+{
+	static __thread char name[256];
+
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	while (*path) hash = (hash ^ (uint8_t)*path++) * 16777619u;
+
+	snprintf(name, sizeof(name), "%s/%08x.%s", RBF_CACHE_DIR, hash, ext);
+	return name;
+}
+
+static int read_all(int fd, void *buf, uint32_t size)
+{
+	uint8_t *p = (uint8_t*)buf;
+	while (size)
+	{
+		int ret = read(fd, p, size);
+		if (ret <= 0) return 0;
+		p += ret;
+		size -= ret;
+	}
+	return 1;
+}
+
+static int write_all(int fd, const void *buf, uint32_t size)
+{
+	const uint8_t *p = (const uint8_t*)buf;
+	while (size)
+	{
+		int ret = write(fd, p, size);
+		if (ret <= 0) return 0;
+		p += ret;
+		size -= ret;
+	}
+	return 1;
+}
+
+// header of a valid entry for the current .rbf, fd positioned at the data
+static int entry_open(const char *path, rbf_header *hdr)
+{
+	struct stat64 st;
+	if (stat64(path, &st) < 0) return -1;
+
+	int fd = open(entry_path(path, "rbz"), O_RDONLY);
+	if (fd < 0) return -1;
+
+	if (read_all(fd, hdr, sizeof(rbf_header)) && !memcmp(hdr->magic, "MRB1", 4) && hdr->size == st.st_size &&
+		hdr->mtime == st.st_mtime && !strncmp(hdr->path, path, sizeof(hdr->path))) return fd;
+
+	close(fd);
+	return -1;
+}
+
+// drop least recently used entries until the cache fits rbf_cache_mb
+static void trim()
+{
+	struct rbf_file
+	{
+		char name[32];
+		uint64_t size;
+		time_t mtime;
+	};
+
+	static rbf_file files[RBF_MAX_FILES];
+	int num = 0;
+	uint64_t total = 0;
+
+	DIR *dir = opendir(RBF_CACHE_DIR);
+	if (!dir) return;
+
+	struct dirent *de;
+	while ((de = readdir(dir)) && num < RBF_MAX_FILES)
+	{
+		if (!strstr(de->d_name, ".rbz") || strlen(de->d_name) >= sizeof(files[0].name)) continue;
+
+		char name[300];
+		snprintf(name, sizeof(name), "%s/%s", RBF_CACHE_DIR, de->d_name);
+
+		struct stat64 st;
+		if (stat64(name, &st) < 0) continue;
+
+		strcpy(files[num].name, de->d_name);
+		files[num].size = st.st_size;
+		files[num].mtime = st.st_mtime;
+		total += st.st_size;
+		num++;
+	}
+	closedir(dir);
+
+	uint64_t max = (uint64_t)cfg.rbf_cache_mb * 1024 * 1024;
+	while (total > max && num)
+	{
+		int old = 0;
+		for (int i = 1; i < num; i++) if (files[i].mtime < files[old].mtime) old = i;
+
+		char name[300];
+		snprintf(name, sizeof(name), "%s/%s", RBF_CACHE_DIR, files[old].name);
+		printf("rbf_cache: remove %s\n", files[old].name);
+		unlink(name);
+
+		total -= files[old].size;
+		files[old] = files[--num];
+	}
+}
+
+static mz_bool put_buf(const void *buf, int len, void *user)
+{
+	return write_all(*(int*)user, buf, len);
+}
+
+// compressed in chunks straight into the entry file, so stop is checked
+// between chunks and a switch to another core never waits for a whole .rbf.
+static void add(const char *path)
+{
+	rbf_header hdr;
+	int fd = entry_open(path, &hdr);
+	if (fd >= 0)
+	{
+		close(fd);
+		return;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return;
+
+	struct stat64 st;
+	if (fstat64(fd, &st) < 0 || st.st_size <= 0 || st.st_size > RBF_MAX_SIZE)
+	{
+		close(fd);
+		return;
+	}
+
+	char name[300], tmp[310];
+	snprintf(name, sizeof(name), "%s", entry_path(path, "rbz"));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+
+	int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
+	if (out < 0)
+	{
+		close(fd);
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, "MRB1", 4);
+	hdr.size = st.st_size;
+	hdr.mtime = st.st_mtime;
+	snprintf(hdr.path, sizeof(hdr.path), "%s", path);
+
+	tdefl_compressor *comp = (tdefl_compressor*)malloc(sizeof(tdefl_compressor));
+	uint8_t *buf = (uint8_t*)malloc(RBF_CHUNK);
+
+	// fast level: decompression speed matters, not the ratio
+	int ok = comp && buf && write_all(out, &hdr, sizeof(hdr)) &&
+		tdefl_init(comp, put_buf, &out, TDEFL_COMPUTE_ADLER32 | tdefl_create_comp_flags_from_zip_params(1, MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY)) == TDEFL_STATUS_OKAY;
+
+	uint32_t remain = st.st_size;
+	while (ok && remain)
+	{
+		uint32_t len = (remain > RBF_CHUNK) ? RBF_CHUNK : remain;
+		remain -= len;
+
+		ok = !stop && read_all(fd, buf, len) &&
+			tdefl_compress_buffer(comp, buf, len, remain ? TDEFL_NO_FLUSH : TDEFL_FINISH) == (remain ? TDEFL_STATUS_OKAY : TDEFL_STATUS_DONE);
+	}
+
+	free(comp);
+	free(buf);
+	close(fd);
+
+	if (ok)
+	{
+		off_t end = lseek(out, 0, SEEK_CUR);
+		hdr.packed = (end > (off_t)sizeof(hdr)) ? end - sizeof(hdr) : 0;
+		ok = hdr.packed && !stop && (uint64_t)end <= (uint64_t)cfg.rbf_cache_mb * 1024 * 1024 &&
+			pwrite(out, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+	}
+	close(out);
+
+	// rename keeps a half written entry from ever being used
+	if (!ok || rename(tmp, name)) unlink(tmp);
+	else
+	{
+		printf("rbf_cache: added %s (%u -> %u bytes)\n", path, hdr.size, hdr.packed);
+		trim();
+	}
+}
+
+// caller holds lock
+static void queue_add(const char *path)
+{
+	for (int i = 0; i < queue_num; i++) if (!strcmp(queue[i], path)) return;
+	if (queue_num < RBF_QUEUE) snprintf(queue[queue_num++], sizeof(queue[0]), "%s", path);
+}
+
+static void *worker(void *)
+{
+	// main is pinned to CPU 1
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	char path[1024];
+
+	pthread_mutex_lock(&lock);
+	while (!stop)
+	{
+		if (!queue_num)
+		{
+			if (!pending[0])
+			{
+				pthread_cond_wait(&cond, &lock);
+				continue;
+			}
+
+			// the highlighted core is only cached once the cursor stays on it
+			struct timespec now;
+			clock_gettime(CLOCK_REALTIME, &now);
+			if (now.tv_sec < pending_at.tv_sec || (now.tv_sec == pending_at.tv_sec && now.tv_nsec < pending_at.tv_nsec))
+			{
+				pthread_cond_timedwait(&cond, &lock, &pending_at);
+				continue;
+			}
+
+			queue_add(pending);
+			pending[0] = 0;
+		}
+
+		strcpy(path, queue[0]);
+		queue_num--;
+		memmove(queue[0], queue[1], queue_num * sizeof(queue[0]));
+
+		pthread_mutex_unlock(&lock);
+		add(path);
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+// caller holds lock
+static int start()
+{
+	if (!running && !stop)
+	{
+		mkdir(RBF_CACHE_DIR, S_IRWXU | S_IRWXG | S_IRWXO);
+		running = !pthread_create(&thread, NULL, worker, NULL);
+	}
+	return running;
+}
+
+uint8_t *rbf_cache_load(const char *path, int *size)
+{
+	if (!cfg.rbf_cache_mb) return NULL;
+
+	rbf_header hdr;
+	int fd = entry_open(path, &hdr);
+	if (fd < 0) return NULL;
+
+	uint8_t *packed = (uint8_t*)malloc(hdr.packed);
+	uint8_t *data = (uint8_t*)malloc(hdr.size);
+	int ok = packed && data && read_all(fd, packed, hdr.packed);
+	close(fd);
+
+	mz_ulong len = hdr.size;
+	if (ok) ok = mz_uncompress(data, &len, packed, hdr.packed) == MZ_OK && len == hdr.size;
+	free(packed);
+
+	if (!ok)
+	{
+		free(data);
+		unlink(entry_path(path, "rbz"));
+		return NULL;
+	}
+
+	// mtime is the LRU stamp for trim()
+	utimes(entry_path(path, "rbz"), NULL);
+
+	*size = hdr.size;
+	return data;
+}
+
+void rbf_cache_used(const char *path)
+{
+	if (!cfg.rbf_cache_mb) return;
+
+	char list[RBF_RECENT][1024];
+	int num = 0;
+	strcpy(list[num++], path);
+
+	FILE *f = fopen(RBF_HISTORY, "r");
+	if (f)
+	{
+		while (num < RBF_RECENT && fgets(list[num], sizeof(list[0]), f))
+		{
+			list[num][strcspn(list[num], "\n")] = 0;
+			if (list[num][0] && strcmp(list[num], path)) num++;
+		}
+		fclose(f);
+	}
+
+	mkdir(RBF_CACHE_DIR, S_IRWXU | S_IRWXG | S_IRWXO);
+	f = fopen(RBF_HISTORY, "w");
+	if (!f) return;
+
+	for (int i = 0; i < num; i++) fprintf(f, "%s\n", list[i]);
+	fclose(f);
+}
+
+void rbf_cache_prefetch(const char *path)
+{
+	if (!cfg.rbf_cache_mb || !strcmp(path, last)) return;
+	snprintf(last, sizeof(last), "%s", path);
+
+	pthread_mutex_lock(&lock);
+	if (start())
+	{
+		snprintf(pending, sizeof(pending), "%s", path);
+		clock_gettime(CLOCK_REALTIME, &pending_at);
+		pending_at.tv_nsec += RBF_DEBOUNCE * 1000000L;
+		pending_at.tv_sec += pending_at.tv_nsec / 1000000000L;
+		pending_at.tv_nsec %= 1000000000L;
+		pthread_cond_signal(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void rbf_cache_prefetch_recent()
+{
+	if (!cfg.rbf_cache_mb) return;
+
+	FILE *f = fopen(RBF_HISTORY, "r");
+	if (!f) return;
+
+	pthread_mutex_lock(&lock);
+	if (start())
+	{
+		char path[1024];
+		while (fgets(path, sizeof(path), f))
+		{
+			path[strcspn(path, "\n")] = 0;
+			if (path[0]) queue_add(path);
+		}
+		pthread_cond_signal(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+
+	fclose(f);
+}
+
+void rbf_cache_stop()
+{
+	pthread_mutex_lock(&lock);
+	stop = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+
+	if (running) pthread_join(thread, NULL);
+	running = 0;
+
+	stop = 0;
+	queue_num = 0;
+	last[0] = 0;
+	pending[0] = 0;
+}
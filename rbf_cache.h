@@ -0,0 +1,26 @@
+// rbf_cache.h
+// Compressed cache of core bitstreams in tmpfs (rbf_cache_mb in MiSTer.ini).
+// Cores are added by a background thread while the core list is browsed:
+// the highlighted core and the recently loaded ones. An entry is used only
+// while the .rbf keeps its size and date.
+
+#ifndef RBF_CACHE_H
+#define RBF_CACHE_H
+
+#include <stdint.h>
+
+// malloc'd content of the .rbf (full path) or NULL if not cached
+uint8_t *rbf_cache_load(const char *path, int *size);
+
+// remember a loaded core for rbf_cache_prefetch_recent()
+void rbf_cache_used(const char *path);
+
+// highlighted core (full path), cached once it stays selected for a moment
+void rbf_cache_prefetch(const char *path);
+// queue the recently loaded cores for the background thread
+void rbf_cache_prefetch_recent();
+
+// stop the background thread (and drop the queue) before a bitstream is loaded
+void rbf_cache_stop();
+
+#endif
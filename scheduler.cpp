@@ -1,16 +1,66 @@
 #include "scheduler.h"
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include "libco.h"
 #include "menu.h"
 #include "user_io.h"
 #include "input.h"
 #include "fpga_io.h"
 #include "osd.h"
+#include "hardware.h"
+#include "trace.h"
+
+#define SCHED_BUSY_MS   100    // keep busy-polling this long after the core requested I/O
+#define SCHED_CORE_US   500    // max sleep while a core is running (FPGA requests are polled)
+#define SCHED_MENU_US   20000  // max sleep in the menu core (menu/OSD timers set their own deadlines)
+#define SCHED_MAX_FDS   64
+
+enum
+{
+	TASK_POLL,
+	TASK_UI,
+	TASK_NUM
+};
+
+struct sched_task
+{
+	const char *name;
+	cothread_t co;
+	int done;          // task finished its pass (not yielded from inside a long operation)
+	uint64_t runs;
+	uint64_t time_us;
+	uint64_t max_us;
+};
 
 static cothread_t co_scheduler = nullptr;
-static cothread_t co_poll = nullptr;
-static cothread_t co_ui = nullptr;
-static cothread_t co_last = nullptr;
+static sched_task tasks[TASK_NUM] = {};
+static sched_task *task_cur = nullptr;
+
+static int ep_fd = -1;
+static int timer_fd = -1;
+static int watch_fds[SCHED_MAX_FDS];
+static int watch_num = 0;
+static uint32_t watch_gen = 0;
+
+static unsigned long busy_until = 0;
+static unsigned long wake_at = 0;
+
+static uint64_t stat_start = 0;
+static uint64_t sleep_us = 0;
+static uint64_t sleeps = 0;
+static uint64_t wakeups_fd = 0;
+
+static uint64_t time_us()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
 
 static void scheduler_wait_fpga_ready(void)
 {
@@ -20,16 +70,27 @@ static void scheduler_wait_fpga_ready(void)
 	}
 }
 
+static void scheduler_task_done(void)
+{
+	task_cur->done = 1;
+	scheduler_yield();
+}
+
 static void scheduler_co_poll(void)
 {
 	for (;;)
 	{
 		scheduler_wait_fpga_ready();
 
+		uint64_t t = trace_start();
 		user_io_poll();
+		trace_end(TRACE_USER_IO_POLL, t);
+
+		t = trace_start();
 		input_poll(0);
+		trace_end(TRACE_INPUT_POLL, t);
 
-		scheduler_yield();
+		scheduler_task_done();
 	}
 }
 
@@ -37,46 +98,145 @@ static void scheduler_co_ui(void)
 {
 	for (;;)
 	{
+		uint64_t t = trace_start();
 		HandleUI();
+		trace_end(TRACE_HANDLE_UI, t);
+
+		t = trace_start();
 		OsdUpdate();
+		trace_end(TRACE_OSD_UPDATE, t);
+
+		scheduler_task_done();
+	}
+}
+
+static void scheduler_run_task(sched_task *task)
+{
+	task_cur = task;
+	task->done = 0;
+
+	uint64_t start = time_us();
+	co_switch(task->co);
+	uint64_t us = time_us() - start;
+
+	task->runs++;
+	task->time_us += us;
+	if (task->max_us < us) task->max_us = us;
+}
+
+// follow the input devices: they are reopened on hotplug
+static void scheduler_update_fds(void)
+{
+	uint32_t gen;
+	int num;
+	const struct pollfd *pfd = input_pollfds(&num, &gen);
+	if (gen == watch_gen) return;
+
+	for (int i = 0; i < watch_num; i++) epoll_ctl(ep_fd, EPOLL_CTL_DEL, watch_fds[i], NULL);
+	watch_num = 0;
+
+	for (int i = 0; i < num && watch_num < SCHED_MAX_FDS; i++)
+	{
+		// no events: the input thread reads this one
+		if (pfd[i].fd < 0 || !pfd[i].events) continue;
 
-		scheduler_yield();
+		struct epoll_event ev = {};
+		ev.events = (pfd[i].events & POLLPRI) ? EPOLLPRI : EPOLLIN;
+		ev.data.fd = pfd[i].fd;
+		if (!epoll_ctl(ep_fd, EPOLL_CTL_ADD, pfd[i].fd, &ev)) watch_fds[watch_num++] = pfd[i].fd;
 	}
+
+	watch_gen = gen;
 }
 
-static void scheduler_schedule(void)
+// sleep until input arrives or the nearest deadline
+static void scheduler_wait(void)
 {
-	if (co_last == co_poll)
+	if (ep_fd < 0) return;
+	if (!CheckTimer(busy_until)) return;
+
+	long us = is_menu() ? SCHED_MENU_US : SCHED_CORE_US;
+	if (wake_at)
 	{
-		co_last = co_ui;
-		co_switch(co_ui);
+		long ms = (long)(wake_at - GetTimer(0));
+		if (ms <= 0) return;
+		if (ms * 1000 < us) us = ms * 1000;
 	}
-	else
+
+	scheduler_update_fds();
+
+	struct itimerspec its = {};
+	its.it_value.tv_sec = us / 1000000;
+	its.it_value.tv_nsec = (us % 1000000) * 1000;
+	timerfd_settime(timer_fd, 0, &its, NULL);
+
+	uint64_t start = time_us();
+
+	struct epoll_event ev[8];
+	int n = epoll_wait(ep_fd, ev, 8, -1);
+	for (int i = 0; i < n; i++)
 	{
-		co_last = co_poll;
-		co_switch(co_poll);
+		if (ev[i].data.fd == timer_fd)
+		{
+			uint64_t exp;
+			if (read(timer_fd, &exp, sizeof(exp))) {}
+		}
+		else
+		{
+			wakeups_fd++;
+		}
 	}
+
+	sleep_us += time_us() - start;
+	sleeps++;
 }
 
 void scheduler_init(void)
 {
 	const unsigned int co_stack_size = 262144 * sizeof(void*);
 
-	co_poll = co_create(co_stack_size, scheduler_co_poll);
-	co_ui = co_create(co_stack_size, scheduler_co_ui);
+	tasks[TASK_POLL].name = "poll";
+	tasks[TASK_POLL].co = co_create(co_stack_size, scheduler_co_poll);
+	tasks[TASK_UI].name = "ui";
+	tasks[TASK_UI].co = co_create(co_stack_size, scheduler_co_ui);
+
+	ep_fd = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ep_fd < 0 || timer_fd < 0)
+	{
+		printf("scheduler: no epoll/timerfd, polling continuously.\n");
+		if (ep_fd >= 0) close(ep_fd);
+		ep_fd = -1;
+		return;
+	}
+
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = timer_fd;
+	epoll_ctl(ep_fd, EPOLL_CTL_ADD, timer_fd, &ev);
 }
 
 void scheduler_run(void)
 {
 	co_scheduler = co_active();
+	stat_start = time_us();
 
 	for (;;)
 	{
-		scheduler_schedule();
+		wake_at = 0;
+		uint32_t words = fpga_spi_words;
+
+		scheduler_run_task(&tasks[TASK_POLL]);
+		scheduler_run_task(&tasks[TASK_UI]);
+
+		trace_value(TRACE_SPI_WORDS, fpga_spi_words - words);
+
+		// a task yielding from inside a long operation wants to continue right away
+		if (tasks[TASK_POLL].done && tasks[TASK_UI].done) scheduler_wait();
 	}
 
-	co_delete(co_ui);
-	co_delete(co_poll);
+	co_delete(tasks[TASK_UI].co);
+	co_delete(tasks[TASK_POLL].co);
 	co_delete(co_scheduler);
 }
 
@@ -84,3 +244,32 @@ void scheduler_yield(void)
 {
 	co_switch(co_scheduler);
 }
+
+void scheduler_io_active(void)
+{
+	busy_until = GetTimer(SCHED_BUSY_MS);
+}
+
+void scheduler_wake_at(unsigned long timer)
+{
+	if (timer && (!wake_at || timer < wake_at)) wake_at = timer;
+}
+
+void scheduler_print_stats(void)
+{
+	uint64_t total = time_us() - stat_start;
+	if (!total) total = 1;
+
+	for (int i = 0; i < TASK_NUM; i++)
+	{
+		sched_task *t = &tasks[i];
+		printf("scheduler: %-4s runs: %llu, time: %llums (%llu%%), avg: %lluus, max: %lluus\n",
+			t->name, (unsigned long long)t->runs, (unsigned long long)(t->time_us / 1000),
+			(unsigned long long)(t->time_us * 100 / total),
+			(unsigned long long)(t->runs ? t->time_us / t->runs : 0), (unsigned long long)t->max_us);
+	}
+
+	printf("scheduler: sleep: %llums (%llu%%), sleeps: %llu, input wakeups: %llu\n",
+		(unsigned long long)(sleep_us / 1000), (unsigned long long)(sleep_us * 100 / total),
+		(unsigned long long)sleeps, (unsigned long long)wakeups_fd);
+}
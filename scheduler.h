@@ -7,4 +7,12 @@ void scheduler_init(void);
 void scheduler_run(void);
 void scheduler_yield(void);
 
+// core requested I/O: poll without sleeping for a while
+void scheduler_io_active(void);
+
+// GetTimer() deadline the loop must not sleep past (reset every pass)
+void scheduler_wake_at(unsigned long timer);
+
+void scheduler_print_stats(void);
+
 #endif
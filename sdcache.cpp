@@ -0,0 +1,296 @@
+// sdcache.cpp
+// Sector cache for SD card emulation.
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "sdcache.h"
+#include "hardware.h"
+
+#define SDC_BLKSECT   16                    // sectors per block
+#define SDC_BLKSIZE   (SDC_BLKSECT * 512)
+#define SDC_BLOCKS    32                    // blocks per disk (256KB)
+#define SDC_RA_BLOCKS 4                     // blocks fetched on a sequential miss
+#define SDC_SEQ_MIN   8                     // sequential sectors before readahead kicks in
+#define SDC_MAX_DIRTY 16                    // flush everything when this many blocks are dirty
+#define SDC_FLUSH_MS  500                   // max time a written sector stays in memory
+
+typedef struct
+{
+	uint8_t  data[SDC_BLKSIZE];
+	uint32_t lba;      // first sector of the block
+	uint32_t stamp;    // LRU
+	uint16_t valid;    // per sector bits
+	uint16_t dirty;
+} sdc_block;
+
+typedef struct
+{
+	fileTYPE *f;
+	sdc_block blk[SDC_BLOCKS];
+	uint32_t stamp;
+	uint32_t next_lba;
+	uint32_t seq;
+	int      dirty_cnt;
+	int      failing;  // last write to the image failed
+	unsigned long flush_timer;
+	sdcache_stats_t stats;
+} sdc_disk;
+
+static sdc_disk disks[SDC_DISKS] = {};
+static uint8_t ra_buf[SDC_BLKSIZE * SDC_RA_BLOCKS];
+
+static sdc_block *find_block(sdc_disk *d, uint32_t base)
+{
+	for (int i = 0; i < SDC_BLOCKS; i++)
+	{
+		sdc_block *b = &d->blk[i];
+		if ((b->valid || b->dirty) && b->lba == base) return b;
+	}
+	return 0;
+}
+
+// writes to the image fail like before the cache: zip, read only file
+static int writable(fileTYPE *f)
+{
+	return f->filp && (f->mode & (O_WRONLY | O_RDWR));
+}
+
+// sectors that fail to write stay dirty and are retried by the next flush
+static int flush_block(sdc_disk *d, sdc_block *b)
+{
+	int ok = 1;
+
+	// write runs of consecutive dirty sectors with one call each
+	for (int i = 0; i < SDC_BLKSECT; )
+	{
+		if (!(b->dirty & (1 << i)))
+		{
+			i++;
+			continue;
+		}
+
+		int n = 0;
+		while ((i + n) < SDC_BLKSECT && (b->dirty & (1 << (i + n)))) n++;
+
+		d->stats.flushes++;
+		if (FileSeekLBA(d->f, b->lba + i) && FileWriteAdv(d->f, b->data + i * 512, n * 512) == n * 512)
+		{
+			b->dirty &= ~(((1 << n) - 1) << i);
+		}
+		else
+		{
+			if (!d->failing) printf("sdcache: failed to write %d sectors at %u, keeping them for retry\n", n, b->lba + i);
+			d->stats.errors++;
+			ok = 0;
+		}
+		i += n;
+	}
+
+	if (ok && d->failing) printf("sdcache: image writes work again\n");
+	d->failing = !ok;
+
+	if (!b->dirty) d->dirty_cnt--;
+	return ok;
+}
+
+static sdc_block *find_lru(sdc_disk *d, int clean)
+{
+	sdc_block *lru = 0;
+	for (int i = 0; i < SDC_BLOCKS; i++)
+	{
+		sdc_block *b = &d->blk[i];
+		if (clean && b->dirty) continue;
+		if (!b->valid && !b->dirty) return b;
+		if (!lru || (int32_t)(b->stamp - lru->stamp) < 0) lru = b;
+	}
+	return lru;
+}
+
+// 0 if all blocks hold sectors that can't be written to the image
+static sdc_block *alloc_block(sdc_disk *d, uint32_t base)
+{
+	sdc_block *lru = find_lru(d, 0);
+	if (lru->dirty && !flush_block(d, lru))
+	{
+		lru = find_lru(d, 1);
+		if (!lru) return 0;
+	}
+
+	lru->lba = base;
+	lru->valid = 0;
+	lru->dirty = 0;
+	lru->stamp = ++d->stamp;
+	return lru;
+}
+
+// fill blocks starting at base from the image, dirty sectors are kept.
+static void fetch(sdc_disk *d, uint32_t base, int count)
+{
+	if (!FileSeekLBA(d->f, base)) return;
+
+	int len = FileReadAdv(d->f, ra_buf, count * SDC_BLKSIZE);
+	if (len <= 0) return;
+
+	// partial sector at the end of image is padded with zeros
+	if (len & 511)
+	{
+		memset(ra_buf + len, 0, 512 - (len & 511));
+		len = (len + 511) & ~511;
+	}
+
+	for (int n = 0; n < count && len > n * SDC_BLKSIZE; n++, base += SDC_BLKSECT)
+	{
+		sdc_block *b = find_block(d, base);
+		if (!b) b = alloc_block(d, base);
+		else if (n) continue; // already cached ahead
+		if (!b) break;
+
+		int sectors = (len - n * SDC_BLKSIZE) / 512;
+		if (sectors > SDC_BLKSECT) sectors = SDC_BLKSECT;
+
+		uint8_t *src = ra_buf + n * SDC_BLKSIZE;
+		for (int i = 0; i < sectors; i++)
+		{
+			if (b->dirty & (1 << i)) continue;
+			memcpy(b->data + i * 512, src + i * 512, 512);
+			b->valid |= 1 << i;
+		}
+
+		if (n) d->stats.readahead++;
+	}
+}
+
+void sdcache_attach(int disk, fileTYPE *f)
+{
+	sdc_disk *d = &disks[disk];
+
+	if (d->f)
+	{
+		if (!sdcache_flush(disk)) printf("sdcache: %d blocks of disk %d were not written to the image\n", d->dirty_cnt, disk);
+		if (d->stats.hits || d->stats.misses || d->stats.writes) sdcache_print_stats(disk);
+	}
+
+	memset(d, 0, sizeof(sdc_disk));
+	d->f = f;
+}
+
+int sdcache_read(int disk, uint32_t lba, uint8_t *buf)
+{
+	sdc_disk *d = &disks[disk];
+	if (!d->f) return 0;
+
+	d->seq = (lba == d->next_lba) ? d->seq + 1 : 0;
+	d->next_lba = lba + 1;
+
+	uint32_t base = lba & ~(SDC_BLKSECT - 1);
+	uint16_t bit = 1 << (lba & (SDC_BLKSECT - 1));
+
+	sdc_block *b = find_block(d, base);
+	if (b && (b->valid & bit))
+	{
+		d->stats.hits++;
+	}
+	else
+	{
+		d->stats.misses++;
+		if (!d->f->size) return 0;
+
+		fetch(d, base, (d->seq >= SDC_SEQ_MIN) ? SDC_RA_BLOCKS : 1);
+
+		b = find_block(d, base);
+		if (!b || !(b->valid & bit)) return 0;
+	}
+
+	b->stamp = ++d->stamp;
+	memcpy(buf, b->data + (lba & (SDC_BLKSECT - 1)) * 512, 512);
+	return 1;
+}
+
+int sdcache_write(int disk, uint32_t lba, const uint8_t *buf)
+{
+	sdc_disk *d = &disks[disk];
+	if (!d->f || !writable(d->f)) return 0;
+
+	uint32_t base = lba & ~(SDC_BLKSECT - 1);
+	uint16_t bit = 1 << (lba & (SDC_BLKSECT - 1));
+
+	sdc_block *b = find_block(d, base);
+	if (!b) b = alloc_block(d, base);
+	if (!b) return 0;
+
+	if (!b->dirty)
+	{
+		if (!d->dirty_cnt) d->flush_timer = GetTimer(SDC_FLUSH_MS);
+		d->dirty_cnt++;
+	}
+
+	memcpy(b->data + (lba & (SDC_BLKSECT - 1)) * 512, buf, 512);
+	b->valid |= bit;
+	b->dirty |= bit;
+	b->stamp = ++d->stamp;
+	d->stats.writes++;
+
+	if (d->dirty_cnt >= SDC_MAX_DIRTY) sdcache_flush(disk);
+	return 1;
+}
+
+int sdcache_flush(int disk)
+{
+	sdc_disk *d = &disks[disk];
+	if (!d->dirty_cnt) return 1;
+
+	// ascending order keeps the image writes sequential
+	int ok = 1;
+	uint64_t next = 0;
+	while (1)
+	{
+		sdc_block *first = 0;
+		for (int i = 0; i < SDC_BLOCKS; i++)
+		{
+			sdc_block *b = &d->blk[i];
+			if (b->dirty && b->lba >= next && (!first || b->lba < first->lba)) first = b;
+		}
+
+		if (!first) break;
+		if (!flush_block(d, first)) ok = 0;
+		next = (uint64_t)first->lba + SDC_BLKSECT;
+	}
+
+	// failed sectors are retried after another SDC_FLUSH_MS
+	if (d->dirty_cnt) d->flush_timer = GetTimer(SDC_FLUSH_MS);
+	return ok;
+}
+
+int sdcache_flush_all()
+{
+	int ok = 1;
+	for (int i = 0; i < SDC_DISKS; i++) if (!sdcache_flush(i)) ok = 0;
+	return ok;
+}
+
+void sdcache_poll()
+{
+	for (int i = 0; i < SDC_DISKS; i++)
+	{
+		if (disks[i].dirty_cnt && CheckTimer(disks[i].flush_timer)) sdcache_flush(i);
+	}
+}
+
+void sdcache_get_stats(int disk, sdcache_stats_t *stats)
+{
+	*stats = disks[disk].stats;
+}
+
+void sdcache_print_stats(int disk)
+{
+	sdcache_stats_t *s = &disks[disk].stats;
+	uint64_t total = s->hits + s->misses;
+
+	printf("SD cache %d: hits: %llu, misses: %llu (%llu%% hit), readahead: %llu, writes: %llu, flushes: %llu, errors: %llu\n",
+		disk, (unsigned long long)s->hits, (unsigned long long)s->misses,
+		total ? (unsigned long long)(s->hits * 100 / total) : 0ULL,
+		(unsigned long long)s->readahead, (unsigned long long)s->writes, (unsigned long long)s->flushes,
+		(unsigned long long)s->errors);
+}
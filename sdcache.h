@@ -0,0 +1,43 @@
+// sdcache.h
+// Sector cache for SD card emulation (user_io_poll).
+// Per mounted image: N-way LRU of 8KB blocks, sequential readahead
+// and write-back of dirty sectors flushed within SDC_FLUSH_MS.
+
+#ifndef SDCACHE_H
+#define SDCACHE_H
+
+#include <stdint.h>
+#include "file_io.h"
+
+#define SDC_DISKS 4
+
+typedef struct
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t readahead;   // blocks fetched ahead of the core
+	uint64_t writes;      // sectors written by the core
+	uint64_t flushes;     // write calls issued to the image
+	uint64_t errors;      // write calls that failed, their sectors stay dirty
+} sdcache_stats_t;
+
+// attach image to the disk slot and drop all cached blocks.
+// Dirty blocks of the previous image are flushed first.
+void sdcache_attach(int disk, fileTYPE *f);
+
+// 1 if sector was read from the image, 0 if not available (caller fills blank)
+int  sdcache_read(int disk, uint32_t lba, uint8_t *buf);
+
+// 1 if the sector was taken, 0 if the image isn't writable
+// (or the cache is full of sectors the image refused)
+int  sdcache_write(int disk, uint32_t lba, const uint8_t *buf);
+
+// 0 if some sectors couldn't be written, they stay in the cache
+int  sdcache_flush(int disk);
+int  sdcache_flush_all();
+void sdcache_poll();
+
+void sdcache_get_stats(int disk, sdcache_stats_t *stats);
+void sdcache_print_stats(int disk);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SHMEM_H
+#define SHMEM_H
+
+#include <stdint.h>
+
+// FPGA DDR3 window as seen from HPS (0x20000000-0x3FFFFFFF)
+#define FPGA_MEM_BASE 0x20000000
+#define FPGA_MEM_SIZE 0x20000000
+#define fpga_mem(x) (FPGA_MEM_BASE | ((x) & (FPGA_MEM_SIZE - 1)))
+
+void *shmem_map(uint32_t address, uint32_t size);
+int   shmem_unmap(void* map, uint32_t size);
+int   shmem_put(uint32_t address, uint32_t size, const void *buf);
+
+#endif
@@ -0,0 +1,184 @@
+// startup.cpp
+// Startup phase log and dependency graph of init steps.
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "startup.h"
+
+#define STARTUP_PHASES 64
+#define STARTUP_STEPS  32
+
+struct startup_phase
+{
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	int worker;
+};
+
+int startup_log = 0;
+
+static startup_phase phases[STARTUP_PHASES];
+static int phase_num = 0;
+static __thread int worker = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static const startup_step *graph = 0;
+static int graph_num = 0;
+static uint32_t graph_done = 0;
+
+uint64_t startup_start()
+{
+	return trace_time();
+}
+
+void startup_end(const char *name, uint64_t start)
+{
+	uint64_t end = trace_time();
+
+	pthread_mutex_lock(&lock);
+	if (phase_num < STARTUP_PHASES)
+	{
+		startup_phase *ph = &phases[phase_num++];
+		ph->name = name;
+		ph->start = start;
+		ph->end = end;
+		ph->worker = worker;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+static void run_step(int n)
+{
+	uint64_t t = startup_start();
+	graph[n].func();
+	startup_end(graph[n].name, t);
+
+	pthread_mutex_lock(&lock);
+	graph_done |= 1 << n;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static void *step_thread(void *arg)
+{
+	// main is pinned to CPU 1
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	worker = 1;
+	run_step((int)(intptr_t)arg);
+	return NULL;
+}
+
+void startup_run(const startup_step *steps, int num)
+{
+	if (num > STARTUP_STEPS) num = STARTUP_STEPS;
+
+	pthread_t threads[STARTUP_STEPS];
+	int started[STARTUP_STEPS] = {};
+	int joinable[STARTUP_STEPS] = {};
+	uint32_t all = (num < 32) ? (1u << num) - 1 : 0xFFFFFFFF;
+
+	pthread_mutex_lock(&lock);
+	graph = steps;
+	graph_num = num;
+	graph_done = 0;
+
+	while (graph_done != all)
+	{
+		// workers first: a main thread step may wait for them
+		int ran = 0;
+		for (int i = 0; i < num; i++)
+		{
+			if (started[i] || !steps[i].thread || (steps[i].deps & ~graph_done)) continue;
+			started[i] = 1;
+			ran = 1;
+
+			if (!pthread_create(&threads[i], NULL, step_thread, (void*)(intptr_t)i)) joinable[i] = 1;
+			else
+			{
+				pthread_mutex_unlock(&lock);
+				run_step(i);
+				pthread_mutex_lock(&lock);
+			}
+		}
+
+		for (int i = 0; i < num; i++)
+		{
+			if (started[i] || steps[i].thread || (steps[i].deps & ~graph_done)) continue;
+			started[i] = 1;
+			ran = 1;
+
+			pthread_mutex_unlock(&lock);
+			run_step(i);
+			pthread_mutex_lock(&lock);
+			break;
+		}
+
+		if (!ran) pthread_cond_wait(&cond, &lock);
+	}
+
+	graph = 0;
+	graph_num = 0;
+	pthread_mutex_unlock(&lock);
+
+	for (int i = 0; i < num; i++) if (joinable[i]) pthread_join(threads[i], NULL);
+}
+
+void startup_wait(const char *name)
+{
+	pthread_mutex_lock(&lock);
+	for (int i = 0; i < graph_num; i++)
+	{
+		if (strcmp(graph[i].name, name)) continue;
+
+		uint64_t t = trace_time();
+		while (graph && !(graph_done & (1 << i))) pthread_cond_wait(&cond, &lock);
+
+		t = trace_time() - t;
+		if (startup_log && t >= 1000) printf("startup: waited %llums for %s\n", (unsigned long long)(t / 1000), name);
+		break;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void startup_clear()
+{
+	pthread_mutex_lock(&lock);
+	phase_num = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+void startup_print()
+{
+	if (!startup_log) return;
+
+	pthread_mutex_lock(&lock);
+
+	// recorded as the phases end
+	for (int i = 1; i < phase_num; i++)
+	{
+		startup_phase ph = phases[i];
+		int n = i;
+		for (; n > 0 && phases[n - 1].start > ph.start; n--) phases[n] = phases[n - 1];
+		phases[n] = ph;
+	}
+
+	printf("startup:   start(ms)  time(ms)  phase\n");
+	for (int i = 0; i < phase_num; i++)
+	{
+		startup_phase *ph = &phases[i];
+		printf("startup: %9.1f %9.1f  %s%s\n", ph->start / 1000.0, (ph->end - ph->start) / 1000.0,
+			ph->name, ph->worker ? " (worker)" : "");
+	}
+	printf("startup: ready at %.1fms since boot\n", trace_time() / 1000.0);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,34 @@
+// startup.h
+// Startup phase log and a small dependency graph of init steps.
+// Steps marked as threaded run on a worker next to the main thread steps
+// once their dependencies are done. "MiSTer --startup-log" prints the log,
+// timestamps are ms since boot (CLOCK_MONOTONIC).
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stdint.h>
+
+struct startup_step
+{
+	const char *name;
+	void (*func)();
+	uint32_t deps;     // bit mask of the steps that have to finish first
+	int thread;        // 0 - main thread (FPGA bus, menu/user_io state)
+};
+
+extern int startup_log;
+
+uint64_t startup_start();
+void startup_end(const char *name, uint64_t start);
+
+// returns when all steps are done
+void startup_run(const startup_step *steps, int num);
+
+// wait for a threaded step of the running graph (no-op if there is none by that name)
+void startup_wait(const char *name);
+
+void startup_clear();
+void startup_print();
+
+#endif
@@ -12,9 +12,12 @@
 #include "../../file_io.h"
 #include "../../menu.h"
 #include "../../fpga_io.h"
+#include "../../shmem.h"
 #include "../../lib/md5/md5.h"
+#include "../../bufops.h"
 
 #include "buffer.h"
+#include "rom_cache.h"
 #include "mra_loader.h"
 
 #define kBigTextSize 1024
@@ -33,6 +36,9 @@ struct arc_struct {
 	int patchaddr;
 	int dataop;
 	int validrom0;
+	int romnum;
+	int romfail;
+	int cached;
 	int insidesw;
 	int insideinterleave;
 	int ifrom;
@@ -182,6 +188,12 @@ static int      romblkl = 0;
 static uint8_t* romdata = 0;
 static uint8_t  romindex = 0;
 
+// expected size of every <rom> in document order, filled by xml_scan_romsize
+#define MAX_ROM_HINTS 64
+static uint32_t rom_hint[MAX_ROM_HINTS] = {};
+static int      rom_hint_num = 0;
+static int      rom_hint_pos = 0;
+
 static void rom_start(unsigned char index)
 {
 	romindex = index;
@@ -190,6 +202,16 @@ static void rom_start(unsigned char index)
 	memset(romlen, 0, sizeof(romlen));
 	romblkl = 0;
 	unitlen = 1;
+
+	// allocate the whole ROM at once if the size is known in advance
+	uint32_t hint = (rom_hint_pos < rom_hint_num) ? rom_hint[rom_hint_pos] : 0;
+	rom_hint_pos++;
+
+	if (hint)
+	{
+		romdata = (uint8_t*)malloc(hint);
+		if (romdata) romblkl = hint;
+	}
 }
 
 #define BLKL (1024*1024)
@@ -197,22 +219,36 @@ static int rom_checksz(int idx, int chunk)
 {
 	if ((romlen[idx] + chunk) > romblkl)
 	{
-	        if (romlen[idx] + chunk > romblkl + BLKL)
-		  romblkl += (chunk + BLKL);
-		else
-		  romblkl += BLKL;
-		romdata = (uint8_t*)realloc(romdata, romblkl);
-		if (!romdata)
+		// parts without length: grow geometrically to keep the copies few
+		int sz = romblkl + (romblkl >> 1);
+		if (sz < romlen[idx] + chunk + BLKL) sz = romlen[idx] + chunk + BLKL;
+
+		uint8_t *p = (uint8_t*)realloc(romdata, sz);
+		if (!p)
 		{
-			printf("realloc failed - romblkl %d \n",romblkl);
+			printf("realloc failed - romblkl %d \n", sz);
+			free(romdata);
+			romdata = 0;
 			romblkl = 0;
 			memset(romlen, 0, sizeof(romlen));
 			return 0;
 		}
+
+		romdata = p;
+		romblkl = sz;
 	}
 	return 1;
 }
 
+// take a complete ROM (from the cache), parts are not loaded then
+static void rom_set(uint8_t *data, int size)
+{
+	if (romdata) free(romdata);
+	romdata = data;
+	romblkl = size;
+	romlen[0] = size;
+}
+
 static int rom_data(const uint8_t *buf, int chunk, int map, struct MD5Context *md5context)
 {
 	if (md5context) MD5Update(md5context, buf, chunk);
@@ -227,44 +263,82 @@ static int rom_data(const uint8_t *buf, int chunk, int map, struct MD5Context *m
 	}
 
 	if (idx >= unitlen) return 0; // illegal map
-	if (!rom_checksz(idx, chunk*unitlen)) return 0;
 
-	while (chunk)
+	// unit position of every input byte of a unit, in input order
+	uint8_t pos[8];
+	int num = 0;
+	for (int ord = 1; ord <= unitlen; ord++)
 	{
-		for (int ord = 1; ord <= unitlen; ord++)
+		for (int i = 0; i < unitlen; i++) if (((map >> (i * 4)) & 0xF) == ord) pos[num++] = i;
+	}
+
+	if (!num) return 0; // illegal map
+
+	int units = (chunk + num - 1) / num;
+	if (!rom_checksz(idx, units * unitlen)) return 0;
+
+	uint8_t *dst = romdata + romlen[idx];
+	romlen[idx] += units * unitlen;
+
+	if (num == unitlen)
+	{
+		int ident = 1;
+		for (int i = 0; i < num; i++) if (pos[i] != i) ident = 0;
+
+		if (ident)
 		{
-			for (int i = 0; (i < unitlen && chunk); i++)
-			{
-				if (((map >> (i * 4)) & 0xF) == ord)
-				{
-					*(romdata + romlen[idx] + i) = *buf++;
-					chunk--;
-				}
-			}
+			memcpy(dst, buf, chunk);
+			return 1;
+		}
+
+		if (num == 2 && !(chunk & 1))
+		{
+			memcpy(dst, buf, chunk);
+			bswap16_buf(dst, chunk);
+			return 1;
 		}
+	}
 
-		romlen[idx] += unitlen;
+	if (num == 1)
+	{
+		scatter8_buf(dst + pos[0], buf, chunk, unitlen);
+		return 1;
 	}
 
+	for (; chunk >= num; chunk -= num, dst += unitlen)
+	{
+		for (int i = 0; i < num; i++) dst[pos[i]] = *buf++;
+	}
+
+	for (int i = 0; i < chunk; i++) dst[pos[i]] = *buf++;
 	return 1;
 }
 
 static int rom_file(const char *name, uint32_t crc32, int start, int len, int map, struct MD5Context *md5context)
 {
 	fileTYPE f = {};
-	static uint8_t buf[8192];
 	if (!FileOpenZip(&f, name, crc32)) return 0;
 	if (start) FileSeek(&f, start, SEEK_SET);
 	unsigned long bytes2send = f.size - f.offset;
 	if (len > 0 && len < (int)bytes2send) bytes2send = len;
 
+	// inflate the next block while the current one is interleaved
+	fileReadAhead *ra = FileReadAheadStart(&f, bytes2send);
+	if (!ra && bytes2send)
+	{
+		FileClose(&f);
+		return 0;
+	}
+
 	while (bytes2send)
 	{
-		uint16_t chunk = (bytes2send > sizeof(buf)) ? sizeof(buf) : bytes2send;
+		uint8_t *buf;
+		int chunk = FileReadAheadGet(ra, &buf);
+		if (!chunk) break;
 
-		FileReadAdv(&f, buf, chunk);
-		if (!rom_data(buf, chunk, map, md5context))
+		if (chunk < 0 || !rom_data(buf, chunk, map, md5context))
 		{
+			FileReadAheadStop(ra);
 			FileClose(&f);
 			return 0;
 		};
@@ -272,6 +346,7 @@ static int rom_file(const char *name, uint32_t crc32, int start, int len, int ma
 		bytes2send -= chunk;
 	}
 
+	FileReadAheadStop(ra);
 	FileClose(&f);
 	return 1;
 }
@@ -293,29 +368,8 @@ static int rom_patch(const uint8_t *buf, int offset, uint16_t len, int dataop)
 
 static void send_to_ddr(uint32_t address, void* buf, uint32_t len)
 {
-	int memfd = open("/dev/mem", O_RDWR | O_SYNC);
-	if (memfd == -1)
-	{
-		printf("Unable to open /dev/mem!\n");
-		return;
-	}
-
 	//make sure it's in FPGA address space
-	uint32_t map_addr = 0x20000000 | address;
-
-	void *base = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, map_addr);
-	if (base == (void *)-1)
-	{
-		printf("Unable to mmap (0x%X, %d)!\n", map_addr, len);
-		close(memfd);
-		return;
-	}
-
-	memcpy(base, buf, len);
-	munmap(base, len);
-
-	close(memfd);
-	return;
+	shmem_put(fpga_mem(address), len, buf);
 }
 
 static void rom_finish(int send, uint32_t address)
@@ -692,6 +746,21 @@ static int xml_send_rom(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, cons
 				arc_info->error_msg[0] = 0;
 
 			rom_start(arc_info->romindex);
+
+			arc_info->romfail = 0;
+			arc_info->cached = 0;
+			rom_cache_start_rom();
+
+			if (arc_info->romindex || !arc_info->validrom0)
+			{
+				int size = 0;
+				uint8_t *data = rom_cache_load(arc_info->romnum, &size);
+				if (data)
+				{
+					rom_set(data, size);
+					arc_info->cached = 1;
+				}
+			}
 		}
 
 		if (arc_info->insiderom && !strcasecmp(node->tag, "interleave"))
@@ -758,7 +827,8 @@ static int xml_send_rom(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, cons
 					p += 2;
 				}
 
-				int checksumsame = !strlen(arc_info->zipname) || !strcasecmp(arc_info->md5, hex);
+				// cached ROMs were verified when they were stored
+				int checksumsame = arc_info->cached || !strlen(arc_info->zipname) || !strcasecmp(arc_info->md5, hex);
 				if (checksumsame == 0)
 				{
 					printf("\n*** Checksum mismatch\n");
@@ -784,7 +854,13 @@ static int xml_send_rom(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, cons
 					}
 				}
 
+				if (checksumsame && !arc_info->cached && !arc_info->romfail && romlen[0] && romdata)
+				{
+					rom_cache_save(arc_info->romnum, romdata, romlen[0]);
+				}
+
 				rom_finish(checksumsame, arc_info->address);
+				arc_info->romnum++;
 			}
 			arc_info->insiderom = 0;
 		}
@@ -797,6 +873,7 @@ static int xml_send_rom(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, cons
 			// this is useful for merged rom sets - if the first one was valid, use it
 			// the second might not be
 			if (arc_info->romindex == 0 && arc_info->validrom0 == 1) break;
+			if (arc_info->cached) break;
 			char fname[kBigTextSize * 2 + 16];
 			int start, length, repeat;
 			uint32_t crc32;
@@ -851,11 +928,13 @@ static int xml_send_rom(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, cons
 
 					if (result)
 					{
+						rom_cache_dep(fname);
 						break;
 					}
 				}
 				if (result == 0)
 				{
+					arc_info->romfail = 1;
 					printf("%s does not exist\n", arc_info->partname);
 					snprintf(arc_info->error_msg, kBigTextSize, "%s\nFile Not Found", arc_info->partname);
 				}
@@ -877,7 +956,7 @@ static int xml_send_rom(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, cons
 			if (!arc_info->insideinterleave) unitlen = 1;
 		}
 
-		if (!strcasecmp(node->tag, "patch") && arc_info->insiderom)
+		if (!strcasecmp(node->tag, "patch") && arc_info->insiderom && !arc_info->cached)
 		{
 			size_t len = 0;
 			unsigned char* binary = hexstr_to_char(arc_info->data->content, &len);
@@ -928,6 +1007,53 @@ static int xml_send_rom(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, cons
 	return true;
 }
 
+// sum up the part lengths of every <rom> so its buffer can be allocated once.
+// Parts without length are not counted, the buffer grows for them later.
+static int xml_scan_romsize(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, const int n, SAX_Data* sd)
+{
+	static int cur = -1;
+	(void)(sd);
+
+	switch (evt)
+	{
+	case XML_EVENT_START_DOC:
+		cur = -1;
+		rom_hint_num = 0;
+		break;
+
+	case XML_EVENT_START_NODE:
+		if (!strcasecmp(node->tag, "rom"))
+		{
+			cur = (rom_hint_num < MAX_ROM_HINTS) ? rom_hint_num++ : -1;
+			if (cur >= 0) rom_hint[cur] = 0;
+		}
+
+		if (!strcasecmp(node->tag, "part") && cur >= 0)
+		{
+			uint32_t length = 0, repeat = 1;
+			for (int i = 0; i < node->n_attributes; i++)
+			{
+				if (!strcasecmp(node->attributes[i].name, "length")) length = strtoul(node->attributes[i].value, NULL, 0);
+				if (!strcasecmp(node->attributes[i].name, "repeat")) repeat = strtoul(node->attributes[i].value, NULL, 0);
+			}
+			rom_hint[cur] += length * repeat;
+		}
+		break;
+
+	case XML_EVENT_END_NODE:
+		if (!strcasecmp(node->tag, "rom")) cur = -1;
+		break;
+
+	case XML_EVENT_ERROR:
+		printf("XML parse: %s: ERROR %d\n", text, n);
+		break;
+	default:
+		break;
+	}
+
+	return true;
+}
+
 static int xml_scan_rbf(XMLEvent evt, const XMLNode* node, SXML_CHAR* text, const int n, SAX_Data* sd)
 {
 	static int insiderbf = 0;
@@ -1031,6 +1157,10 @@ int arcade_send_rom(const char *xml)
 	SAX_Callbacks sax;
 	SAX_Callbacks_init(&sax);
 
+	sax.all_event = xml_scan_romsize;
+	XMLDoc_parse_file_SAX(xml, &sax, NULL);
+	rom_hint_pos = 0;
+
 	sax.all_event = xml_send_rom;
 
 	set_arcade_root(xml);
@@ -1040,6 +1170,10 @@ int arcade_send_rom(const char *xml)
 	arc_info.data = buffer_init(kBigTextSize);
 	arc_info.error_msg[0] = 0;
 	arc_info.validrom0 = 0;
+	arc_info.romnum = 0;
+	arc_info.cached = 0;
+
+	rom_cache_begin(xml);
 
 	// parse
 	XMLDoc_parse_file_SAX(xml, &sax, &arc_info);
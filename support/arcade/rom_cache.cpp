@@ -0,0 +1,288 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "../../file_io.h"
+#include "../../cfg.h"
+#include "../../lib/md5/md5.h"
+
+#include "rom_cache.h"
+
+#define ROMCACHE_DIR CONFIG_DIR "/romcache"
+#define RC_MAX_DEPS  16
+#define RC_MAX_FILES 256
+
+struct rc_header
+{
+	char     magic[4];
+	uint8_t  key[16];
+	uint32_t num;
+	uint32_t size;
+	uint32_t deps;
+};
+
+struct rc_dep
+{
+	uint64_t size;
+	int64_t  mtime;
+	char     name[1024];
+};
+
+static int     enabled = 0;
+static uint8_t key[16];
+static char    keyhex[33];
+
+static rc_dep  deps[RC_MAX_DEPS];
+static int     dep_num = 0;
+static int     dep_over = 0;
+
+static const char *entry_path(int num)
+{
+	static char path[1024];
+	snprintf(path, sizeof(path), "%s/%s_%d.rom", getFullPath(ROMCACHE_DIR), keyhex, num);
+	return path;
+}
+
+static int read_all(int fd, void *buf, uint32_t size)
+{
+	uint8_t *p = (uint8_t*)buf;
+	while (size)
+	{
+		int ret = read(fd, p, size);
+		if (ret <= 0) return 0;
+		p += ret;
+		size -= ret;
+	}
+	return 1;
+}
+
+static int write_all(int fd, const void *buf, uint32_t size)
+{
+	const uint8_t *p = (const uint8_t*)buf;
+	while (size)
+	{
+		int ret = write(fd, p, size);
+		if (ret <= 0) return 0;
+		p += ret;
+		size -= ret;
+	}
+	return 1;
+}
+
+// zip (or plain file) the part is read from
+static void dep_stat(const char *name, rc_dep *dep)
+{
+	memset(dep, 0, sizeof(rc_dep));
+	snprintf(dep->name, sizeof(dep->name), "%s", name);
+
+	char *p = strcasestr(dep->name, ".zip/");
+	if (p) p[4] = 0;
+
+	struct stat64 *st = getPathStat(dep->name);
+	if (st)
+	{
+		dep->size = st->st_size;
+		dep->mtime = st->st_mtime;
+	}
+}
+
+// drop least recently used entries until the cache fits rom_cache_mb
+static void trim()
+{
+	struct rc_file
+	{
+		char name[64];
+		uint64_t size;
+		time_t mtime;
+	};
+
+	static rc_file files[RC_MAX_FILES];
+	int num = 0;
+	uint64_t total = 0;
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s", getFullPath(ROMCACHE_DIR));
+
+	DIR *dir = opendir(path);
+	if (!dir) return;
+
+	struct dirent *de;
+	while ((de = readdir(dir)) && num < RC_MAX_FILES)
+	{
+		// exact suffix: *.rom.tmp is still being written
+		int len = strlen(de->d_name);
+		if (len < 4 || strcasecmp(de->d_name + len - 4, ".rom") || len >= (int)sizeof(files[0].name)) continue;
+
+		char name[1024 + 64];
+		snprintf(name, sizeof(name), "%s/%s", path, de->d_name);
+
+		struct stat64 st;
+		if (stat64(name, &st) < 0) continue;
+
+		strcpy(files[num].name, de->d_name);
+		files[num].size = st.st_size;
+		files[num].mtime = st.st_mtime;
+		total += st.st_size;
+		num++;
+	}
+	closedir(dir);
+
+	uint64_t max = (uint64_t)cfg.rom_cache_mb * 1024 * 1024;
+	while (total > max && num)
+	{
+		int old = 0;
+		for (int i = 1; i < num; i++) if (files[i].mtime < files[old].mtime) old = i;
+
+		char name[1024 + 64];
+		snprintf(name, sizeof(name), "%s/%s", path, files[old].name);
+		printf("rom_cache: remove %s\n", files[old].name);
+		unlink(name);
+
+		total -= files[old].size;
+		files[old] = files[--num];
+	}
+}
+
+int rom_cache_begin(const char *xml)
+{
+	enabled = 0;
+	if (!cfg.rom_cache_mb) return 0;
+
+	int size = FileLoad(xml, 0, 0);
+	if (size <= 0) return 0;
+
+	uint8_t *buf = (uint8_t*)malloc(size);
+	if (!buf) return 0;
+
+	if (FileLoad(xml, buf, size) == size)
+	{
+		struct MD5Context ctx;
+		MD5Init(&ctx);
+		MD5Update(&ctx, buf, size);
+		MD5Final(key, &ctx);
+
+		for (int i = 0; i < 16; i++) sprintf(keyhex + i * 2, "%02x", key[i]);
+		enabled = 1;
+	}
+
+	free(buf);
+	return enabled;
+}
+
+void rom_cache_start_rom()
+{
+	dep_num = 0;
+	dep_over = 0;
+}
+
+void rom_cache_dep(const char *name)
+{
+	if (!enabled) return;
+
+	rc_dep dep;
+	dep_stat(name, &dep);
+
+	for (int i = 0; i < dep_num; i++) if (!strcmp(deps[i].name, dep.name)) return;
+
+	if (dep_num < RC_MAX_DEPS) deps[dep_num++] = dep;
+	else dep_over = 1;
+}
+
+uint8_t *rom_cache_load(int num, int *size)
+{
+	if (!enabled) return NULL;
+
+	const char *path = entry_path(num);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	rc_header hdr;
+	uint8_t *data = NULL;
+	int valid = read_all(fd, &hdr, sizeof(hdr)) && !memcmp(hdr.magic, "MRC1", 4) &&
+		!memcmp(hdr.key, key, sizeof(key)) && hdr.num == (uint32_t)num && hdr.deps <= RC_MAX_DEPS;
+
+	for (uint32_t i = 0; valid && i < hdr.deps; i++)
+	{
+		rc_dep dep, cur;
+		valid = read_all(fd, &dep, sizeof(dep));
+		if (!valid) break;
+
+		dep.name[sizeof(dep.name) - 1] = 0;
+		dep_stat(dep.name, &cur);
+		if (cur.size != dep.size || cur.mtime != dep.mtime)
+		{
+			printf("rom_cache: %s has changed\n", dep.name);
+			valid = 0;
+		}
+	}
+
+	if (valid)
+	{
+		data = (uint8_t*)malloc(hdr.size);
+		if (data && !read_all(fd, data, hdr.size))
+		{
+			free(data);
+			data = NULL;
+		}
+	}
+	close(fd);
+
+	if (!data)
+	{
+		if (!valid) unlink(path);
+		return NULL;
+	}
+
+	// mtime is the LRU stamp for trim()
+	utimes(path, NULL);
+
+	printf("rom_cache: using %s (%u bytes)\n", path, hdr.size);
+	*size = hdr.size;
+	return data;
+}
+
+void rom_cache_save(int num, const uint8_t *data, int size)
+{
+	if (!enabled || !dep_num || dep_over || size <= 0) return;
+	if ((uint64_t)size > (uint64_t)cfg.rom_cache_mb * 1024 * 1024) return;
+
+	FileCreatePath(ROMCACHE_DIR);
+
+	char path[1024], tmp[1024 + 8];
+	snprintf(path, sizeof(path), "%s", entry_path(num));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
+	if (fd < 0)
+	{
+		printf("rom_cache: cannot create %s\n", tmp);
+		return;
+	}
+
+	rc_header hdr = {};
+	memcpy(hdr.magic, "MRC1", 4);
+	memcpy(hdr.key, key, sizeof(key));
+	hdr.num = num;
+	hdr.size = size;
+	hdr.deps = dep_num;
+
+	int ok = write_all(fd, &hdr, sizeof(hdr)) && write_all(fd, deps, dep_num * sizeof(rc_dep)) && write_all(fd, data, size);
+	close(fd);
+
+	// rename keeps a half written entry from ever being used
+	if (!ok || rename(tmp, path))
+	{
+		printf("rom_cache: failed to write %s\n", path);
+		unlink(tmp);
+		return;
+	}
+
+	printf("rom_cache: saved %s\n", path);
+	trim();
+}
@@ -0,0 +1,21 @@
+#ifndef ROM_CACHE_H_
+#define ROM_CACHE_H_
+
+#include <stdint.h>
+
+// On-disk cache of assembled MRA ROMs (rom_cache_mb in MiSTer.ini).
+// Entries are keyed by the MD5 of the MRA file and the <rom> number and
+// are only used while the source zips keep their size and date.
+
+// hash the MRA file. Returns 0 if the cache is disabled.
+int rom_cache_begin(const char *xml);
+
+// start collecting the source files of the next <rom>
+void rom_cache_start_rom();
+void rom_cache_dep(const char *name);
+
+// malloc'd ROM of <rom> num or NULL if not cached or outdated
+uint8_t *rom_cache_load(int num, int *size);
+void rom_cache_save(int num, const uint8_t *data, int size);
+
+#endif
@@ -8,6 +8,7 @@
 #include "../../debug.h"
 #include "../../user_io.h"
 #include "../../input.h"
+#include "../../scheduler.h"
 #include "../../support.h"
 #include "archie.h"
 
@@ -505,6 +506,7 @@ void archie_poll(void)
 	spi_uio_cmd_cont(0x04);
 	if (spi_in() == 0xa1)
 	{
+		scheduler_io_active();
 		unsigned char data = spi_in();
 		DisableIO();
 
@@ -5,8 +5,11 @@
 #include <string.h>
 #include <inttypes.h>
 #include <time.h>
+#include <pthread.h>
+#include <vector>
 #include "../../file_io.h"
 #include "../../cd.h"
+#include "../../cfg.h"
 #include "mister_chd.h"
 
 void lba_to_hunkinfo(chd_file *chd_f, int lba, int *hunknumber, int *hunkoffset)
@@ -31,6 +34,220 @@ int mister_chd_log(const char *format, ...)
 	return printf("\x1b[32m%s\x1b[0m", logline);
 }
 
+// Decompressed hunks are kept in a cache shared by all open CHDs
+// (CHD_CACHE_MB in MiSTer.ini, 0 disables it). During sequential reads
+// the next hunk is decompressed by a worker thread.
+struct chd_hunk_t
+{
+	chd_file *chd;
+	int       num;
+	uint32_t  size;
+	uint32_t  stamp;
+	uint8_t  *buf;
+};
+
+static std::vector<chd_hunk_t> hunk_cache;
+static uint32_t cache_bytes = 0;
+static uint32_t cache_stamp = 0;
+static uint32_t cache_hits = 0, cache_misses = 0, cache_prefetched = 0;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t decode_lock = PTHREAD_MUTEX_INITIALIZER; // chd_read is not reentrant
+static pthread_cond_t  cache_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t       pf_thread;
+static int             pf_started = 0;
+static chd_file       *pf_chd = NULL;   // pending request
+static int             pf_num = -1;
+static chd_file       *busy_chd = NULL; // being decoded by the worker
+static int             busy_num = -1;
+
+static uint32_t cache_limit()
+{
+	return cfg.chd_cache_mb * 1024 * 1024;
+}
+
+// cache_lock must be held
+static chd_hunk_t *cache_find(chd_file *chd, int num)
+{
+	for (auto &h : hunk_cache)
+	{
+		if (h.chd == chd && h.num == num)
+		{
+			h.stamp = ++cache_stamp;
+			return &h;
+		}
+	}
+	return NULL;
+}
+
+// cache_lock must be held. Takes ownership of buf.
+static void cache_insert(chd_file *chd, int num, uint8_t *buf, uint32_t size)
+{
+	while (!hunk_cache.empty() && cache_bytes + size > cache_limit())
+	{
+		size_t lru = 0;
+		for (size_t i = 1; i < hunk_cache.size(); i++)
+		{
+			if ((int32_t)(hunk_cache[i].stamp - hunk_cache[lru].stamp) < 0) lru = i;
+		}
+
+		cache_bytes -= hunk_cache[lru].size;
+		free(hunk_cache[lru].buf);
+		hunk_cache[lru] = hunk_cache.back();
+		hunk_cache.pop_back();
+	}
+
+	hunk_cache.push_back({ chd, num, size, ++cache_stamp, buf });
+	cache_bytes += size;
+}
+
+static uint8_t *hunk_decode(chd_file *chd, int num, uint32_t size)
+{
+	uint8_t *buf = (uint8_t*)malloc(size);
+	if (!buf) return NULL;
+
+	pthread_mutex_lock(&decode_lock);
+	chd_error err = chd_read(chd, num, buf);
+	pthread_mutex_unlock(&decode_lock);
+
+	if (err != CHDERR_NONE)
+	{
+		mister_chd_log("ERROR %s\n", chd_error_string(err));
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void *prefetch_thread(void *)
+{
+	pthread_mutex_lock(&cache_lock);
+	while (1)
+	{
+		while (!pf_chd) pthread_cond_wait(&cache_cond, &cache_lock);
+
+		chd_file *chd = pf_chd;
+		int num = pf_num;
+		pf_chd = NULL;
+
+		if (cache_find(chd, num)) continue;
+
+		busy_chd = chd;
+		busy_num = num;
+		pthread_mutex_unlock(&cache_lock);
+
+		uint32_t size = chd_get_header(chd)->hunkbytes;
+		uint8_t *buf = hunk_decode(chd, num, size);
+
+		pthread_mutex_lock(&cache_lock);
+		if (buf)
+		{
+			cache_insert(chd, num, buf, size);
+			cache_prefetched++;
+		}
+		busy_chd = NULL;
+		busy_num = -1;
+		pthread_cond_broadcast(&cache_cond);
+	}
+	return NULL;
+}
+
+// cache_lock must be held
+static void prefetch_hunk(chd_file *chd, int num)
+{
+	if ((uint32_t)num >= chd_get_header(chd)->totalhunks) return;
+	if (busy_chd == chd && busy_num == num) return;
+	if (cache_find(chd, num)) return;
+
+	if (!pf_started)
+	{
+		if (pthread_create(&pf_thread, NULL, prefetch_thread, NULL))
+		{
+			printf("CHD: failed to start prefetch thread.\n");
+			return;
+		}
+		pf_started = 1;
+	}
+
+	pf_chd = chd;
+	pf_num = num;
+	pthread_cond_broadcast(&cache_cond);
+}
+
+static chd_error cached_read_sector(chd_file *chd_f, int hnum, uint32_t offset, int length, uint8_t *destbuf, int *hunknum)
+{
+	pthread_mutex_lock(&cache_lock);
+
+	chd_hunk_t *h;
+	while (!(h = cache_find(chd_f, hnum)) && busy_chd == chd_f && busy_num == hnum)
+	{
+		pthread_cond_wait(&cache_cond, &cache_lock);
+	}
+
+	if (h)
+	{
+		cache_hits++;
+	}
+	else
+	{
+		cache_misses++;
+		pthread_mutex_unlock(&cache_lock);
+
+		uint32_t size = chd_get_header(chd_f)->hunkbytes;
+		uint8_t *buf = hunk_decode(chd_f, hnum, size);
+		if (!buf) return CHDERR_DECOMPRESSION_ERROR;
+
+		pthread_mutex_lock(&cache_lock);
+		h = cache_find(chd_f, hnum);
+		if (h) free(buf);
+		else
+		{
+			cache_insert(chd_f, hnum, buf, size);
+			h = &hunk_cache.back();
+		}
+	}
+
+	memcpy(destbuf, h->buf + offset, length);
+
+	// sequential access: have the next hunk ready before it's needed
+	if (hnum == *hunknum || hnum == *hunknum + 1) prefetch_hunk(chd_f, hnum + 1);
+	*hunknum = hnum;
+
+	pthread_mutex_unlock(&cache_lock);
+	return CHDERR_NONE;
+}
+
+void mister_chd_close(chd_file *chd_f)
+{
+	if (!chd_f) return;
+
+	pthread_mutex_lock(&cache_lock);
+	if (pf_chd == chd_f) pf_chd = NULL;
+	while (busy_chd == chd_f) pthread_cond_wait(&cache_cond, &cache_lock);
+
+	for (size_t i = 0; i < hunk_cache.size();)
+	{
+		if (hunk_cache[i].chd == chd_f)
+		{
+			cache_bytes -= hunk_cache[i].size;
+			free(hunk_cache[i].buf);
+			hunk_cache[i] = hunk_cache.back();
+			hunk_cache.pop_back();
+		}
+		else i++;
+	}
+
+	if (cache_hits || cache_misses)
+	{
+		mister_chd_log("hunk cache: hits %u, misses %u, prefetched %u\n", cache_hits, cache_misses, cache_prefetched);
+		cache_hits = cache_misses = cache_prefetched = 0;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	chd_close(chd_f);
+}
+
 chd_error mister_load_chd(const char *filename, toc_t *cd_toc)
 {
 	chd_error err = chd_open(getFullPath(filename), CHD_OPEN_READ, NULL, &cd_toc->chd_f);
@@ -148,6 +365,11 @@ chd_error mister_chd_read_sector(chd_file *chd_f, int lba, uint32_t d_offset, ui
 
 
 	//mister_chd_log("READ LBA: %d, dest_offset: %d sector offset: %d length %d chd_f %p\n", lba, d_offset, s_offset, length, chd_f);
+	if (cache_limit())
+	{
+		return cached_read_sector(chd_f, tmphnum, hunkofs * CD_FRAME_SIZE + s_offset, length, destbuf + d_offset, hunknum);
+	}
+
 	if (tmphnum != *hunknum)
 	{
 		chd_error err = chd_read(chd_f, tmphnum, hunkbuf);
@@ -8,5 +8,6 @@
 
 chd_error mister_chd_read_sector(chd_file *chd_f, int lba, uint32_t d_offset, uint32_t s_offset, int length, uint8_t *destbuf, uint8_t *hunkbuf, int *hunknum);
 chd_error mister_load_chd(const char *filename, toc_t *cd_toc);
+void mister_chd_close(chd_file *chd_f);
 
 #endif
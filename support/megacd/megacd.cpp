@@ -9,6 +9,7 @@
 #include "../../spi.h"
 #include "../../hardware.h"
 #include "../../menu.h"
+#include "../../scheduler.h"
 #include "../../cheats.h"
 #include "megacd.h"
 
@@ -48,6 +49,7 @@ void mcd_poll()
 	uint8_t req = spi_uio_cmd_cont(UIO_CD_GET);
 	if (req != last_req)
 	{
+		scheduler_io_active();
 		last_req = req;
 
 		uint16_t data_in[4];
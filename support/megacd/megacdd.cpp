@@ -7,6 +7,7 @@
 
 #include "megacd.h"
 #include "../chd/mister_chd.h"
+#include "../../bufops.h"
 
 #define CD_DATA_IO_INDEX 2
 #define CD_SUB_IO_INDEX 3
@@ -313,7 +314,7 @@ void cdd_t::Unload()
 	{
 		if (this->toc.chd_f)
 		{
-			chd_close(this->toc.chd_f);
+			mister_chd_close(this->toc.chd_f);
 		}
 
 		if (this->chd_hunkbuf)
@@ -903,14 +904,8 @@ int cdd_t::ReadCDDA(uint8_t *buf)
 			mister_chd_read_sector(this->toc.chd_f, this->lba + this->toc.tracks[this->index].offset, 2352*i, 0, 2352, buf, this->chd_hunkbuf, &this->chd_hunknum);
 		}
 
-		//CHD audio requires byteswap. There's probably a better way to do this...
-
-		for (int swapidx = 0; swapidx < this->audioLength; swapidx += 2)
-		{
-			uint8_t temp = buf[swapidx];
-			buf[swapidx] = buf[swapidx+1];
-			buf[swapidx+1] = temp;
-		}
+		//CHD audio requires byteswap.
+		bswap16_buf(buf, this->audioLength);
 
 	} else if (this->toc.tracks[this->index].f.opened()) {
 		FileReadAdv(&this->toc.tracks[this->index].f, buf, this->audioLength);
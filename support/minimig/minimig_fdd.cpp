@@ -32,6 +32,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../../debug.h"
 #include "../../user_io.h"
 #include "../../menu.h"
+#include "../../scheduler.h"
 
 unsigned char drives = 0; // number of active drives reported by FPGA (may change only during reset)
 adfTYPE *pdfx;            // drive select pointer
@@ -612,6 +613,8 @@ void HandleFDD(unsigned char c1, unsigned char c2)
 	unsigned char sel;
 	drives = (c1 >> 4) & 0x03; // number of active floppy drives
 
+	if (c1 & (CMD_RDTRK | CMD_WRTRK)) scheduler_io_active();
+
 	if (c1 & CMD_RDTRK)
 	{
 		DISKLED_ON;
@@ -32,6 +32,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "minimig_config.h"
 #include "../../debug.h"
 #include "../../user_io.h"
+#include "../../scheduler.h"
 
 #define CMD_IDECMD                 0x04
 #define CMD_IDEDAT                 0x08
@@ -81,9 +82,20 @@ typedef struct
 	uint16_t sector_count;
 } hdfTYPE;
 
+#define HDD_BUF_SECTORS 256 // the longest ATA transfer
+#define HDD_RA_MIN      64  // reads this long overlap file reading with sending
+#define HDD_RA_SECTORS  32
+
 static hdfTYPE HDF[4] = {};
 static uint8_t sector_buffer[512];
 
+// sectors of the current transfer, read/written in as few calls as possible
+static uint8_t hdd_buf[HDD_BUF_SECTORS * 512];
+static fileReadAhead *rd_ra = 0;
+static uint8_t *rd_ptr = 0;
+static int rd_left = 0;
+static int wr_count = 0;
+
 static void CalcGeometry(hdfTYPE *hdf)
 {
 	uint32_t head = 0, cyl = 0, spt = 0;
@@ -495,58 +507,135 @@ static void updateTaskFile(hdfTYPE *hdf)
 	WriteTaskFile(0, hdf->sector_count, hdf->sector, (uint8_t)hdf->cylinder, (uint8_t)(hdf->cylinder >> 8), (uint8_t)(hdf->lu | hdf->head));
 }
 
-static void ReadSector(hdfTYPE *hdf)
+static void ReadBegin(hdfTYPE *hdf, int count)
+{
+	rd_ra = 0;
+	rd_left = 0;
+
+	// sectors in front of the image come from FakeRDB()
+	int fake = 0;
+	while (fake < count && (hdf->lba + hdf->offset + fake) < 0) fake++;
+	count -= fake;
+	if (!count) return;
+
+	if (count >= HDD_RA_MIN) rd_ra = FileReadAheadStart(&hdf->file, (__off64_t)count * 512, HDD_RA_SECTORS * 512);
+	if (!rd_ra)
+	{
+		int ret = FileReadAdv(&hdf->file, hdd_buf, count * 512);
+		rd_ptr = hdd_buf;
+		rd_left = (ret > 0) ? ret / 512 : 0;
+	}
+}
+
+static uint8_t *ReadNext(hdfTYPE *hdf)
 {
 	// sector outside limit (fake rdb header)
 	if ((hdf->lba + hdf->offset) < 0)
+	{
 		FakeRDB(hdf);
-	else
-		FileReadSec(&hdf->file, sector_buffer);
+		return sector_buffer;
+	}
+
+	if (!rd_left && rd_ra)
+	{
+		int len = FileReadAheadGet(rd_ra, &rd_ptr);
+		if (len < 0) printf("HDD: read error at lba %d\n", hdf->lba);
+		rd_left = (len > 0) ? len / 512 : 0;
+	}
+
+	// past the end of the image
+	if (!rd_left) return sector_buffer;
+
+	uint8_t *buf = rd_ptr;
+	rd_ptr += 512;
+	rd_left--;
+	return buf;
+}
+
+static void ReadEnd()
+{
+	FileReadAheadStop(rd_ra);
+	rd_ra = 0;
+	rd_left = 0;
 }
 
-static void SendSector()
+static void SendSector(const uint8_t *buf)
 {
 	EnableFpga();
 	fpga_spi_fast(CMD_IDE_DATA_WR << 8); // write data command
 	fpga_spi_fast(0);
 	fpga_spi_fast(0);
-	if (is_minimig()) fpga_spi_fast_block_write_be((uint16_t*)sector_buffer, 256);
-	else fpga_spi_fast_block_write((uint16_t*)sector_buffer, 256);
+	if (is_minimig()) fpga_spi_fast_block_write_be((const uint16_t*)buf, 256);
+	else fpga_spi_fast_block_write((const uint16_t*)buf, 256);
 	DisableFpga();
 }
 
-static void RecvSector()
+static void RecvSector(uint8_t *buf)
 {
 	EnableFpga();
 	fpga_spi_fast(CMD_IDE_DATA_RD << 8); // read data command
 	fpga_spi_fast(0);
 	fpga_spi_fast(0);
-	if (is_minimig()) fpga_spi_fast_block_read_be((uint16_t*)sector_buffer, 256);
-	else fpga_spi_fast_block_read((uint16_t*)sector_buffer, 256);
+	if (is_minimig()) fpga_spi_fast_block_read_be((uint16_t*)buf, 256);
+	else fpga_spi_fast_block_read((uint16_t*)buf, 256);
 	DisableFpga();
 }
 
-static void WriteSector(hdfTYPE *hdf)
+static int IsRDBWrite(hdfTYPE *hdf, int lba, const uint8_t *buf)
+{
+	return !hdf->offset && lba < 16 && (*(const uint32_t*)buf) == RDB_MAGIC;
+}
+
+//Write RDB header, grab the CHS!
+static void WriteRDB(hdfTYPE *hdf, int lba, const uint8_t *buf)
 {
+	memcpy(sector_buffer, buf, 512);
+
+	printf("Writing RDB header, LBA=%d: ", lba);
+	uint32_t sum = RDBChecksum((uint32_t*)sector_buffer, 0);
+	if (sum)
+	{
+		printf("Checksumm is incorrect(0x%08X)! Ignore the RDB parameters.\n", sum);
+	}
+	else
+	{
+		GetRDBGeometry(hdf);
+		printf("Using new CHS: %u/%u/%u (%llu MB)\n", hdf->cylinders, hdf->heads, hdf->sectors, ((((uint64_t)hdf->cylinders) * hdf->heads * hdf->sectors) >> 11));
+	}
+}
+
+// receive the next sector into hdd_buf, 1 if it has to be written right away
+static int RecvNext(hdfTYPE *hdf)
+{
+	uint8_t *buf = hdd_buf + wr_count * 512;
+	RecvSector(buf);
+	wr_count++;
+
+	// new geometry has to be in use for the following sectors
+	return IsRDBWrite(hdf, hdf->lba + wr_count - 1, buf) || wr_count >= HDD_BUF_SECTORS;
+}
+
+static void WriteFlush(hdfTYPE *hdf)
+{
+	uint8_t *buf = hdd_buf;
+	int count = wr_count;
+	wr_count = 0;
+
 	//Do not write to fake RDB header
-	if ((hdf->lba + hdf->offset) < 0) return;
+	while (count && (hdf->lba + hdf->offset) < 0)
+	{
+		buf += 512;
+		count--;
+		hdf->lba++;
+	}
 
-	//Write RDB header, grab the CHS!
-	if (!hdf->offset && hdf->lba < 16 && (*(uint32_t*)sector_buffer) == RDB_MAGIC)
+	for (int i = 0; i < count; i++)
 	{
-		printf("Writing RDB header, LBA=%d: ", hdf->lba);
-		uint32_t sum = RDBChecksum((uint32_t*)sector_buffer, 0);
-		if (sum)
-		{
-			printf("Checksumm is incorrect(0x%08X)! Ignore the RDB parameters.\n", sum);
-		}
-		else
-		{
-			GetRDBGeometry(hdf);
-			printf("Using new CHS: %u/%u/%u (%llu MB)\n", hdf->cylinders, hdf->heads, hdf->sectors, ((((uint64_t)hdf->cylinders) * hdf->heads * hdf->sectors) >> 11));
-		}
+		if (IsRDBWrite(hdf, hdf->lba + i, buf + i * 512)) WriteRDB(hdf, hdf->lba + i, buf + i * 512);
 	}
-	FileWriteSec(&hdf->file, sector_buffer);
+
+	if (count) FileWriteAdv(&hdf->file, buf, count * 512);
+	hdf->lba += count;
 }
 
 // Read Sectors (0x20)
@@ -556,17 +645,18 @@ static void ATA_ReadSectors(uint8_t* tfr, hdfTYPE *hdf)
 
 	if(Preface(tfr, hdf))
 	{
+		ReadBegin(hdf, hdf->sector_count);
 		while (hdf->sector_count)
 		{
 			while (!(GetDiskStatus() & CMD_IDECMD)); // wait for empty sector buffer
 			WriteStatus(IDE_STATUS_IRQ);
 
-			ReadSector(hdf);
+			uint8_t *buf = ReadNext(hdf);
 
 			// to be modified sector of first partition
 			if (!hdf->unit && !hdf->lba)
 			{
-				struct RigidDiskBlock *rdb = (struct RigidDiskBlock *)sector_buffer;
+				struct RigidDiskBlock *rdb = (struct RigidDiskBlock *)buf;
 				if (rdb->rdb_ID == RDB_MAGIC)
 				{
 					// adjust checksum by the difference between old and new flag value
@@ -574,13 +664,14 @@ static void ATA_ReadSectors(uint8_t* tfr, hdfTYPE *hdf)
 					rdb->rdb_Flags = SWAP(0x12);
 				}
 			}
-			SendSector();
+			SendSector(buf);
 
 			hdf->lba++;
 			hdf->sector_count--;
 			nextCHS(hdf);
 			updateTaskFile(hdf);
 		}
+		ReadEnd();
 	}
 	WriteStatus(IDE_STATUS_END);
 }
@@ -592,6 +683,7 @@ static void ATA_ReadMultiple(uint8_t* tfr, hdfTYPE *hdf)
 
 	if (Preface(tfr, hdf))
 	{
+		ReadBegin(hdf, hdf->sector_count);
 		while (hdf->sector_count)
 		{
 			while (!(GetDiskStatus() & CMD_IDECMD)); // wait for empty sector buffer
@@ -600,8 +692,7 @@ static void ATA_ReadMultiple(uint8_t* tfr, hdfTYPE *hdf)
 			WriteStatus(IDE_STATUS_IRQ);
 			while (block_count--)
 			{
-				ReadSector(hdf);
-				SendSector();
+				SendSector(ReadNext(hdf));
 
 				hdf->lba++;
 				hdf->sector_count--;
@@ -609,6 +700,7 @@ static void ATA_ReadMultiple(uint8_t* tfr, hdfTYPE *hdf)
 			}
 			updateTaskFile(hdf);
 		}
+		ReadEnd();
 	}
 	WriteStatus(IDE_STATUS_END);
 }
@@ -624,15 +716,14 @@ static void ATA_WriteSectors(uint8_t* tfr, hdfTYPE *hdf)
 		{
 			while (!(GetDiskStatus() & CMD_IDEDAT)); // wait for full write buffer
 
-			RecvSector();
+			int flush = RecvNext(hdf);
 			hdf->sector_count--;
 
 			nextCHS(hdf);
 			updateTaskFile(hdf);
 			WriteStatus(hdf->sector_count ? IDE_STATUS_IRQ : IDE_STATUS_END | IDE_STATUS_IRQ);
 
-			WriteSector(hdf);
-			hdf->lba++;
+			if (flush || !hdf->sector_count) WriteFlush(hdf);
 		}
 	}
 }
@@ -652,14 +743,13 @@ static void ATA_WriteMultiple(uint8_t* tfr, hdfTYPE *hdf)
 			{
 				while (!(GetDiskStatus() & CMD_IDEDAT)); // wait for full write buffer
 
-				RecvSector();
-				WriteSector(hdf);
-				hdf->lba++;
+				if (RecvNext(hdf)) WriteFlush(hdf);
 
 				block_count--;
 				hdf->sector_count--;
 				nextCHS(hdf);
 			}
+			WriteFlush(hdf);
 			updateTaskFile(hdf);
 			WriteStatus(hdf->sector_count ? IDE_STATUS_IRQ : IDE_STATUS_END | IDE_STATUS_IRQ);
 		}
@@ -674,6 +764,7 @@ void HandleHDD(uint8_t c1, uint8_t c2)
 	{
 		uint8_t  unit = 0;
 		uint8_t  tfr[8];
+		scheduler_io_active();
 		DISKLED_ON;
 
 		EnableFpga();
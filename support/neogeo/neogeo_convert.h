@@ -0,0 +1,123 @@
+// neogeo_convert.h
+// C ROM and S ROM reordering for the NeoGeo core (used by neogeo_loader.cpp,
+// checked against the original per-element formulas by tests/neogeo_check.cpp).
+// Outputs may be the mmapped DDR window: the vector stores of the bufops
+// kernels only write the bytes that belong to the output.
+
+#ifndef NEOGEO_CONVERT_H
+#define NEOGEO_CONVERT_H
+
+#include <stdint.h>
+#include "../../bufops.h"
+
+static inline void spr_convert(uint16_t* buf_in, uint16_t* buf_out, uint32_t size)
+{
+	/*
+	In C ROMs, a word provides two bitplanes for an 8-pixel wide line
+	They're used in pairs to provide 32 bits at once (all four bitplanes)
+	For one sprite tile, bytes are used like this: ([...] represents one 8-pixel wide line)
+	Even ROM					Odd ROM
+	[  40 41  ][  00 01  ]		[  42 43  ][  02 03  ]
+	[  44 45  ][  04 05  ]  	[  46 47  ][  06 07  ]
+	[  48 49  ][  08 09  ]  	[  4A 4B  ][  0A 0B  ]
+	[  4C 4D  ][  0C 0D  ]  	[  4E 4F  ][  0E 0F  ]
+	[  50 51  ][  10 11  ]  	[  52 53  ][  12 13  ]
+	...							...
+	The data read for a given tile line (16 pixels) is always the same, only the rendering order of the pixels can change
+	To take advantage of the SDRAM burst read feature, the data can be loaded so that all 16 pixels of a tile
+	line can be read sequentially: () are 16-bit words, [] is the 4-word burst read
+	[(40 41) (00 01) (42 43) (02 03)]
+	[(44 45) (04 05) (46 47) (06 07)]...
+	Word interleaving is done on the FPGA side to mix the two C ROMs data (even/odd)
+
+	In:  FEDCBA9876 54321 0
+	Out: FEDCBA9876 15432 0
+	*/
+
+	// every 32-word block is an interleave of its upper and lower halves
+	uint32_t i = 0;
+	for (; i + 32 <= size; i += 32) interleave16_buf(buf_out + i, buf_in + i + 16, buf_in + i, 16);
+	for (; i < size; i++) buf_out[i] = buf_in[(i & ~0x1F) | ((i >> 1) & 0xF) | (((i & 1) ^ 1) << 4)];
+
+	/*
+	0 <- 20
+	1 <- 21
+	2 <- 00
+	3 <- 01
+	4 <- 22
+	5 <- 23
+	6 <- 02
+	7 <- 03
+	...
+
+	00 -> 02
+	01 -> 03
+	02 -> 06
+	03 -> 07
+	...
+	*/
+}
+
+static inline void spr_convert_skp(uint16_t* buf_in, uint16_t* buf_out, uint32_t size)
+{
+	// Output goes to every other word (the other C ROM fills the words in
+	// between), so it's stored word by word: a vector store would overwrite
+	// them. Same order as spr_convert without the index math.
+	uint32_t i = 0;
+	for (; i + 32 <= size; i += 32, buf_in += 32, buf_out += 64)
+	{
+		for (int k = 0; k < 16; k++)
+		{
+			buf_out[k << 2] = buf_in[16 + k];
+			buf_out[(k << 2) + 2] = buf_in[k];
+		}
+	}
+	for (uint32_t j = 0; i < size; i++, j++) buf_out[j << 1] = buf_in[(j & ~0x1F) | ((j >> 1) & 0xF) | (((j & 1) ^ 1) << 4)];
+}
+
+static inline void spr_convert_dbl(uint16_t* buf_in, uint16_t* buf_out, uint32_t size)
+{
+	// 64-word block: 32-bit pairs of the upper and lower halves interleaved,
+	// each with its two words swapped. Input is modified.
+	uint32_t blocks = size >> 6;
+	wswap32_buf((uint32_t*)buf_in, blocks * 32);
+
+	uint32_t i = 0;
+	for (; i < (blocks << 6); i += 64) interleave32_buf((uint32_t*)(buf_out + i), (uint32_t*)(buf_in + i + 32), (uint32_t*)(buf_in + i), 16);
+	for (; i < size; i++) buf_out[i] = buf_in[(i & ~0x3F) | ((i ^ 1) & 1) | ((i >> 1) & 0x1E) | (((i & 2) ^ 2) << 4)];
+}
+
+static inline void fix_convert(uint8_t* buf_in, uint8_t* buf_out, uint32_t size)
+{
+	/*
+	In S ROMs, a byte provides two pixels
+	For one fix tile, bytes are used like this: ([...] represents a pair of pixels)
+	[10][18][00][08]
+	[11][19][01][09]
+	[12][1A][02][0A]
+	[13][1B][03][0B]
+	[14][1C][04][0C]
+	[15][1D][05][0D]
+	[16][1E][06][0E]
+	[17][1F][07][0F]
+	The data read for a given tile line (8 pixels) is always the same
+	To take advantage of the SDRAM burst read feature, the data can be loaded so that all 8 pixels of a tile
+	line can be read sequentially: () are 16-bit words, [] is the 2-word burst read
+	[(10 18) (00 08)]
+	[(11 19) (01 09)]...
+
+	In:  FEDCBA9876543210
+	Out: FEDCBA9876510432
+	*/
+	static const uint8_t tbl[32] =
+	{
+		0x10, 0x18, 0x00, 0x08, 0x11, 0x19, 0x01, 0x09, 0x12, 0x1A, 0x02, 0x0A, 0x13, 0x1B, 0x03, 0x0B,
+		0x14, 0x1C, 0x04, 0x0C, 0x15, 0x1D, 0x05, 0x0D, 0x16, 0x1E, 0x06, 0x0E, 0x17, 0x1F, 0x07, 0x0F
+	};
+
+	uint32_t i = size & ~0x1F;
+	shuffle32_buf(buf_out, buf_in, tbl, i);
+	for (; i < size; i++) buf_out[i] = buf_in[(i & ~0x1F) | ((i >> 2) & 7) | ((i & 1) << 3) | (((i & 2) << 3) ^ 0x10)];
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <time.h>   // clock_gettime, CLOCK_REALTIME
+#include <sched.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include "neogeo_loader.h"
 #include "../../sxmlc.h"
@@ -12,6 +14,7 @@
 #include "../../fpga_io.h"
 #include "../../osd.h"
 #include "../../menu.h"
+#include "neogeo_convert.h"
 
 struct NeoFile
 {
@@ -27,86 +30,6 @@ struct NeoFile
 	uint8_t Filler2[4096 - 512];	//fill to 4096
 };
 
-static inline void spr_convert(uint16_t* buf_in, uint16_t* buf_out, uint32_t size)
-{
-	/*
-	In C ROMs, a word provides two bitplanes for an 8-pixel wide line
-	They're used in pairs to provide 32 bits at once (all four bitplanes)
-	For one sprite tile, bytes are used like this: ([...] represents one 8-pixel wide line)
-	Even ROM					Odd ROM
-	[  40 41  ][  00 01  ]		[  42 43  ][  02 03  ]
-	[  44 45  ][  04 05  ]  	[  46 47  ][  06 07  ]
-	[  48 49  ][  08 09  ]  	[  4A 4B  ][  0A 0B  ]
-	[  4C 4D  ][  0C 0D  ]  	[  4E 4F  ][  0E 0F  ]
-	[  50 51  ][  10 11  ]  	[  52 53  ][  12 13  ]
-	...							...
-	The data read for a given tile line (16 pixels) is always the same, only the rendering order of the pixels can change
-	To take advantage of the SDRAM burst read feature, the data can be loaded so that all 16 pixels of a tile
-	line can be read sequentially: () are 16-bit words, [] is the 4-word burst read
-	[(40 41) (00 01) (42 43) (02 03)]
-	[(44 45) (04 05) (46 47) (06 07)]...
-	Word interleaving is done on the FPGA side to mix the two C ROMs data (even/odd)
-
-	In:  FEDCBA9876 54321 0
-	Out: FEDCBA9876 15432 0
-	*/
-
-	for (uint32_t i = 0; i < size; i++) buf_out[i] = buf_in[(i & ~0x1F) | ((i >> 1) & 0xF) | (((i & 1) ^ 1) << 4)];
-
-	/*
-	0 <- 20
-	1 <- 21
-	2 <- 00
-	3 <- 01
-	4 <- 22
-	5 <- 23
-	6 <- 02
-	7 <- 03
-	...
-
-	00 -> 02
-	01 -> 03
-	02 -> 06
-	03 -> 07
-	...
-	*/
-}
-
-static inline void spr_convert_skp(uint16_t* buf_in, uint16_t* buf_out, uint32_t size)
-{
-	for (uint32_t i = 0; i < size; i++) buf_out[i << 1] = buf_in[(i & ~0x1F) | ((i >> 1) & 0xF) | (((i & 1) ^ 1) << 4)];
-}
-
-static inline void spr_convert_dbl(uint16_t* buf_in, uint16_t* buf_out, uint32_t size)
-{
-	for (uint32_t i = 0; i < size; i++) buf_out[i] = buf_in[(i & ~0x3F) | ((i ^ 1) & 1) | ((i >> 1) & 0x1E) | (((i & 2) ^ 2) << 4)];
-}
-
-static void fix_convert(uint8_t* buf_in, uint8_t* buf_out, uint32_t size)
-{
-	/*
-	In S ROMs, a byte provides two pixels
-	For one fix tile, bytes are used like this: ([...] represents a pair of pixels)
-	[10][18][00][08]
-	[11][19][01][09]
-	[12][1A][02][0A]
-	[13][1B][03][0B]
-	[14][1C][04][0C]
-	[15][1D][05][0D]
-	[16][1E][06][0E]
-	[17][1F][07][0F]
-	The data read for a given tile line (8 pixels) is always the same
-	To take advantage of the SDRAM burst read feature, the data can be loaded so that all 8 pixels of a tile
-	line can be read sequentially: () are 16-bit words, [] is the 2-word burst read
-	[(10 18) (00 08)]
-	[(11 19) (01 09)]...
-
-	In:  FEDCBA9876543210
-	Out: FEDCBA9876510432
-	*/
-	for (uint32_t i = 0; i < size; i++) buf_out[i] = buf_in[(i & ~0x1F) | ((i >> 2) & 7) | ((i & 1) << 3) | (((i & 2) << 3) ^ 0x10)];
-}
-
 static char pchar[] = { 0x8C, 0x8E, 0x8F, 0x90, 0x91, 0x7F };
 
 #define PROGRESS_CNT    10
@@ -164,30 +87,48 @@ static uint32_t neogeo_file_tx(const char* path, const char* name, uint8_t neo_f
 
 	int progress = -1;
 
+	// next block is read while the current one goes over SPI
+	fileReadAhead *ra = FileReadAheadStart(&f, bytes2send, sizeof(buf));
+
 	while (bytes2send)
 	{
 		uint16_t chunk = (bytes2send > sizeof(buf)) ? sizeof(buf) : bytes2send;
+		uint8_t *data = buf;
 
-		FileReadAdv(&f, buf, chunk);
+		if (!ra) FileReadAdv(&f, buf, chunk);
+		else
+		{
+			int len = FileReadAheadGet(ra, &data);
+			if (len <= 0)
+			{
+				if (len < 0)
+				{
+					printf("Read error in %s\n", name);
+					size = 0;
+				}
+				break;
+			}
+			if (chunk > len) chunk = len;
+		}
 
 		EnableFpga();
 		spi8(FIO_FILE_TX_DAT);
 
 		if (neo_file_type == NEO_FILE_RAW)
 		{
-			spi_write(buf, chunk, 1);
+			spi_write(data, chunk, 1);
 		}
 		else if (neo_file_type == NEO_FILE_8BIT)
 		{
-			spi_write(buf, chunk, 0);
+			spi_write(data, chunk, 0);
 		}
 		else
 		{
-			if (neo_file_type == NEO_FILE_FIX) fix_convert(buf, buf_out, sizeof(buf_out));
+			if (neo_file_type == NEO_FILE_FIX) fix_convert(data, buf_out, sizeof(buf_out));
 			else if (neo_file_type == NEO_FILE_SPR)
 			{
-				if (index == 15) spr_convert_dbl((uint16_t*)buf, (uint16_t*)buf_out, sizeof(buf_out)/2);
-				else spr_convert((uint16_t*)buf, (uint16_t*)buf_out, sizeof(buf_out)/2);
+				if (index == 15) spr_convert_dbl((uint16_t*)data, (uint16_t*)buf_out, sizeof(buf_out)/2);
+				else spr_convert((uint16_t*)data, (uint16_t*)buf_out, sizeof(buf_out)/2);
 			}
 
 			spi_write(buf_out, chunk, 1);
@@ -203,6 +144,7 @@ static uint32_t neogeo_file_tx(const char* path, const char* name, uint8_t neo_f
 		bytes2send -= chunk;
 	}
 
+	FileReadAheadStop(ra);
 	FileClose(&f);
 
 	// signal end of transmission
@@ -223,40 +165,136 @@ static void make_path(const char *root, const char *name, char *path)
 	strcat(path, name);
 }
 
-extern uint8_t loadbuf[];
-static uint32_t load_crom_to_mem(const char* path, const char* name, uint8_t index, uint32_t offset, uint32_t size)
+static uint32_t crom_sz_max = 0;
+static uint32_t crom_start = 0;
+
+#define ALIGN_1MB ((1024*1024)-1)
+static void notify_core(uint8_t index, uint32_t size)
 {
-	fileTYPE f = {};
-	static char name_buf[1024];
+	user_io_set_index(10);
+	user_io_set_download(1);
+
+	if (index == 4 || index == 6) size = (size + ALIGN_1MB) & ~ALIGN_1MB;
+	char memcp = !(index == 9 || (index >= 16 && index < 64));
+	printf("notify_core(%d,%d): memcp = %d\n", index, size, memcp);
+
+	if (index == 15 && size > crom_sz_max) crom_sz_max = size;
+	if (index == 4) crom_start = 0x200000 + size;
+	if (index == 5) crom_start = 0x280000 + size;
+	if (index == 6) crom_start = 0x300000 + size;
+
+	EnableFpga();
+	spi8(FIO_FILE_TX_DAT);
+	spi_w(index);
+	spi_w((uint16_t)size);
+	spi_w(size >> 16);
+	spi_w(memcp); //copy flag
+	spi_w(0);
+	DisableFpga();
+
+	user_io_set_download(0);
+}
 
+// ROMs are loaded by worker threads on both CPU cores. Jobs are queued by
+// neogeo_tx() in the original order and started as soon as no earlier job
+// writing the same DDR area is still pending. Notifications to the core
+// are sent from the main thread strictly in queue order.
+#define NEO_JOBS_MAX 128
+#define NEO_WORKERS  2
+
+#define NEO_JOB_ROM       0
+#define NEO_JOB_CROM      1
+#define NEO_JOB_CROM_DONE 2 // notify the core about loaded C ROMs
+
+#define NEO_JOB_QUEUED    0
+#define NEO_JOB_RUNNING   1
+#define NEO_JOB_DONE      2
+#define NEO_JOB_COMMITTED 3
+
+struct neo_job
+{
+	int      kind;
+	char     path[1024];
+	char     name[256];
+	uint8_t  neo_file_type;
+	uint8_t  index;
+	uint32_t offset, size, expand, addr;
+	int      swap;
+	int      more;          // size is added to the next job before notification
+
+	uint32_t ddr_start, ddr_end;
+	uint32_t total;
+	uint32_t progress;      // bytes done, polled by the main thread for OSD
+	uint32_t result;
+	int      state;
+};
+
+extern uint8_t loadbuf[];
+static neo_job neo_jobs[NEO_JOBS_MAX];
+static int neo_job_cnt = 0;
+static int crom_pending = 0;
+static uint32_t crom_lo = 0, crom_hi = 0;
+
+static pthread_mutex_t neo_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t neo_file_lock = PTHREAD_MUTEX_INITIALIZER; // file_io open/seek use static buffers
+static pthread_cond_t  neo_cond = PTHREAD_COND_INITIALIZER;
+
+static int neo_open(fileTYPE *f, const char* path, const char* name, uint32_t offset, uint32_t *size)
+{
+	char name_buf[1024];
 	make_path(path, name, name_buf);
-	if (!FileOpen(&f, name_buf, 0)) return 0;
-	if (!size && offset < f.size) size = f.size - offset;
-	if (!size)
+
+	pthread_mutex_lock(&neo_file_lock);
+	int ret = FileOpen(f, name_buf, 0);
+	if (ret)
 	{
-		FileClose(&f);
-		return 0;
+		if (!*size && offset < f->size) *size = f->size - offset;
+		if (*size) FileSeek(f, offset, SEEK_SET);
 	}
+	pthread_mutex_unlock(&neo_file_lock);
+
+	if (ret && !*size)
+	{
+		FileClose(f);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+static void neo_close(fileTYPE *f)
+{
+	pthread_mutex_lock(&neo_file_lock);
+	FileClose(f);
+	pthread_mutex_unlock(&neo_file_lock);
+}
+
+static uint32_t load_crom_to_mem(neo_job *job, uint8_t *tmpbuf)
+{
+	fileTYPE f = {};
+	uint32_t size = job->size;
+	uint8_t index = job->index;
+
+	if (!neo_open(&f, job->path, job->name, job->offset, &size)) return 0;
 
 	int memfd = open("/dev/mem", O_RDWR | O_SYNC);
 	if (memfd == -1)
 	{
 		printf("Unable to open /dev/mem!\n");
-		FileClose(&f);
+		neo_close(&f);
 		return 0;
 	}
 
 	size *= 2;
-
-	FileSeek(&f, offset, SEEK_SET);
-	printf("CROM %s (offset %u, size %u) with index %u\n", name, offset, size, index);
+	printf("CROM %s (offset %u, size %u) with index %u\n", job->name, job->offset, size, index);
 
 	// Put pairs of bitplanes in the correct order for the core
-	int progress = -1;
-
 	uint32_t remain = size;
 	uint32_t map_addr = 0x38000000 + (((index - 64) >> 1) * 1024 * 1024);
 
+	// next part is read while the current one is reordered into DDR
+	fileReadAhead *ra = FileReadAheadStart(&f, size / 2, LOADBUF_SZ / 2);
+
 	while (remain)
 	{
 		uint32_t partsz = remain;
@@ -267,70 +305,71 @@ static uint32_t load_crom_to_mem(const char* path, const char* name, uint8_t ind
 		if (base == (void *)-1)
 		{
 			printf("Unable to mmap (0x%X, %d)!\n", map_addr, partsz);
+			FileReadAheadStop(ra);
 			close(memfd);
-			FileClose(&f);
+			neo_close(&f);
 			return 0;
 		}
 
-		FileReadAdv(&f, loadbuf, partsz/2);
-		spr_convert_skp((uint16_t*)loadbuf, ((uint16_t*)base) + ((index ^ 1) & 1), partsz / 4);
-
-		int new_progress = PROGRESS_MAX - ((((uint64_t)(remain - partsz))*PROGRESS_MAX) / size);
-		if (progress != new_progress)
+		uint8_t *buf = tmpbuf;
+		if (!ra) FileReadAdv(&f, tmpbuf, partsz / 2);
+		else
 		{
-			progress = new_progress;
-			neogeo_osd_progress(name, progress);
+			int got = FileReadAheadGet(ra, &buf);
+			if (got < 0)
+			{
+				printf("Read error in %s\n", job->name);
+				munmap(base, partsz);
+				FileReadAheadStop(ra);
+				close(memfd);
+				neo_close(&f);
+				return 0;
+			}
+
+			if (!got) buf = tmpbuf;
+			if ((uint32_t)got < partsz / 2) memset(buf + got, 0, (partsz / 2) - got);
 		}
+		spr_convert_skp((uint16_t*)buf, ((uint16_t*)base) + ((index ^ 1) & 1), partsz / 4);
 
 		munmap(base, partsz);
 		remain -= partsz;
 		map_addr += partsz;
+		__atomic_store_n(&job->progress, size - remain, __ATOMIC_RELAXED);
 	}
 
+	FileReadAheadStop(ra);
 	close(memfd);
-	FileClose(&f);
+	neo_close(&f);
 
 	return map_addr - 0x38000000;
 }
 
-static inline void spr_bswap(uint32_t* buf, uint32_t size)
-{
-	for (uint32_t i = 0; i < size; i++) buf[i] = (buf[i] & 0xFF0000FF) | ((buf[i] & 0xFF00) << 8) | ((buf[i] & 0xFF0000) >> 8);
-}
-
-static uint32_t load_rom_to_mem(const char* path, const char* name, uint8_t neo_file_type, uint8_t index, uint32_t offset, uint32_t size, uint32_t expand, int swap, uint32_t addr)
+static uint32_t load_rom_to_mem(neo_job *job, uint8_t *tmpbuf)
 {
 	fileTYPE f = {};
-	static char name_buf[1024];
+	uint32_t size = job->size;
+	uint32_t expand = job->expand;
+	uint8_t index = job->index;
+	uint8_t neo_file_type = job->neo_file_type;
 
-	make_path(path, name, name_buf);
-	if (!FileOpen(&f, name_buf, 0)) return 0;
-	if (!size && offset < f.size) size = f.size - offset;
-	if (!size)
-	{
-		FileClose(&f);
-		return 0;
-	}
+	if (!neo_open(&f, job->path, job->name, job->offset, &size)) return 0;
 
 	int memfd = open("/dev/mem", O_RDWR | O_SYNC);
 	if (memfd == -1)
 	{
 		printf("Unable to open /dev/mem!\n");
-		FileClose(&f);
+		neo_close(&f);
 		return 0;
 	}
 
-	FileSeek(&f, offset, SEEK_SET);
-	printf("ROM %s (offset %u, size %u, exp %u, type %u, addr %u) with index %u\n", name, offset, size, expand, neo_file_type, addr, index);
-
-	int progress = -1;
+	printf("ROM %s (offset %u, size %u, exp %u, type %u, addr %u) with index %u\n", job->name, job->offset, size, expand, neo_file_type, job->addr, index);
 
 	uint32_t remainf = size;
 
 	if(expand) size = expand;
 	uint32_t remain = size;
 
-	uint32_t map_addr = 0x30000000 + (addr ? addr : ((index >= 16) && (index < 64)) ? (index - 16) * 0x80000 : (index == 9) ? 0x2000000 : 0x8000000);
+	uint32_t map_addr = job->ddr_start;
 
 	while (remain)
 	{
@@ -346,22 +385,22 @@ static uint32_t load_rom_to_mem(const char* path, const char* name, uint8_t neo_
 		{
 			printf("Unable to mmap (0x%X, %d)!\n", map_addr, partsz);
 			close(memfd);
-			FileClose(&f);
+			neo_close(&f);
 			return 0;
 		}
 
 		if (neo_file_type == NEO_FILE_FIX)
 		{
-			memset(loadbuf, 0, partsz);
-			if (partszf) FileReadAdv(&f, loadbuf, partszf);
-			fix_convert(loadbuf, (uint8_t*)base, partsz);
+			memset(tmpbuf, 0, partsz);
+			if (partszf) FileReadAdv(&f, tmpbuf, partszf);
+			fix_convert(tmpbuf, (uint8_t*)base, partsz);
 		}
 		else if (neo_file_type == NEO_FILE_SPR)
 		{
-			memset(loadbuf, 0, partsz);
-			if (partszf) FileReadAdv(&f, loadbuf, partszf);
-			if (swap) spr_bswap((uint32_t*)loadbuf, partsz / 4);
-			spr_convert_dbl((uint16_t*)loadbuf, (uint16_t*)base, partsz / 2);
+			memset(tmpbuf, 0, partsz);
+			if (partszf) FileReadAdv(&f, tmpbuf, partszf);
+			if (job->swap) bswap_mid32_buf((uint32_t*)tmpbuf, partsz / 4);
+			spr_convert_dbl((uint16_t*)tmpbuf, (uint16_t*)base, partsz / 2);
 		}
 		else
 		{
@@ -369,54 +408,246 @@ static uint32_t load_rom_to_mem(const char* path, const char* name, uint8_t neo_
 			if (partszf) FileReadAdv(&f, base, partszf);
 		}
 
-		int new_progress = PROGRESS_MAX - ((((uint64_t)(remain - partsz))*PROGRESS_MAX) / size);
-		if (progress != new_progress)
-		{
-			progress = new_progress;
-			neogeo_osd_progress(name, progress);
-		}
 		munmap(base, partsz);
 		remain -= partsz;
 		map_addr += partsz;
+		__atomic_store_n(&job->progress, size - remain, __ATOMIC_RELAXED);
 	}
 
 	close(memfd);
-	FileClose(&f);
+	neo_close(&f);
 
 	return size;
 }
 
-static uint32_t crom_sz_max = 0;
-static uint32_t crom_start = 0;
+static int neo_job_conflict(neo_job *a, neo_job *b)
+{
+	if (a->ddr_start >= b->ddr_end || b->ddr_start >= a->ddr_end) return 0;
 
-#define ALIGN_1MB ((1024*1024)-1)
-static void notify_core(uint8_t index, uint32_t size)
+	// even and odd C ROMs fill alternate words of the same area
+	if (a->kind == NEO_JOB_CROM && b->kind == NEO_JOB_CROM) return !((a->index ^ b->index) & 1);
+	return 1;
+}
+
+// neo_lock must be held
+static neo_job *neo_job_next(int *pending)
 {
-	user_io_set_index(10);
-	user_io_set_download(1);
+	*pending = 0;
+	for (int i = 0; i < neo_job_cnt; i++)
+	{
+		neo_job *job = &neo_jobs[i];
+		if (job->state != NEO_JOB_QUEUED) continue;
 
-	if (index == 4 || index == 6) size = (size + ALIGN_1MB) & ~ALIGN_1MB;
-	char memcp = !(index == 9 || (index >= 16 && index < 64));
-	printf("notify_core(%d,%d): memcp = %d\n", index, size, memcp);
+		*pending = 1;
+		int ready = 1;
+		for (int j = 0; j < i && ready; j++)
+		{
+			if (neo_jobs[j].state != NEO_JOB_COMMITTED && neo_job_conflict(&neo_jobs[j], job)) ready = 0;
+		}
 
-	if (index == 15 && size > crom_sz_max) crom_sz_max = size;
-	if (index == 4) crom_start = 0x200000 + size;
-	if (index == 5) crom_start = 0x280000 + size;
-	if (index == 6) crom_start = 0x300000 + size;
+		if (ready) return job;
+	}
 
-	EnableFpga();
-	spi8(FIO_FILE_TX_DAT);
-	spi_w(index);
-	spi_w((uint16_t)size);
-	spi_w(size >> 16);
-	spi_w(memcp); //copy flag
-	spi_w(0);
-	DisableFpga();
+	return NULL;
+}
 
-	user_io_set_download(0);
+static uint32_t neo_job_exec(neo_job *job, uint8_t *tmpbuf)
+{
+	if (!tmpbuf) return 0;
+	return (job->kind == NEO_JOB_CROM) ? load_crom_to_mem(job, tmpbuf) : load_rom_to_mem(job, tmpbuf);
+}
+
+static void *neo_worker(void *)
+{
+	uint8_t *tmpbuf = (uint8_t*)malloc(LOADBUF_SZ);
+
+	pthread_mutex_lock(&neo_lock);
+	while (1)
+	{
+		int pending;
+		neo_job *job = neo_job_next(&pending);
+		if (!job)
+		{
+			if (!pending) break;
+			pthread_cond_wait(&neo_cond, &neo_lock);
+			continue;
+		}
+
+		job->state = NEO_JOB_RUNNING;
+		pthread_mutex_unlock(&neo_lock);
+
+		uint32_t res = neo_job_exec(job, tmpbuf);
+
+		pthread_mutex_lock(&neo_lock);
+		job->result = res;
+		__atomic_store_n(&job->progress, job->total, __ATOMIC_RELAXED);
+		job->state = NEO_JOB_DONE;
+		pthread_cond_broadcast(&neo_cond);
+	}
+	pthread_mutex_unlock(&neo_lock);
+
+	free(tmpbuf);
+	return NULL;
 }
 
 static uint32_t crom_sz = 0;
+static void neo_job_commit(neo_job *job)
+{
+	static uint32_t acc = 0;
+
+	switch (job->kind)
+	{
+	case NEO_JOB_CROM:
+		if (job->result > crom_sz) crom_sz = job->result;
+		break;
+
+	case NEO_JOB_CROM_DONE:
+		if (crom_sz)
+		{
+			notify_core(15, crom_sz);
+			crom_sz = 0;
+		}
+		break;
+
+	default:
+		acc += job->result;
+		if (!job->more)
+		{
+			if (acc) notify_core(job->index, acc);
+			acc = 0;
+		}
+		break;
+	}
+}
+
+static void neo_jobs_run()
+{
+	if (!neo_job_cnt) return;
+
+	uint32_t total = 0;
+	for (int i = 0; i < neo_job_cnt; i++) total += neo_jobs[i].total;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+	CPU_SET(1, &set);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+
+	pthread_t workers[NEO_WORKERS];
+	int nworkers = 0;
+	for (int i = 0; i < NEO_WORKERS; i++)
+	{
+		if (!pthread_create(&workers[nworkers], &attr, neo_worker, NULL)) nworkers++;
+	}
+	pthread_attr_destroy(&attr);
+
+	int progress = -1;
+
+	if (!nworkers)
+	{
+		printf("neogeo: failed to start loader threads, loading sequentially.\n");
+		for (int i = 0; i < neo_job_cnt; i++)
+		{
+			neo_job *job = &neo_jobs[i];
+			if (job->state == NEO_JOB_QUEUED) job->result = neo_job_exec(job, loadbuf);
+			neo_job_commit(job);
+		}
+		neo_job_cnt = 0;
+		return;
+	}
+
+	int committed = 0;
+
+	pthread_mutex_lock(&neo_lock);
+	while (committed < neo_job_cnt)
+	{
+		neo_job *job = &neo_jobs[committed];
+		if (job->state == NEO_JOB_DONE)
+		{
+			pthread_mutex_unlock(&neo_lock);
+			neo_job_commit(job);
+			pthread_mutex_lock(&neo_lock);
+
+			job->state = NEO_JOB_COMMITTED;
+			committed++;
+			pthread_cond_broadcast(&neo_cond);
+			continue;
+		}
+
+		uint64_t done = 0;
+		for (int i = 0; i < neo_job_cnt; i++) done += __atomic_load_n(&neo_jobs[i].progress, __ATOMIC_RELAXED);
+
+		int new_progress = total ? (int)((done * PROGRESS_MAX) / total) : PROGRESS_MAX;
+		if (progress != new_progress && job->name[0])
+		{
+			progress = new_progress;
+			pthread_mutex_unlock(&neo_lock);
+			neogeo_osd_progress(job->name, progress);
+			pthread_mutex_lock(&neo_lock);
+			continue;
+		}
+
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 50000000;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&neo_cond, &neo_lock, &ts);
+	}
+	pthread_mutex_unlock(&neo_lock);
+
+	for (int i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+	neo_job_cnt = 0;
+}
+
+static neo_job *neo_job_add(int kind)
+{
+	if (neo_job_cnt >= NEO_JOBS_MAX) neo_jobs_run();
+
+	neo_job *job = &neo_jobs[neo_job_cnt++];
+	memset(job, 0, sizeof(neo_job));
+	job->kind = kind;
+	job->state = (kind == NEO_JOB_CROM_DONE) ? NEO_JOB_DONE : NEO_JOB_QUEUED;
+	return job;
+}
+
+// size of the file part to load, 0 if not available
+static uint32_t neo_file_size(const char* path, const char* name, uint32_t offset, uint32_t size)
+{
+	fileTYPE f = {};
+	if (!neo_open(&f, path, name, offset, &size)) return 0;
+	neo_close(&f);
+	return size;
+}
+
+static uint32_t neo_queue_rom(const char* path, const char* name, uint8_t neo_file_type, uint8_t index, uint32_t offset, uint32_t size, uint32_t expand, int swap, uint32_t addr)
+{
+	uint32_t sz = neo_file_size(path, name, offset, size);
+	if (!sz) return 0;
+	if (expand) sz = expand;
+
+	neo_job *job = neo_job_add(NEO_JOB_ROM);
+	strcpy(job->path, path);
+	strncpy(job->name, name, sizeof(job->name) - 1);
+	job->neo_file_type = neo_file_type;
+	job->index = index;
+	job->offset = offset;
+	job->size = size;
+	job->expand = expand;
+	job->swap = swap;
+	job->addr = addr;
+	job->ddr_start = 0x30000000 + (addr ? addr : ((index >= 16) && (index < 64)) ? (index - 16) * 0x80000 : (index == 9) ? 0x2000000 : 0x8000000);
+	job->ddr_end = job->ddr_start + sz;
+	job->total = sz;
+	return sz;
+}
+
 static uint32_t neogeo_tx(const char* path, const char* name, uint8_t neo_file_type, int16_t index, uint32_t offset, uint32_t size, uint32_t expand = 0, int swap = 0)
 {
 	/*
@@ -428,26 +659,48 @@ static uint32_t neogeo_tx(const char* path, const char* name, uint8_t neo_file_t
 
 	if (index >= 64)
 	{
-		sz = load_crom_to_mem(path, name, index, offset, size);
-		if (sz > crom_sz) crom_sz = sz;
-		return sz;
+		sz = neo_file_size(path, name, offset, size);
+		if (!sz) return 0;
+
+		neo_job *job = neo_job_add(NEO_JOB_CROM);
+		strcpy(job->path, path);
+		strncpy(job->name, name, sizeof(job->name) - 1);
+		job->index = index;
+		job->offset = offset;
+		job->size = size;
+		job->ddr_start = 0x38000000 + (((index - 64) >> 1) * 1024 * 1024);
+		job->ddr_end = job->ddr_start + sz * 2;
+		job->total = sz * 2;
+
+		if (!crom_pending || job->ddr_start < crom_lo) crom_lo = job->ddr_start;
+		if (!crom_pending || job->ddr_end > crom_hi) crom_hi = job->ddr_end;
+		crom_pending = 1;
+		return job->ddr_end - 0x38000000;
 	}
 
-	if (crom_sz)
+	if (crom_pending)
 	{
-		sz = crom_sz;
-		notify_core(15, crom_sz);
-		crom_sz = 0;
+		// C ROM area must be taken by the core before it's reused
+		neo_job *job = neo_job_add(NEO_JOB_CROM_DONE);
+		job->ddr_start = crom_lo;
+		job->ddr_end = crom_hi;
+		crom_pending = 0;
 	}
 
 	if (index >= 0)
 	{
-		sz = load_rom_to_mem(path, name, neo_file_type, index, offset, size, expand, swap, 0);
-
 		//multipart prom
-		if (!strcasecmp(name, "prom") && index == 4) sz += load_rom_to_mem(path, "prom1", neo_file_type, index, offset, size, expand, swap, sz);
+		int multi = (!strcasecmp(name, "prom") && index == 4);
+		if (multi && neo_job_cnt > NEO_JOBS_MAX - 2) neo_jobs_run();
 
-		if (sz) notify_core(index, sz);
+		int first = neo_job_cnt;
+		sz = neo_queue_rom(path, name, neo_file_type, index, offset, size, expand, swap, 0);
+		if (multi)
+		{
+			uint32_t sz1 = neo_queue_rom(path, "prom1", neo_file_type, index, offset, size, expand, swap, sz);
+			if (sz && sz1) neo_jobs[first].more = 1;
+			sz += sz1;
+		}
 	}
 
 	return sz;
@@ -1119,6 +1372,8 @@ int neogeo_romset_tx(char* name)
 	crom_sz_max = 0;
 	crom_start = 0;
 	crom_sz = 0;
+	crom_pending = 0;
+	neo_job_cnt = 0;
 	set_config(0, -1);
 
 	const char* home = HomeDir();
@@ -1188,6 +1443,8 @@ int neogeo_romset_tx(char* name)
 	neogeo_tx(NULL, NULL, 0, -1, 0, 0);
 
 	if (!(system_type & 2))	neogeo_tx(home, "sfix.sfix", NEO_FILE_FIX, 2, 0, 0);
+	neo_jobs_run();
+
 	neogeo_file_tx(home, "000-lo.lo", NEO_FILE_8BIT, 1, 0, 0x10000);
 
 	if (crom_start < 0x300000) crom_start = 0x300000;
@@ -8,6 +8,7 @@
 #include "../../user_io.h"
 
 #include "../chd/mister_chd.h"
+#include "../../bufops.h"
 #include "pcecd.h"
 
 #define PCECD_DATA_IO_INDEX 2
@@ -290,7 +291,7 @@ void pcecdd_t::Unload()
 	{
 		if (this->toc.chd_f)
 		{
-			chd_close(this->toc.chd_f);
+			mister_chd_close(this->toc.chd_f);
 			this->toc.chd_f = NULL;
 			if (this->chd_hunkbuf)
 			{
@@ -846,12 +847,7 @@ int pcecdd_t::ReadCDDA(uint8_t *buf)
 	if (this->toc.chd_f)
 	{
 		mister_chd_read_sector(this->toc.chd_f, this->lba + this->toc.tracks[this->index].offset, 0, 0, this->audioLength, buf, this->chd_hunkbuf, &this->chd_hunknum);
-		for (int swapidx = 0; swapidx < this->audioLength; swapidx += 2)
-		{
-			uint8_t temp = buf[swapidx];
-			buf[swapidx] = buf[swapidx+1];
-			buf[swapidx+1] = temp;
-		}
+		bswap16_buf(buf, this->audioLength);
 	} else if (this->toc.tracks[this->index].f.opened()) {
 		FileReadAdv(&this->toc.tracks[this->index].f, buf, this->audioLength);
 	}
@@ -32,11 +32,14 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "../../spi.h"
 #include "../../user_io.h"
 #include "../../file_io.h"
 #include "../../fpga_io.h"
+#include "../../hardware.h"
+#include "../../scheduler.h"
 #include "x86_share.h"
 #include "x86_ide.h"
 #include "x86_cdrom.h"
@@ -240,8 +243,131 @@ static fileTYPE fdd1_image = {};
 static fileTYPE ide_image[4] = {};
 static bool boot_from_floppy = 1;
 
+// Sequential reads are served from a run prefetched by a worker thread
+// while the core consumes the previous DMA buffer. The run doubles while
+// the reads stay sequential.
+#define IMG_PF_MIN 64
+#define IMG_PF_MAX 512
+
+static struct
+{
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	int             started;
+	int             busy;
+
+	fileTYPE       *f;
+	uint32_t        lba;
+	uint32_t        sect;    // requested sectors
+	uint32_t        len;     // valid bytes
+	uint8_t         buf[IMG_PF_MAX * 512];
+} img_pf = {};
+
+static struct
+{
+	uint64_t rd_bytes;
+	uint64_t pf_bytes;
+	uint64_t wr_bytes;
+	unsigned long timer;
+	struct timespec start;
+} img_stat = {};
+
+static void *img_pf_worker(void *)
+{
+	pthread_mutex_lock(&img_pf.lock);
+	while (1)
+	{
+		while (!img_pf.busy) pthread_cond_wait(&img_pf.cond, &img_pf.lock);
+
+		int fd = fileno(img_pf.f->filp);
+		off_t off = (off_t)img_pf.lba << 9;
+		pthread_mutex_unlock(&img_pf.lock);
+
+		ssize_t ret = pread(fd, img_pf.buf, img_pf.sect << 9, off);
+
+		pthread_mutex_lock(&img_pf.lock);
+		img_pf.len = (ret > 0) ? ret : 0;
+		img_pf.busy = 0;
+		pthread_cond_broadcast(&img_pf.cond);
+	}
+	return NULL;
+}
+
+static void img_pf_wait()
+{
+	if (!img_pf.started) return;
+
+	pthread_mutex_lock(&img_pf.lock);
+	while (img_pf.busy) pthread_cond_wait(&img_pf.cond, &img_pf.lock);
+	pthread_mutex_unlock(&img_pf.lock);
+}
+
+static void img_pf_drop(fileTYPE *f)
+{
+	img_pf_wait();
+	if (img_pf.f == f)
+	{
+		img_pf.f = NULL;
+		img_pf.len = 0;
+	}
+}
+
+static void img_pf_start(fileTYPE *f, uint32_t lba, uint32_t sect)
+{
+	if (!f->filp) return;
+
+	if (!img_pf.started)
+	{
+		pthread_mutex_init(&img_pf.lock, NULL);
+		pthread_cond_init(&img_pf.cond, NULL);
+		if (pthread_create(&img_pf.thread, NULL, img_pf_worker, NULL))
+		{
+			printf("x86: failed to start prefetch thread.\n");
+			return;
+		}
+		img_pf.started = 1;
+	}
+
+	pthread_mutex_lock(&img_pf.lock);
+	while (img_pf.busy) pthread_cond_wait(&img_pf.cond, &img_pf.lock);
+	img_pf.f = f;
+	img_pf.lba = lba;
+	img_pf.sect = sect;
+	img_pf.len = 0;
+	img_pf.busy = 1;
+	pthread_cond_signal(&img_pf.cond);
+	pthread_mutex_unlock(&img_pf.lock);
+}
+
+static void img_stat_poll()
+{
+	if (!img_stat.timer)
+	{
+		img_stat.timer = GetTimer(10000);
+		clock_gettime(CLOCK_MONOTONIC, &img_stat.start);
+		return;
+	}
+
+	if (!CheckTimer(img_stat.timer)) return;
+
+	if (img_stat.rd_bytes || img_stat.wr_bytes)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double sec = (now.tv_sec - img_stat.start.tv_sec) + (now.tv_nsec - img_stat.start.tv_nsec) / 1000000000.0;
+
+		printf("x86 disk: read %.1f KB/s (%d%% prefetched), write %.1f KB/s\n",
+			img_stat.rd_bytes / 1024.0 / sec, (int)(img_stat.pf_bytes * 100 / (img_stat.rd_bytes ? img_stat.rd_bytes : 1)),
+			img_stat.wr_bytes / 1024.0 / sec);
+	}
+
+	memset(&img_stat, 0, sizeof(img_stat));
+}
+
 static int img_mount(fileTYPE *f, const char *name, int rw)
 {
+	img_pf_drop(f);
 	FileClose(f);
 	int writable = 0, ret = 0;
 
@@ -269,16 +395,70 @@ static int img_mount(fileTYPE *f, const char *name, int rw)
 	return 1;
 }
 
-static int img_read(fileTYPE *f, uint32_t lba, void *buf, uint32_t cnt)
+// ahead: sectors the caller knows will be read next (rest of an IDE command)
+static int img_read(fileTYPE *f, uint32_t lba, void *buf, uint32_t cnt, uint32_t ahead = 0)
 {
-	if (!FileSeekLBA(f, lba)) return 0;
-	return FileReadAdv(f, buf, cnt * 512);
+	static fileTYPE *last_f = NULL;
+	static uint32_t next_lba = 0;
+	static uint32_t run = IMG_PF_MIN;
+
+	int ret = 0;
+	int seq = (f == last_f && lba == next_lba);
+	last_f = f;
+	next_lba = lba + cnt;
+	if (!seq) run = IMG_PF_MIN;
+
+	if (seq && img_pf.f == f)
+	{
+		img_pf_wait();
+		if (img_pf.f == f && lba >= img_pf.lba && (lba + cnt) <= img_pf.lba + (img_pf.len >> 9))
+		{
+			ret = cnt * 512;
+			memcpy(buf, img_pf.buf + ((lba - img_pf.lba) << 9), ret);
+			img_stat.pf_bytes += ret;
+		}
+	}
+
+	if (!ret)
+	{
+		if (!FileSeekLBA(f, lba)) return 0;
+		ret = FileReadAdv(f, buf, cnt * 512);
+	}
+
+	if (ret > 0) img_stat.rd_bytes += ret;
+
+	// next run is requested once the current one is used up
+	if ((seq || ahead) && ret == (int)(cnt * 512) && (img_pf.f != f || next_lba >= img_pf.lba + (img_pf.len >> 9)))
+	{
+		uint32_t sect = seq ? run : 0;
+		if (seq && run < IMG_PF_MAX) run <<= 1;
+		if (sect < ahead) sect = ahead;
+		if (sect > IMG_PF_MAX) sect = IMG_PF_MAX;
+		img_pf_start(f, next_lba, sect);
+	}
+
+	return ret;
+}
+
+int x86_img_read(fileTYPE *f, uint32_t lba, void *buf, uint32_t cnt, uint32_t ahead)
+{
+	return img_read(f, lba, buf, cnt, ahead);
+}
+
+void x86_img_drop(fileTYPE *f)
+{
+	img_pf_drop(f);
 }
 
 static uint32_t img_write(fileTYPE *f, uint32_t lba, void *buf, uint32_t cnt)
 {
+	// prefetched data must not outlive a write to the image
+	img_pf_drop(f);
+
 	if (!FileSeekLBA(f, lba)) return 0;
-	return FileWriteAdv(f, buf, cnt * 512);
+	uint32_t ret = FileWriteAdv(f, buf, cnt * 512);
+	img_stat.wr_bytes += ret;
+	return ret;
 }
 
 static int floppy_wait_cycles;
@@ -762,10 +942,13 @@ void x86_poll()
 	}
 
 	x86_share_poll();
+	img_stat_poll();
 
 	uint16_t sd_req = dma_sdio(0);
 	if (sd_req)
 	{
+		scheduler_io_active();
+
 		if (sd_req & 0x8000)
 		{
 			if (v3) x86_ide_io(0, sd_req & 7);
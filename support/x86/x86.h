@@ -1,6 +1,10 @@
 #ifndef X86_H
 #define X86_H
 
+#include <stdint.h>
+
+struct fileTYPE;
+
 void x86_init();
 void x86_poll();
 
@@ -12,6 +16,11 @@ void x86_config_load();
 void x86_config_save();
 void x86_set_fdd_boot(uint32_t boot);
 
+// hard disk image reads with prefetch of sequential runs, for x86_ide.
+// ahead: sectors known to follow. x86_img_drop before writing to the image.
+int x86_img_read(fileTYPE *f, uint32_t lba, void *buf, uint32_t cnt, uint32_t ahead);
+void x86_img_drop(fileTYPE *f);
+
 void x86_dma_set(uint32_t address, uint32_t data);
 void x86_dma_sendbuf(uint32_t address, uint32_t length, uint32_t *data);
 void x86_dma_recvbuf(uint32_t address, uint32_t length, uint32_t *data);
@@ -1432,7 +1432,7 @@ void cdrom_close_chd(drive_t *drv)
 
 	if (drv->chd_f)
 	{
-		chd_close(drv->chd_f);
+		mister_chd_close(drv->chd_f);
 		drv->chd_f = NULL;
 	}
 
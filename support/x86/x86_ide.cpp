@@ -399,10 +399,12 @@ static void process_read(ide_config *ide)
 	if (ide->state == IDE_STATE_INIT_RW)
 	{
 		//printf("Read from LBA: %d\n", lba);
-		ide->null = !FileSeekLBA(ide->drive[ide->regs.drv].f, lba);
+		ide->null = 0;
 	}
 
-	if (!ide->null) ide->null = (FileReadAdv(ide->drive[ide->regs.drv].f, ide_buf, cnt * 512, -1) <= 0);
+	// the rest of the command is prefetched while this block goes to the core
+	uint32_t ahead = (ide->regs.sector_count ? ide->regs.sector_count : 256) - cnt;
+	if (!ide->null) ide->null = (x86_img_read(ide->drive[ide->regs.drv].f, lba, ide_buf, cnt, ahead) <= 0);
 	if (ide->null) memset(ide_buf, 0, cnt * 512);
 
 	ide_send_data(ide_buf, cnt * 128);
@@ -439,6 +441,7 @@ static void prep_write(ide_config *ide)
 		{
 			uint32_t lba = ide->regs.sector | (ide->regs.cylinder << 8) | (ide->regs.head << 24);
 			//printf("Write to LBA: %d\n", lba);
+			x86_img_drop(ide->drive[ide->regs.drv].f);
 			ide->null = !FileSeekLBA(ide->drive[ide->regs.drv].f, lba);
 		}
 	}
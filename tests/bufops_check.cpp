@@ -0,0 +1,278 @@
+// bufops_check.cpp
+// Compares the bufops kernels with plain C loops on random buffers of
+// random size and alignment, then prints the throughput of both.
+// Built by "make check": NEON kernels on ARM, the C fallback with FPGA_SIM.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bufops.h"
+
+#define BUF_SIZE   (1024 * 1024)
+#define RUNS       2000
+#define BENCH_LOOP 64
+
+static uint8_t src_a[BUF_SIZE + 64], src_b[BUF_SIZE + 64];
+static uint8_t out_k[2 * BUF_SIZE + 128], out_r[2 * BUF_SIZE + 128];
+static uint8_t fix_tbl[32];
+
+static int failed = 0;
+
+static uint64_t time_us()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
+static void fill(uint8_t *buf, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++) buf[i] = rand();
+}
+
+// reference loops: the element formulas the kernels replaced
+
+static void ref_bswap16(void *buf, uint32_t size)
+{
+	uint8_t *p = (uint8_t*)buf;
+	for (uint32_t i = 0; i + 1 < size; i += 2)
+	{
+		uint8_t tmp = p[i];
+		p[i] = p[i + 1];
+		p[i + 1] = tmp;
+	}
+}
+
+static void ref_bswap32(uint32_t *buf, uint32_t count)
+{
+	uint8_t *p = (uint8_t*)buf;
+	for (uint32_t i = 0; i < count * 4; i += 4)
+	{
+		uint8_t t0 = p[i], t1 = p[i + 1];
+		p[i] = p[i + 3];
+		p[i + 1] = p[i + 2];
+		p[i + 2] = t1;
+		p[i + 3] = t0;
+	}
+}
+
+static void ref_bswap_mid32(uint32_t *buf, uint32_t count)
+{
+	uint8_t *p = (uint8_t*)buf;
+	for (uint32_t i = 0; i < count * 4; i += 4)
+	{
+		uint8_t tmp = p[i + 1];
+		p[i + 1] = p[i + 2];
+		p[i + 2] = tmp;
+	}
+}
+
+static void ref_interleave8(uint8_t *dst, const uint8_t *a, const uint8_t *b, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		dst[i * 2] = a[i];
+		dst[i * 2 + 1] = b[i];
+	}
+}
+
+static void ref_interleave16(uint16_t *dst, const uint16_t *a, const uint16_t *b, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		dst[i * 2] = a[i];
+		dst[i * 2 + 1] = b[i];
+	}
+}
+
+static void ref_interleave32(uint32_t *dst, const uint32_t *a, const uint32_t *b, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		dst[i * 2] = a[i];
+		dst[i * 2 + 1] = b[i];
+	}
+}
+
+static void ref_wswap32(uint32_t *buf, uint32_t count)
+{
+	uint16_t *p = (uint16_t*)buf;
+	for (uint32_t i = 0; i < count * 2; i += 2)
+	{
+		uint16_t tmp = p[i];
+		p[i] = p[i + 1];
+		p[i + 1] = tmp;
+	}
+}
+
+static void ref_shuffle32(uint8_t *dst, const uint8_t *src, const uint8_t *tbl, uint32_t size)
+{
+	for (uint32_t i = 0; i < (size & ~31); i++) dst[i] = src[(i & ~31) | tbl[i & 31]];
+}
+
+static void ref_scatter8(uint8_t *dst, const uint8_t *src, uint32_t count, uint32_t step)
+{
+	for (uint32_t i = 0; i < count; i++) dst[i * step] = src[i];
+}
+
+// one kernel with its reference on the same input.
+// size: source bytes, off: alignment of all buffers, arg: kernel parameter.
+enum
+{
+	OP_BSWAP16,
+	OP_BSWAP32,
+	OP_BSWAP_MID32,
+	OP_INTERLEAVE8,
+	OP_INTERLEAVE16,
+	OP_INTERLEAVE32,
+	OP_WSWAP32,
+	OP_SHUFFLE32,
+	OP_SCATTER8_2,
+	OP_SCATTER8_4,
+	OP_NUM
+};
+
+static const char *op_name[OP_NUM] =
+{
+	"bswap16_buf", "bswap32_buf", "bswap_mid32_buf", "interleave8_buf", "interleave16_buf",
+	"interleave32_buf", "wswap32_buf", "shuffle32_buf", "scatter8_buf/2", "scatter8_buf/4"
+};
+
+// alignment the kernel's element type needs
+static const uint32_t op_align[OP_NUM] = { 1, 4, 4, 1, 2, 4, 4, 1, 1, 1 };
+
+// bytes of output written for size bytes of input
+static uint32_t op_out(int op, uint32_t size)
+{
+	switch (op)
+	{
+	case OP_INTERLEAVE8:
+	case OP_INTERLEAVE16:
+	case OP_INTERLEAVE32: return size * 2;
+	case OP_SCATTER8_2:   return size * 2;
+	case OP_SCATTER8_4:   return size * 4;
+	default:              return size;
+	}
+}
+
+static void run_op(int op, int ref, uint8_t *out, const uint8_t *a, const uint8_t *b, uint32_t size)
+{
+	switch (op)
+	{
+	case OP_BSWAP16:
+		memcpy(out, a, size);
+		if (ref) ref_bswap16(out, size); else bswap16_buf(out, size);
+		break;
+
+	case OP_BSWAP32:
+		memcpy(out, a, size);
+		if (ref) ref_bswap32((uint32_t*)out, size / 4); else bswap32_buf((uint32_t*)out, size / 4);
+		break;
+
+	case OP_BSWAP_MID32:
+		memcpy(out, a, size);
+		if (ref) ref_bswap_mid32((uint32_t*)out, size / 4); else bswap_mid32_buf((uint32_t*)out, size / 4);
+		break;
+
+	case OP_INTERLEAVE8:
+		if (ref) ref_interleave8(out, a, b, size); else interleave8_buf(out, a, b, size);
+		break;
+
+	case OP_INTERLEAVE16:
+		if (ref) ref_interleave16((uint16_t*)out, (const uint16_t*)a, (const uint16_t*)b, size / 2);
+		else interleave16_buf((uint16_t*)out, (const uint16_t*)a, (const uint16_t*)b, size / 2);
+		break;
+
+	case OP_INTERLEAVE32:
+		if (ref) ref_interleave32((uint32_t*)out, (const uint32_t*)a, (const uint32_t*)b, size / 4);
+		else interleave32_buf((uint32_t*)out, (const uint32_t*)a, (const uint32_t*)b, size / 4);
+		break;
+
+	case OP_WSWAP32:
+		memcpy(out, a, size);
+		if (ref) ref_wswap32((uint32_t*)out, size / 4); else wswap32_buf((uint32_t*)out, size / 4);
+		break;
+
+	case OP_SHUFFLE32:
+		if (ref) ref_shuffle32(out, a, fix_tbl, size); else shuffle32_buf(out, a, fix_tbl, size);
+		break;
+
+	case OP_SCATTER8_2:
+	case OP_SCATTER8_4:
+	{
+		uint32_t step = (op == OP_SCATTER8_2) ? 2 : 4;
+		// the bytes between the targets must be kept
+		memcpy(out, b, size * step);
+		if (ref) ref_scatter8(out, a, size, step); else scatter8_buf(out, a, size, step);
+	}
+	break;
+	}
+}
+
+static void check_op(int op)
+{
+	uint32_t align = op_align[op];
+
+	for (int run = 0; run < RUNS; run++)
+	{
+		// small sizes hit the tails, some runs cover many vector blocks
+		uint32_t size = (run & 7) ? (rand() % 300) : (rand() % 16384);
+		if (op == OP_SHUFFLE32) size &= ~31;
+		size &= ~(align - 1);
+
+		uint32_t off = (rand() % 16) & ~(align - 1);
+		uint32_t in_size = (op == OP_SCATTER8_2 || op == OP_SCATTER8_4) ? op_out(op, size) : size;
+
+		fill(src_a + off, size);
+		fill(src_b + off, in_size);
+
+		// guard bytes behind the output catch writes past the end
+		uint32_t out_size = op_out(op, size);
+		memset(out_k, 0x5A, out_size + off + 64);
+		memset(out_r, 0x5A, out_size + off + 64);
+
+		run_op(op, 0, out_k + off, src_a + off, src_b + off, size);
+		run_op(op, 1, out_r + off, src_a + off, src_b + off, size);
+
+		if (memcmp(out_k, out_r, out_size + off + 64))
+		{
+			printf("%-17s FAILED (size %u, offset %u)\n", op_name[op], size, off);
+			failed = 1;
+			return;
+		}
+	}
+
+	fill(src_a, BUF_SIZE);
+	fill(src_b, BUF_SIZE);
+	uint32_t size = (op == OP_SCATTER8_4) ? BUF_SIZE / 4 : (op == OP_SCATTER8_2) ? BUF_SIZE / 2 : BUF_SIZE;
+
+	double mbs[2];
+	for (int ref = 0; ref < 2; ref++)
+	{
+		uint64_t t = time_us();
+		for (int i = 0; i < BENCH_LOOP; i++) run_op(op, ref, ref ? out_r : out_k, src_a, src_b, size);
+		t = time_us() - t;
+		mbs[ref] = (double)size * BENCH_LOOP / (t ? t : 1);
+	}
+
+	printf("%-17s ok, %8.1f MB/s (plain C %8.1f MB/s)\n", op_name[op], mbs[0], mbs[1]);
+}
+
+int main()
+{
+	srand(time(NULL));
+	for (int i = 0; i < 32; i++) fix_tbl[i] = rand() & 31;
+
+#ifdef __ARM_NEON
+	printf("bufops: NEON kernels\n");
+#else
+	printf("bufops: C fallback\n");
+#endif
+
+	for (int op = 0; op < OP_NUM; op++) check_op(op);
+
+	printf(failed ? "bufops: FAILED\n" : "bufops: all kernels match\n");
+	return failed;
+}
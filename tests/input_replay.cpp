@@ -0,0 +1,80 @@
+// input_replay.cpp
+// Replays an input recording ("input_rec" MiSTer_cmd command) off the board
+// through input_cb() with the recorded device, cfg and UI state, and reports
+// whether the map tables and the linear scan give the same output.
+// -v prints every output (core, OSD, menu) of the replay.
+// Built by "make FPGA_SIM=1 BASE=<host triplet> replay".
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "input.h"
+#include "cfg.h"
+#include "menu.h"
+#include "user_io.h"
+#include "video.h"
+#include "file_io.h"
+#include "fpga_io.h"
+#include "scheduler.h"
+#include "spi.h"
+#include "support/arcade/mra_loader.h"
+
+cfg_t cfg;
+
+// queries input_cb() makes: the state at the start of the recording
+
+char is_menu() { return input_replay_ui.menu; }
+char user_io_osd_is_visible() { return input_replay_ui.osd; }
+int video_fb_state() { return input_replay_ui.fb; }
+int hasAPI1_5() { return input_replay_ui.api1_5; }
+int menu_allow_cfg_switch() { return input_replay_ui.cfg_switch; }
+int user_io_get_kbdemu() { return input_replay_ui.kbdemu; }
+
+char *user_io_get_confstr(int) { return 0; }
+const char *user_io_get_core_name_ex() { return ""; }
+void user_io_read_confstr() {}
+
+// maps come with the recorded device state, nothing else is on disk
+
+int FileLoadConfig(const char *, void *, int) { return 0; }
+int FileSaveConfig(const char *, void *, int) { return 0; }
+int FileDeleteConfig(const char *) { return 0; }
+int FileCreatePath(const char *) { return 0; }
+
+// outputs: the replay sink of input.cpp takes them all, so these are only
+// reached by the device and command code that doesn't run here
+
+void user_io_kbd(uint16_t, int) {}
+int user_io_kbd_core_only(uint16_t, int) { return 0; }
+void user_io_mouse(unsigned char, int16_t, int16_t, int16_t) {}
+void user_io_digital_joystick(unsigned char, uint32_t, int) {}
+void user_io_analog_joystick(unsigned char, char, char) {}
+void user_io_check_reset(unsigned short, char) {}
+void user_io_set_ini(int) {}
+void menu_key_set(unsigned int) {}
+void Info(const char *, int, int, int, int) {}
+void InfoMessage(const char *, int, const char *) {}
+int menu_lightgun_cb(int, uint16_t, uint16_t, int) { return 0; }
+void substrcpy(char *d, char *, char) { *d = 0; }
+void diskled_on() {}
+
+uint8_t spi_uio_cmd(uint8_t) { return 0; }
+void fpga_bus_share(int) {}
+int fpga_load_rbf(const char *, const char *, const char *) { return 0; }
+int arcade_load(const char *) { return 0; }
+void video_cmd(char *) {}
+void scheduler_wake_at(unsigned long) {}
+void scheduler_print_stats() {}
+
+int main(int argc, char *argv[])
+{
+	int verbose = (argc > 1 && !strcmp(argv[1], "-v"));
+	if (argc != 2 + verbose)
+	{
+		printf("usage: %s [-v] <recording>\n", argv[0]);
+		return 2;
+	}
+
+	return input_replay(argv[1 + verbose], verbose);
+}
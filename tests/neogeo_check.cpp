@@ -0,0 +1,122 @@
+// neogeo_check.cpp
+// Compares the NeoGeo C ROM/S ROM conversions of neogeo_convert.h with the
+// per-element loops the loader used before, on random ROM data of full and
+// partial block sizes. Built by "make check".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "support/neogeo/neogeo_convert.h"
+
+#define BUF_WORDS  (64 * 1024)
+#define RUNS       2000
+
+static uint16_t src[BUF_WORDS + 64], tmp[BUF_WORDS + 64];
+static uint16_t out_k[2 * BUF_WORDS + 128], out_r[2 * BUF_WORDS + 128];
+
+static int failed = 0;
+
+static void fill(void *buf, uint32_t size)
+{
+	uint8_t *p = (uint8_t*)buf;
+	for (uint32_t i = 0; i < size; i++) p[i] = rand();
+}
+
+// the loops of the loader before the bufops kernels
+
+static void ref_spr(uint16_t *buf_in, uint16_t *buf_out, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++) buf_out[i] = buf_in[(i & ~0x1F) | ((i >> 1) & 0xF) | (((i & 1) ^ 1) << 4)];
+}
+
+static void ref_spr_skp(uint16_t *buf_in, uint16_t *buf_out, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++) buf_out[i << 1] = buf_in[(i & ~0x1F) | ((i >> 1) & 0xF) | (((i & 1) ^ 1) << 4)];
+}
+
+static void ref_spr_dbl(uint16_t *buf_in, uint16_t *buf_out, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++) buf_out[i] = buf_in[(i & ~0x3F) | ((i ^ 1) & 1) | ((i >> 1) & 0x1E) | (((i & 2) ^ 2) << 4)];
+}
+
+static void ref_fix(uint8_t *buf_in, uint8_t *buf_out, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++) buf_out[i] = buf_in[(i & ~0x1F) | ((i >> 2) & 7) | ((i & 1) << 3) | (((i & 2) << 3) ^ 0x10)];
+}
+
+enum
+{
+	OP_SPR,
+	OP_SPR_SKP,
+	OP_SPR_DBL,
+	OP_FIX,
+	OP_NUM
+};
+
+static const char *op_name[OP_NUM] = { "spr_convert", "spr_convert_skp", "spr_convert_dbl", "fix_convert" };
+
+// size is in words for the C ROM conversions and in bytes for fix_convert
+static void run_op(int op, int ref, uint16_t *out, uint32_t size)
+{
+	switch (op)
+	{
+	case OP_SPR:
+		if (ref) ref_spr(src, out, size); else spr_convert(src, out, size);
+		break;
+
+	case OP_SPR_SKP:
+		if (ref) ref_spr_skp(src, out, size); else spr_convert_skp(src, out, size);
+		break;
+
+	case OP_SPR_DBL:
+		// the kernel version modifies its input
+		memcpy(tmp, src, size * 2);
+		if (ref) ref_spr_dbl(tmp, out, size); else spr_convert_dbl(tmp, out, size);
+		break;
+
+	case OP_FIX:
+		if (ref) ref_fix((uint8_t*)src, (uint8_t*)out, size); else fix_convert((uint8_t*)src, (uint8_t*)out, size);
+		break;
+	}
+}
+
+static void check_op(int op)
+{
+	for (int run = 0; run < RUNS; run++)
+	{
+		// whole blocks most of the time, a partial block at the end otherwise
+		uint32_t size = (run & 7) ? (rand() % 64) * 64 : (rand() % (BUF_WORDS / 2));
+		uint32_t bytes = (op == OP_FIX) ? size : size * 2;
+		uint32_t out_bytes = (op == OP_SPR_SKP) ? bytes * 2 : bytes;
+
+		fill(src, sizeof(src));
+
+		// the words between the skp outputs belong to the other C ROM and
+		// must be kept; guard bytes behind the output catch writes past the end
+		fill(out_k, out_bytes + 64);
+		memcpy(out_r, out_k, out_bytes + 64);
+
+		run_op(op, 0, out_k, size);
+		run_op(op, 1, out_r, size);
+
+		if (memcmp(out_k, out_r, out_bytes + 64))
+		{
+			printf("%-16s FAILED (size %u)\n", op_name[op], size);
+			failed = 1;
+			return;
+		}
+	}
+
+	printf("%-16s ok\n", op_name[op]);
+}
+
+int main()
+{
+	srand(time(NULL));
+	for (int op = 0; op < OP_NUM; op++) check_op(op);
+
+	printf(failed ? "neogeo: FAILED\n" : "neogeo: all conversions match\n");
+	return failed;
+}
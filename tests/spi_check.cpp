@@ -0,0 +1,284 @@
+// spi_check.cpp
+// Drives the SSPI transfers of the file download, SD sector and OSD paths
+// through fpga_io.cpp/spi.cpp into the software bridge model (fpga_sim.cpp),
+// checks the words and chip selects the core side sees and prints the bus
+// cost per word of each path.
+// Built by "make FPGA_SIM=1 BASE=<host triplet> check".
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fpga_io.h"
+#include "fpga_sim.h"
+#include "spi.h"
+#include "user_io.h"
+#include "cfg.h"
+#include "menu.h"
+#include "osd.h"
+#include "input.h"
+#include "video.h"
+#include "sdcache.h"
+#include "rbf_cache.h"
+#include "trace.h"
+
+#define SSPI_FPGA_EN (1<<18)
+#define SSPI_OSD_EN  (1<<19)
+#define SSPI_IO_EN   (1<<20)
+
+#define OSD_CMD_WRITE 0x20
+#define CORE_8BIT     0xA4
+
+#define LOG_MAX 8192
+#define RUNS    500
+
+// fpga_io.cpp is linked for the bridge code only, nothing of this is used
+
+cfg_t cfg;
+void cfg_parse() {}
+fileTYPE::fileTYPE() {}
+fileTYPE::~fileTYPE() {}
+int FileOpenEx(fileTYPE *, const char *, int, char, int) { return 0; }
+void FileClose(fileTYPE *) {}
+fileReadAhead *FileReadAheadStart(fileTYPE *, __off64_t, int) { return 0; }
+int FileReadAheadGet(fileReadAhead *, uint8_t **) { return 0; }
+void FileReadAheadStop(fileReadAhead *) {}
+const char *getRootDir() { return "."; }
+const char *getStorageDir(int) { return "."; }
+void Info(const char *, int, int, int, int) {}
+void OsdDisable() {}
+void input_init() {}
+void input_switch(int) {}
+void input_uinp_destroy() {}
+uint8_t *rbf_cache_load(const char *, int *) { return 0; }
+void rbf_cache_stop() {}
+void rbf_cache_used(const char *) {}
+int sdcache_flush_all() { return 1; }
+void video_logo_preload() {}
+uint64_t trace_time() { return 0; }
+
+// core side: every strobed word with its chip selects, reads get core_data
+
+static uint32_t log_en[LOG_MAX];
+static uint16_t log_word[LOG_MAX];
+static uint32_t log_num = 0;
+
+static uint16_t core_data[LOG_MAX];
+static uint32_t core_pos = 0;
+
+static uint16_t responder(uint32_t en, uint16_t word)
+{
+	if (log_num < LOG_MAX)
+	{
+		log_en[log_num] = en;
+		log_word[log_num] = word;
+		log_num++;
+	}
+	return core_data[core_pos++ % LOG_MAX];
+}
+
+static int failed = 0;
+
+static void fill(void *buf, uint32_t size)
+{
+	uint8_t *p = (uint8_t*)buf;
+	for (uint32_t i = 0; i < size; i++) p[i] = rand();
+}
+
+static int fail(const char *name, const char *what, uint32_t arg)
+{
+	printf("%-14s FAILED (%s %u)\n", name, what, arg);
+	failed = 1;
+	return 0;
+}
+
+// the words a spi_write() of len bytes puts on the bus
+static uint32_t expect_write(uint16_t *exp, const uint8_t *buf, uint32_t len, int wide)
+{
+	uint32_t n = 0;
+	if (wide)
+	{
+		for (uint32_t i = 0; i + 1 < len; i += 2) exp[n++] = buf[i] | (buf[i + 1] << 8);
+		if (len & 1) exp[n++] = buf[len - 1];
+	}
+	else
+	{
+		for (uint32_t i = 0; i < len; i++) exp[n++] = buf[i];
+	}
+	return n;
+}
+
+// command byte with en, then the data words
+static int check_log(const char *name, uint32_t en, uint8_t cmd, const uint16_t *exp, uint32_t num)
+{
+	if (log_num != num + 1) return fail(name, "words", log_num);
+	if ((log_word[0] & 0xFF) != cmd) return fail(name, "command", log_word[0]);
+
+	for (uint32_t i = 0; i <= num; i++)
+	{
+		if (log_en[i] != en) return fail(name, "chip select at word", i);
+		if (i && log_word[i] != exp[i - 1]) return fail(name, "data at word", i);
+	}
+	return 1;
+}
+
+static int check_stats(const char *name, uint32_t words, uint32_t selects, uint32_t spi_words)
+{
+	fpga_sim_stats_t st;
+	fpga_sim_get_stats(&st);
+
+	if (st.strobes != words) return fail(name, "strobes", (uint32_t)st.strobes);
+	if (st.selects != selects) return fail(name, "selects", (uint32_t)st.selects);
+	if (fpga_spi_words - spi_words != words) return fail(name, "fpga_spi_words", fpga_spi_words - spi_words);
+	return 1;
+}
+
+static void check_id()
+{
+	for (int i = 0; i < 16; i++)
+	{
+		int fio = i & 1, io_ver = (i >> 1) & 3, buttons = (i >> 2) & 3;
+		fpga_sim_set_core(CORE_8BIT, io_ver, fio, fio);
+		fpga_sim_set_buttons(buttons);
+
+		if (fpga_core_id() != CORE_8BIT) { fail("core_id", "id", fpga_core_id()); return; }
+		if (fpga_get_fio_size() != fio) { fail("core_id", "fio_size", i); return; }
+		if (fpga_get_io_version() != io_ver) { fail("core_id", "io_version", i); return; }
+		if (fpga_get_io_type() != fio) { fail("core_id", "io_type", i); return; }
+		if (fpga_get_buttons() != buttons) { fail("core_id", "buttons", i); return; }
+	}
+
+	fpga_sim_set_buttons(0);
+	printf("%-14s ok\n", "core_id");
+}
+
+// user_io_file_tx_data(): one chunk of a file download
+static void check_file_tx(int wide)
+{
+	const char *name = wide ? "file_tx/16" : "file_tx/8";
+	static uint8_t buf[4096];
+	static uint16_t exp[4096];
+	uint32_t words = 0, spi_words = fpga_spi_words;
+
+	fpga_sim_set_core(CORE_8BIT, 1, wide, 0);
+	fpga_sim_reset_stats();
+
+	for (int run = 0; run < RUNS; run++)
+	{
+		uint16_t len = (run & 7) ? (rand() % 64) + 1 : sizeof(buf);
+		fill(buf, len);
+		log_num = 0;
+
+		EnableFpga();
+		spi8(FIO_FILE_TX_DAT);
+		spi_write(buf, len, fpga_get_fio_size());
+		DisableFpga();
+
+		uint32_t num = expect_write(exp, buf, len, wide);
+		if (!check_log(name, SSPI_FPGA_EN, FIO_FILE_TX_DAT, exp, num)) return;
+		words += num + 1;
+	}
+
+	if (!check_stats(name, words, RUNS, spi_words)) return;
+	fpga_sim_print_stats(name);
+}
+
+// user_io_poll(): sector to the core (read request) and from it (write request)
+static void check_sd(int wide)
+{
+	const char *name = wide ? "sd_sector/16" : "sd_sector/8";
+	static uint8_t buf[512];
+	static uint16_t exp[512];
+	uint32_t words = 0, spi_words = fpga_spi_words;
+	uint32_t num = wide ? 256 : 512;
+
+	fpga_sim_reset_stats();
+
+	for (int run = 0; run < RUNS; run++)
+	{
+		fill(buf, sizeof(buf));
+		log_num = 0;
+
+		spi_uio_cmd_cont(UIO_SECTOR_RD);
+		spi_block_write(buf, wide);
+		DisableIO();
+
+		expect_write(exp, buf, sizeof(buf), wide);
+		if (!check_log(name, SSPI_IO_EN, UIO_SECTOR_RD, exp, num)) return;
+
+		fill(core_data, num * 2);
+		log_num = 0;
+
+		spi_uio_cmd_cont(UIO_SECTOR_WR);
+		core_pos = 0;
+		spi_block_read(buf, wide);
+		DisableIO();
+
+		if (log_num != num + 1) { fail(name, "words read", log_num); return; }
+		for (uint32_t i = 0; i < num; i++)
+		{
+			uint16_t got = wide ? ((uint16_t*)buf)[i] : buf[i];
+			uint16_t want = wide ? core_data[i] : (uint8_t)core_data[i];
+			if (got != want) { fail(name, "read data at word", i); return; }
+		}
+
+		words += 2 * (num + 1);
+	}
+
+	if (!check_stats(name, words, 2 * RUNS, spi_words)) return;
+	fpga_sim_print_stats(name);
+}
+
+// OsdUpdate(): one 256 byte line per OSD_CMD_WRITE, on each OSD target
+static void check_osd()
+{
+	const char *name = "osd_line";
+	static const int target[3] = { OSD_ALL, OSD_HDMI, OSD_VGA };
+	static const uint32_t en[3] = { SSPI_OSD_EN, SSPI_OSD_EN | SSPI_IO_EN, SSPI_OSD_EN | SSPI_FPGA_EN };
+	static uint8_t buf[256];
+	static uint16_t exp[256];
+	uint32_t words = 0, spi_words = fpga_spi_words;
+
+	fpga_sim_reset_stats();
+
+	for (int run = 0; run < RUNS; run++)
+	{
+		int t = run % 3;
+		uint8_t line = run & 15;
+		fill(buf, sizeof(buf));
+		log_num = 0;
+
+		EnableOsd_on(target[t]);
+		spi_osd_cmd_cont(OSD_CMD_WRITE | line);
+		spi_write(buf, sizeof(buf), 0);
+		DisableOsd();
+
+		expect_write(exp, buf, sizeof(buf), 0);
+		if (!check_log(name, en[t], OSD_CMD_WRITE | line, exp, sizeof(buf))) return;
+		words += sizeof(buf) + 1;
+	}
+
+	EnableOsd_on(OSD_ALL);
+	if (!check_stats(name, words, RUNS, spi_words)) return;
+	fpga_sim_print_stats(name);
+}
+
+int main()
+{
+	srand(time(NULL));
+
+	fpga_io_init();
+	fpga_sim_set_responder(responder);
+
+	check_id();
+	check_file_tx(0);
+	check_file_tx(1);
+	check_sd(0);
+	check_sd(1);
+	check_osd();
+
+	printf(failed ? "spi: FAILED\n" : "spi: all transfers match\n");
+	return failed;
+}
@@ -0,0 +1,197 @@
+// trace.cpp
+// Hot path tracing of the main loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "trace.h"
+
+#define TRACE_EVENTS  65536                  // ring size, power of 2
+#define TRACE_BUCKETS 32                     // log2 buckets
+#define TRACE_FILE    "/tmp/MiSTer_trace.json"
+
+struct trace_event
+{
+	uint64_t ts;
+	uint32_t dur;     // us, or the value for counters
+	uint32_t arg;
+	uint32_t id;
+};
+
+static const char *trace_names[TRACE_NUM] =
+{
+	"user_io_poll",
+	"input_poll",
+	"HandleUI",
+	"OsdUpdate",
+	"sd_sector",
+	"input_latency",
+	"spi_words",
+};
+
+int trace_on = 0;
+
+static trace_event *ring = 0;
+static uint32_t ring_head = 0;
+static uint32_t hist[TRACE_NUM][TRACE_BUCKETS];
+
+uint64_t trace_time()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
+static void trace_put(int id, uint64_t ts, uint32_t dur, uint32_t arg)
+{
+	uint32_t n = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+	trace_event *ev = &ring[n & (TRACE_EVENTS - 1)];
+	ev->ts = ts;
+	ev->dur = dur;
+	ev->arg = arg;
+	ev->id = id;
+
+	int b = dur ? 32 - __builtin_clz(dur) : 0;
+	if (b >= TRACE_BUCKETS) b = TRACE_BUCKETS - 1;
+	__atomic_fetch_add(&hist[id][b], 1, __ATOMIC_RELAXED);
+}
+
+void trace_end(int id, uint64_t start, uint32_t arg)
+{
+	if (!start || !trace_on) return;
+	trace_put(id, start, (uint32_t)(trace_time() - start), arg);
+}
+
+void trace_value(int id, uint32_t value)
+{
+	if (!trace_on) return;
+	trace_put(id, trace_time(), value, 0);
+}
+
+void trace_input(int id, const struct timeval *tv)
+{
+	if (!trace_on || !tv->tv_sec) return;
+
+	// evdev stamps events with CLOCK_REALTIME
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	int64_t lat = (int64_t)(now.tv_sec - tv->tv_sec) * 1000000 + (now.tv_usec - tv->tv_usec);
+	if (lat < 0 || lat > 1000000) return;
+
+	uint64_t ts = trace_time();
+	trace_put(id, ts - lat, (uint32_t)lat, 0);
+}
+
+static void trace_reset()
+{
+	ring_head = 0;
+	memset(hist, 0, sizeof(hist));
+}
+
+static void trace_print_hist(FILE *f, int json)
+{
+	int first = 1;
+	for (int id = 0; id < TRACE_NUM; id++)
+	{
+		int last = -1;
+		for (int b = 0; b < TRACE_BUCKETS; b++) if (hist[id][b]) last = b;
+		if (last < 0) continue;
+
+		const char *unit = (id == TRACE_SPI_WORDS) ? "" : "us";
+		if (json) fprintf(f, "%s\"%s\":{", first ? "" : ",", trace_names[id]);
+		else fprintf(f, "%s:", trace_names[id]);
+		first = 0;
+
+		for (int b = 0; b <= last; b++)
+		{
+			if (json) fprintf(f, "%s\"<%u%s\":%u", b ? "," : "", 1u << b, unit, hist[id][b]);
+			else fprintf(f, " <%u%s:%u", 1u << b, unit, hist[id][b]);
+		}
+
+		fprintf(f, json ? "}" : "\n");
+	}
+}
+
+static void trace_dump(const char *name)
+{
+	FILE *f = fopen(name, "w");
+	if (!f)
+	{
+		printf("trace: cannot create %s\n", name);
+		return;
+	}
+
+	uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+	uint32_t start = (head > TRACE_EVENTS) ? head - TRACE_EVENTS : 0;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (uint32_t i = start; i < head; i++)
+	{
+		trace_event *ev = &ring[i & (TRACE_EVENTS - 1)];
+		const char *sep = (i + 1 < head) ? ",\n" : "\n";
+
+		if (ev->id == TRACE_SPI_WORDS)
+		{
+			fprintf(f, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu,\"pid\":1,\"args\":{\"words\":%u}}%s",
+				trace_names[ev->id], (unsigned long long)ev->ts, ev->dur, sep);
+		}
+		else
+		{
+			// main loop, SD and input each get their own track
+			int tid = (ev->id == TRACE_SD_SECTOR) ? 2 : (ev->id == TRACE_INPUT_LAT) ? 3 : 1;
+			fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":1,\"tid\":%d,\"args\":{\"arg\":%u}}%s",
+				trace_names[ev->id], (unsigned long long)ev->ts, ev->dur, tid, ev->arg, sep);
+		}
+	}
+
+	fprintf(f, "],\n\"otherData\":{\"recorded\":%u,\"kept\":%u},\n\"histograms\":{", head, head - start);
+	trace_print_hist(f, 1);
+	fprintf(f, "}}\n");
+	fclose(f);
+
+	printf("trace: %u events written to %s\n", head - start, name);
+	trace_print_hist(stdout, 0);
+}
+
+void trace_cmd(const char *cmd)
+{
+	while (*cmd == ' ') cmd++;
+
+	if (!strncmp(cmd, "on", 2))
+	{
+		if (!ring) ring = (trace_event*)calloc(TRACE_EVENTS, sizeof(trace_event));
+		if (!ring)
+		{
+			printf("trace: no memory\n");
+			return;
+		}
+
+		trace_reset();
+		trace_on = 1;
+		printf("trace: on\n");
+	}
+	else if (!strncmp(cmd, "off", 3))
+	{
+		trace_on = 0;
+		printf("trace: off\n");
+	}
+	else if (!strncmp(cmd, "reset", 5))
+	{
+		trace_reset();
+	}
+	else if (!strncmp(cmd, "dump", 4))
+	{
+		if (!ring) return;
+
+		cmd += 4;
+		while (*cmd == ' ') cmd++;
+		trace_dump(*cmd ? cmd : TRACE_FILE);
+	}
+	else
+	{
+		printf("trace: use on, off, reset or dump [file]\n");
+	}
+}
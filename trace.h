@@ -0,0 +1,42 @@
+// trace.h
+// Hot path tracing of the main loop: timed events in a lock-free ring
+// buffer plus a log2 histogram per event. Controlled through CMD_FIFO:
+//   trace on | trace off | trace reset | trace dump [file]
+// The dump is Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+struct timeval;
+
+enum
+{
+	TRACE_USER_IO_POLL,
+	TRACE_INPUT_POLL,
+	TRACE_HANDLE_UI,
+	TRACE_OSD_UPDATE,
+	TRACE_SD_SECTOR,     // SD request seen -> sector transferred, arg = lba
+	TRACE_INPUT_LAT,     // evdev timestamp -> joystick sent to the core
+	TRACE_SPI_WORDS,     // SSPI words per main loop pass (value)
+	TRACE_NUM
+};
+
+extern int trace_on;
+
+uint64_t trace_time(); // us, CLOCK_MONOTONIC
+
+// 0 while tracing is off, so trace_end() is a no-op then
+static inline uint64_t trace_start()
+{
+	return trace_on ? trace_time() : 0;
+}
+
+void trace_end(int id, uint64_t start, uint32_t arg = 0);
+void trace_value(int id, uint32_t value);
+void trace_input(int id, const struct timeval *tv);
+
+void trace_cmd(const char *cmd);
+
+#endif
@@ -33,6 +33,11 @@
 #include "cheats.h"
 #include "video.h"
 #include "audio.h"
+#include "shmem.h"
+#include "sdcache.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "startup.h"
 
 #include "support.h"
 
@@ -49,7 +54,6 @@ uint8_t joy_left = 0;
 uint8_t joy_right = 0; 
 
 static fileTYPE sd_image[4] = {};
-static uint64_t buffer_lba[4] = { ULLONG_MAX,ULLONG_MAX,ULLONG_MAX,ULLONG_MAX };
 
 static int use_save = 0;
 
@@ -973,6 +977,7 @@ void user_io_init(const char *path, const char *xml)
 
 	OsdSetSize(8);
 
+	uint64_t t = startup_start();
 	user_io_read_confstr();
 	if (core_type == CORE_TYPE_8BIT)
 	{
@@ -985,18 +990,31 @@ void user_io_init(const char *path, const char *xml)
 		// send a reset
 		user_io_8bit_set_status(UIO_STATUS_RESET, UIO_STATUS_RESET);
 	}
+	startup_end("core_id", t);
 
+	t = startup_start();
 	cfg_parse();
+	startup_end("cfg_parse", t);
+
 	if (cfg.bootcore[0] != '\0')
 	{
+		t = startup_start();
 		bootcore_init(xml ? xml : path);
+		startup_end("bootcore_init", t);
 	}
 
+	t = startup_start();
 	video_mode_load();
+	startup_end("video_mode_load", t);
+
+	t = startup_start();
 	if(strlen(cfg.font)) LoadFont(cfg.font);
 	load_volume();
 
 	user_io_send_buttons(1);
+	startup_end("font_volume", t);
+
+	t = startup_start();
 
 	switch (core_type)
 	{
@@ -1181,6 +1199,7 @@ void user_io_init(const char *path, const char *xml)
 		if(xml) arcade_check_error();
 		break;
 	}
+	startup_end("core_init", t);
 
 	OsdRotation((cfg.osd_rotate == 1) ? 3 : (cfg.osd_rotate == 2) ? 1 : 0);
 
@@ -1417,15 +1436,16 @@ void user_io_set_aindex(uint16_t index)
 	DisableFpga();
 }
 
-void user_io_set_download(unsigned char enable, int addr)
+// size is given for bulk transfers only, where data is already in DDR3
+void user_io_set_download(unsigned char enable, int size)
 {
 	EnableFpga();
 	spi8(FIO_FILE_TX);
 	spi8(enable ? 0xff : 0);
-	if (enable && addr)
+	if (enable && size)
 	{
-		spi_w(addr);
-		spi_w(addr >> 16);
+		spi_w(size);
+		spi_w(size >> 16);
 	}
 	DisableFpga();
 }
@@ -1474,6 +1494,8 @@ int user_io_file_mount(const char *name, unsigned char index, char pre)
 	int ret = 0;
 	int len = strlen(name);
 
+	sdcache_flush(index);
+
 	if (len)
 	{
 		if (!strcasecmp(user_io_get_core_name_ex(), "apple-ii"))
@@ -1509,7 +1531,7 @@ int user_io_file_mount(const char *name, unsigned char index, char pre)
 		FileClose(&sd_image[index]);
 	}
 
-	buffer_lba[index] = -1;
+	sdcache_attach(index, &sd_image[index]);
 	if (!index) use_save = pre;
 
 	if (!ret)
@@ -2126,12 +2148,36 @@ int user_io_file_tx_a(const char* name, uint16_t index)
 	int progress = -1;
 	if (use_progress) MenuHide();
 
+	fileReadAhead *ra = FileReadAheadStart(&f, bytes2send);
+	uint8_t *ra_buf = buf;
+	int ra_len = 0;
+	int res = 1;
+
 	while (bytes2send)
 	{
 		uint16_t chunk = (bytes2send > sizeof(buf)) ? sizeof(buf) : bytes2send;
 
-		FileReadAdv(&f, buf, chunk);
-		user_io_file_tx_data(buf, chunk);
+		if (ra)
+		{
+			if (!ra_len && (ra_len = FileReadAheadGet(ra, &ra_buf)) <= 0)
+			{
+				if (ra_len < 0)
+				{
+					printf("Read error in %s\n", f.name);
+					res = 0;
+				}
+				break;
+			}
+			if (chunk > ra_len) chunk = ra_len;
+			user_io_file_tx_data(ra_buf, chunk);
+			ra_buf += chunk;
+			ra_len -= chunk;
+		}
+		else
+		{
+			FileReadAdv(&f, buf, chunk);
+			user_io_file_tx_data(buf, chunk);
+		}
 
 		if (use_progress)
 		{
@@ -2144,6 +2190,7 @@ int user_io_file_tx_a(const char* name, uint16_t index)
 		}
 		bytes2send -= chunk;
 	}
+	FileReadAheadStop(ra);
 
 	// check if core requests some change while downloading
 	check_status_change();
@@ -2154,10 +2201,108 @@ int user_io_file_tx_a(const char* name, uint16_t index)
 	// signal end of transmission
 	user_io_set_download(0);
 	MenuHide();
-	return 1;
+	return res;
+}
+
+// Bulk transfer: stage the file in FPGA DDR3 and only signal the core.
+// Used for cores which give a load address in the F option of CONF_STR.
+// Data the SPI path sends ahead of the file (SNES header, goomba.rom, ...)
+// is collected in tx_pre and staged in front of it.
+static uint8_t *tx_pre = 0;
+static uint32_t tx_pre_len = 0;
+static uint32_t tx_pre_max = 0;
+static int tx_pre_ddr = 0;
+
+static void file_tx_pre_free()
+{
+	free(tx_pre);
+	tx_pre = 0;
+	tx_pre_len = 0;
+	tx_pre_max = 0;
+	tx_pre_ddr = 0;
+}
+
+// give up on DDR: signal an SPI download and send what was collected
+static void file_tx_pre_spi()
+{
+	user_io_set_download(1);
+	for (uint32_t off = 0; off < tx_pre_len; off += 4096)
+	{
+		user_io_file_tx_data(tx_pre + off, (tx_pre_len - off > 4096) ? 4096 : tx_pre_len - off);
+	}
+	file_tx_pre_free();
+}
+
+static void file_tx_pre(const uint8_t *buf, uint16_t len)
+{
+	if (tx_pre_ddr && tx_pre_len + len > tx_pre_max)
+	{
+		uint32_t max = (tx_pre_len + len + 0xFFFF) & ~0xFFFF;
+		uint8_t *p = (uint8_t*)realloc(tx_pre, max);
+		if (p)
+		{
+			tx_pre = p;
+			tx_pre_max = max;
+		}
+		else file_tx_pre_spi();
+	}
+
+	if (!tx_pre_ddr)
+	{
+		user_io_file_tx_data(buf, len);
+		return;
+	}
+
+	memcpy(tx_pre + tx_pre_len, buf, len);
+	tx_pre_len += len;
+}
+
+// copies tx_pre and then the file into mem, fails on a short or failed read.
+static int file_tx_ddr(fileTYPE *f, uint8_t *mem, uint32_t bytes2send, uint32_t *skip)
+{
+	memcpy(mem, tx_pre, tx_pre_len);
+	mem += tx_pre_len;
+	if (!bytes2send) return 1;
+
+	fileReadAhead *ra = FileReadAheadStart(f, bytes2send);
+	if (!ra) return 0;
+
+	int size = bytes2send;
+	int progress = -1;
+
+	while (bytes2send)
+	{
+		uint8_t *buf;
+		int len = FileReadAheadGet(ra, &buf);
+		if (len <= 0) break;
+
+		uint32_t chunk = len;
+		if (chunk > bytes2send) chunk = bytes2send;
+		memcpy(mem, buf, chunk);
+
+		int new_progress = PROGRESS_MAX - ((((uint64_t)bytes2send)*PROGRESS_MAX) / size);
+		if (progress != new_progress)
+		{
+			progress = new_progress;
+			tx_progress(f->name, progress);
+		}
+
+		if (*skip >= chunk) *skip -= chunk;
+		else
+		{
+			file_crc = crc32(file_crc, buf + *skip, chunk - *skip);
+			*skip = 0;
+		}
+
+		bytes2send -= chunk;
+		mem += chunk;
+	}
+
+	FileReadAheadStop(ra);
+	return !bytes2send;
 }
 
-int user_io_file_tx(const char* name, unsigned char index, char opensave, char mute, char composite)
+int user_io_file_tx(const char* name, unsigned char index, char opensave, char mute, char composite, uint32_t load_addr)
 {
 	fileTYPE f = {};
 	static uint8_t buf[4096];
@@ -2187,19 +2332,25 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 	char *p = f.name + len - 4;
 	user_io_file_info(p);
 
+	int is_snes_bs = 0;
+	if (is_snes() && bytes2send)
+	{
+		const char *ext = strrchr(f.name, '.');
+		if (ext && !strcasecmp(ext, ".BS")) is_snes_bs = 1;
+	}
+
+	// BS header patching works on SPI sized chunks
+	if (is_snes_bs) load_addr = 0;
+
 	// prepare transmission of new file
-	user_io_set_download(1);
+	// with a load address the core is only signalled once all data is staged
+	tx_pre_ddr = load_addr ? 1 : 0;
+	if (!load_addr) user_io_set_download(1);
 
 	int dosend = 1;
 
-	int is_snes_bs = 0;
 	if (is_snes() && bytes2send)
 	{
-		const char *ext = strrchr(f.name, '.');
-		if (ext && !strcasecmp(ext, ".BS")) {
-			is_snes_bs = 1;
-		}
-
 		if (is_snes_bs) {
 			char *rom_path = (char*)buf;
 			strcpy(rom_path, name);
@@ -2214,7 +2365,7 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 				printf("Load BSX bios ROM.\n");
 				uint8_t* buf = snes_get_header(&fb);
 				hexdump(buf, 16, 0);
-				user_io_file_tx_data(buf, 512);
+				file_tx_pre(buf, 512);
 
 				//strip original SNES ROM header if present (not used)
 				if (bytes2send & 512)
@@ -2228,7 +2379,7 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 				{
 					uint16_t chunk = (sz > sizeof(buf)) ? sizeof(buf) : sz;
 					FileReadAdv(&fb, buf, chunk);
-					user_io_file_tx_data(buf, chunk);
+					file_tx_pre(buf, chunk);
 					sz -= chunk;
 				}
 				FileClose(&fb);
@@ -2243,11 +2394,11 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 		else if ((index & 0x3F) == 1) {
 			printf("Load SPC ROM.\n");
 			FileReadSec(&f, buf);
-			user_io_file_tx_data(buf, 256);
+			file_tx_pre(buf, 256);
 
 			FileSeek(&f, (64*1024)+256, SEEK_SET);
 			FileReadSec(&f, buf);
-			user_io_file_tx_data(buf, 256);
+			file_tx_pre(buf, 256);
 
 			FileSeek(&f, 256, SEEK_SET);
 			bytes2send = 64 * 1024;
@@ -2256,7 +2407,7 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 		printf("Load SNES ROM.\n");
 		uint8_t* buf = snes_get_header(&f);
 		hexdump(buf, 16, 0);
-		user_io_file_tx_data(buf, 512);
+		file_tx_pre(buf, 512);
 
 		//strip original SNES ROM header if present (not used)
 		if (bytes2send & 512)
@@ -2295,7 +2446,7 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 				{
 					uint16_t chunk = (sz > sizeof(buf)) ? sizeof(buf) : sz;
 					FileReadAdv(&fg, buf, chunk);
-					user_io_file_tx_data(buf, chunk);
+					file_tx_pre(buf, chunk);
 					sz -= chunk;
 				}
 				FileClose(&fg);
@@ -2303,13 +2454,84 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 		}
 	}
 
+	unsigned long tx_time = GetTimer(0);
+	uint32_t tx_size = dosend ? bytes2send : 0;
+
+	if (tx_pre_ddr)
+	{
+		int ddr_ok = 0;
+		uint32_t total = tx_pre_len + bytes2send;
+		uint32_t addr = fpga_mem(load_addr);
+		uint32_t adj = addr & 0xFFF;
+
+		// map the whole target range first, it must not wrap out of the DDR window
+		if (dosend && total && (load_addr & (FPGA_MEM_SIZE - 1)) + total <= FPGA_MEM_SIZE)
+		{
+			printf("Load to DDR address 0x%08X\n", load_addr);
+			uint8_t *mem = (uint8_t*)shmem_map(addr - adj, total + adj);
+			if (mem)
+			{
+				__off64_t pos = f.offset;
+				ddr_ok = file_tx_ddr(&f, mem + adj, bytes2send, &skip);
+				shmem_unmap(mem, total + adj);
+
+				if (!ddr_ok)
+				{
+					FileSeek(&f, pos, SEEK_SET);
+					file_crc = 0;
+					skip = bytes2send & 0x3FF;
+				}
+			}
+		}
+
+		if (ddr_ok)
+		{
+			user_io_set_download(1, total);
+			file_tx_pre_free();
+			bytes2send = 0;
+		}
+		else
+		{
+			// SPI for the whole file, with the collected header in front
+			if (dosend) printf("DDR transfer failed, using SPI.\n");
+			file_tx_pre_spi();
+		}
+	}
+
+	// BS header patching needs the file offset of every chunk, so read it directly
+	fileReadAhead *ra = (dosend && !is_snes_bs) ? FileReadAheadStart(&f, bytes2send) : 0;
+	uint8_t *ra_buf = 0;
+	int ra_len = 0;
+	int res = 1;
+
 	while (dosend && bytes2send)
 	{
 		uint16_t chunk = (bytes2send > sizeof(buf)) ? sizeof(buf) : bytes2send;
+		uint8_t *data = buf;
+
+		if (ra)
+		{
+			if (!ra_len && (ra_len = FileReadAheadGet(ra, &ra_buf)) <= 0)
+			{
+				if (ra_len < 0)
+				{
+					printf("Read error in %s\n", f.name);
+					res = 0;
+				}
+				break;
+			}
+			if (chunk > ra_len) chunk = ra_len;
+			data = ra_buf;
+			ra_buf += chunk;
+			ra_len -= chunk;
+		}
+		else
+		{
+			FileReadAdv(&f, buf, chunk);
+			if (is_snes() && is_snes_bs) snes_patch_bs_header(&f, buf);
+		}
 
-		FileReadAdv(&f, buf, chunk);
-		if (is_snes() && is_snes_bs) snes_patch_bs_header(&f, buf);
-		user_io_file_tx_data(buf, chunk);
+		user_io_file_tx_data(data, chunk);
 
 		if (use_progress)
 		{
@@ -2325,10 +2547,18 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 		if (skip >= chunk) skip -= chunk;
 		else
 		{
-			file_crc = crc32(file_crc, buf + skip, chunk - skip);
+			file_crc = crc32(file_crc, data + skip, chunk - skip);
 			skip = 0;
 		}
 	}
+	FileReadAheadStop(ra);
+
+	tx_time = GetTimer(0) - tx_time;
+	if (tx_size)
+	{
+		printf("Sent %u bytes in %lums (%.2f MB/s)\n", tx_size, tx_time,
+			tx_time ? (tx_size / 1048576.0) / (tx_time / 1000.0) : 0.0);
+	}
 
 	// check if core requests some change while downloading
 	check_status_change();
@@ -2355,7 +2585,7 @@ int user_io_file_tx(const char* name, unsigned char index, char opensave, char m
 	}
 
 	MenuHide();
-	return 1;
+	return res;
 }
 
 static char cfgstr[1024 * 10] = {};
@@ -2535,6 +2765,7 @@ static uint32_t diskled_timer = 0;
 static uint32_t diskled_is_on = 0;
 void diskled_on()
 {
+	scheduler_io_active();
 	fpga_set_led(1);
 	diskled_timer = GetTimer(50);
 	diskled_is_on = 1;
@@ -2693,10 +2924,12 @@ void user_io_poll()
 	else if ((core_type == CORE_TYPE_8BIT || core_type == CORE_TYPE_ARCHIE) && !is_menu() && !is_minimig())
 	{
 		if (is_st()) tos_poll();
+		sdcache_poll();
 
-		static uint8_t buffer[4][8192];
+		static uint8_t buffer[512];
 		uint32_t lba;
 		uint16_t req_type = 0;
+		uint64_t sd_trace = trace_start();
 		uint16_t c = user_io_sd_get_status(&lba, &req_type);
 		//if(c&3) printf("user_io_sd_get_status: cmd=%02x, lba=%08x\n", c, lba);
 
@@ -2726,11 +2959,9 @@ void user_io_poll()
 
 					if (use_save) menu_process_save();
 
-					buffer_lba[disk] = -1;
-
 					// Fetch sector data from FPGA ...
 					spi_uio_cmd_cont(UIO_SECTOR_WR);
-					spi_block_read(buffer[disk], fio_size);
+					spi_block_read(buffer, fio_size);
 					DisableIO();
 
 					if (sd_image[disk].type == 2 && !lba)
@@ -2739,7 +2970,7 @@ void user_io_poll()
 						if (FileOpenEx(&sd_image[disk], sd_image[disk].path, O_CREAT | O_RDWR | O_SYNC))
 						{
 							diskled_on();
-							if (FileWriteSec(&sd_image[disk], buffer[disk]))
+							if (FileWriteSec(&sd_image[disk], buffer))
 							{
 								sd_image[disk].size = 512;
 							}
@@ -2751,24 +2982,20 @@ void user_io_poll()
 					}
 					else
 					{
-						// ... and write it to disk
+						// ... and write it to disk (through the cache)
 						__off64_t size = sd_image[disk].size>>9;
 						if (size && size>=lba)
 						{
 							diskled_on();
-							if (FileSeekLBA(&sd_image[disk], lba))
+							if (sdcache_write(disk, lba, buffer) && size == lba)
 							{
-								if (FileWriteSec(&sd_image[disk], buffer[disk]))
-								{
-									if (size == lba)
-									{
-										size++;
-										sd_image[disk].size = size << 9;
-									}
-								}
+								size++;
+								sd_image[disk].size = size << 9;
 							}
 						}
 					}
+
+					trace_end(TRACE_SD_SECTOR, sd_trace, lba);
 				}
 			}
 			else if (c & 0x0701)
@@ -2781,70 +3008,50 @@ void user_io_poll()
 				//printf("SD RD %d on %d, WIDE=%d\n", lba, disk, fio_size);
 
 				int done = 0;
-				uint32_t offset;
 
-				if ((buffer_lba[disk] == (uint64_t)-1) || lba < buffer_lba[disk] || lba >(buffer_lba[disk] + 15))
+				if (sd_image[disk].size)
+				{
+					diskled_on();
+					done = sdcache_read(disk, lba, buffer);
+				}
+
+				//Even after error we have to provide the block to the core
+				//Give an empty block.
+				if (!done)
 				{
-					if (sd_image[disk].size)
+					if (sd_image[disk].type == 2)
 					{
-						diskled_on();
-						if (FileSeekLBA(&sd_image[disk], lba))
+						if (is_megacd())
 						{
-							if (FileReadAdv(&sd_image[disk], buffer[disk], sizeof(buffer[disk])))
-							{
-								done = 1;
-							}
+							mcd_fill_blanksave(buffer, lba);
 						}
-					}
-
-					//Even after error we have to provide the block to the core
-					//Give an empty block.
-					if (!done)
-					{
-						if (sd_image[disk].type == 2)
+						else if (is_pce())
 						{
-							if (is_megacd())
-							{
-								mcd_fill_blanksave(buffer[disk], lba);
-							}
-							else if (is_pce())
-							{
-								memset(buffer[disk], 0, sizeof(buffer[disk]));
-								if (!lba)
-								{
-									memcpy(buffer[disk], "HUBM\x00\x88\x10\x80", 8);
-								}
-							}
-							else
+							memset(buffer, 0, sizeof(buffer));
+							if (!lba)
 							{
-								memset(buffer[disk], -1, sizeof(buffer[disk]));
+								memcpy(buffer, "HUBM\x00\x88\x10\x80", 8);
 							}
 						}
 						else
 						{
-							memset(buffer[disk], 0, sizeof(buffer[disk]));
+							memset(buffer, -1, sizeof(buffer));
 						}
 					}
-
-					buffer_lba[disk] = lba;
-					offset = 0;
-				}
-				else
-				{
-					offset = (lba - buffer_lba[disk])*512;
+					else
+					{
+						memset(buffer, 0, sizeof(buffer));
+					}
 				}
 
-					//hexdump(buffer, 32, 0);
+				//hexdump(buffer, 32, 0);
 
-					// data is now stored in buffer. send it to fpga
-					spi_uio_cmd_cont(UIO_SECTOR_RD);
-				spi_block_write(buffer[disk] + offset, fio_size);
-					DisableIO();
+				// data is now stored in buffer. send it to fpga
+				spi_uio_cmd_cont(UIO_SECTOR_RD);
+				spi_block_write(buffer, fio_size);
+				DisableIO();
 
-				if (sd_image[disk].type == 2)
-				{
-					buffer_lba[disk] = -1;
-				}
+				trace_end(TRACE_SD_SECTOR, sd_trace, lba);
 			}
 		}
 	}
@@ -3452,6 +3659,20 @@ void user_io_osd_key_enable(char on)
 	input_switch(-1);
 }
 
+// 1 if user_io_kbd() would only pass the key to the core: OSD closed, no
+// hotkey, no menu key, no emulation mode switch. The input thread sends
+// these itself and leaves the rest to user_io_kbd() in the main loop.
+int user_io_kbd_core_only(uint16_t key, int press)
+{
+	if (!key || is_menu() || osd_is_visible) return 0;
+	if (key == KEY_SYSRQ || key == KEY_SCROLLLOCK || key == KEY_MUTE || key == KEY_VOLUMEDOWN || key == KEY_VOLUMEUP || key == 0xBE || key == 0xBF) return 0;
+	if (!press) return 1;
+	if (key == KEY_MENU || key == KEY_F12) return 0;
+
+	uint32_t code = get_ps2_code(key);
+	return !((code & EMU_SWITCH_1) || ((code & EMU_SWITCH_2) && !use_ps2ctl && !is_archie()));
+}
+
 void user_io_kbd(uint16_t key, int press)
 {
 	if(is_menu()) spi_uio_cmd(UIO_KEYBOARD); //ping the Menu core to wakeup
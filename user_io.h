@@ -213,6 +213,7 @@ uint32_t user_io_get_uart_mode();
 
 void user_io_mouse(unsigned char b, int16_t x, int16_t y, int16_t w);
 void user_io_kbd(uint16_t key, int press);
+int user_io_kbd_core_only(uint16_t key, int press);
 char* user_io_create_config_name();
 int user_io_get_joy_transl();
 void user_io_digital_joystick(unsigned char, uint32_t, int);
@@ -226,12 +227,12 @@ void user_io_set_ini(int ini_num);
 void user_io_send_buttons(char);
 uint16_t user_io_get_sdram_cfg();
 
-int user_io_file_tx(const char* name, unsigned char index = 0, char opensave = 0, char mute = 0, char composite = 0);
+int user_io_file_tx(const char* name, unsigned char index = 0, char opensave = 0, char mute = 0, char composite = 0, uint32_t load_addr = 0);
 int user_io_file_tx_a(const char* name, uint16_t index);
 unsigned char user_io_ext_idx(char *, char*);
 void user_io_set_index(unsigned char index);
 void user_io_set_aindex(uint16_t index);
-void user_io_set_download(unsigned char enable, int addr = 0);
+void user_io_set_download(unsigned char enable, int size = 0);
 void user_io_file_tx_data(const uint8_t *addr, uint16_t len);
 void user_io_set_upload(unsigned char enable, int addr = 0);
 void user_io_file_rx_data(uint8_t *addr, uint16_t len);
@@ -20,6 +20,8 @@
 #include "menu.h"
 #include "video.h"
 #include "input.h"
+#include "coeff_cache.h"
+#include "startup.h"
 
 #include "support.h"
 #include "lib/imlib2/Imlib2.h"
@@ -201,10 +203,46 @@ static void setPLL(double Fout, vmode_custom_t *v)
 static char scaler_flt_cfg[1024] = { 0 };
 static char new_scaler = 0;
 
+static int parseScaler(char *buf, int size, uint16_t *words, int max)
+{
+	char *end = buf + size;
+	char *pos = buf;
+	int phase = 0;
+	int num = 0;
+	while (pos < end)
+	{
+		char *st = pos;
+		while ((pos < end) && *pos && (*pos != 10)) pos++;
+		*pos = 0;
+		while (*st == ' ' || *st == '\t' || *st == 13) st++;
+		if (*st == '#' || *st == ';' || !*st) pos++;
+		else
+		{
+			int c0, c1, c2, c3;
+			int n = sscanf(st, "%d,%d,%d,%d", &c0, &c1, &c2, &c3);
+			if (n == 4 && num + 4 <= max)
+			{
+				//printf("   phase %c-%02d: %4d,%4d,%4d,%4d\n", (phase >= 16) ? 'V' : 'H', phase % 16, c0, c1, c2, c3);
+				//printf("%03X: %03X %03X %03X %03X;\n",phase*4, c0 & 0x1FF, c1 & 0x1FF, c2 & 0x1FF, c3 & 0x1FF);
+
+				words[num++] = (c0 & 0x1FF) | (((phase * 4) + 0) << 9);
+				words[num++] = (c1 & 0x1FF) | (((phase * 4) + 1) << 9);
+				words[num++] = (c2 & 0x1FF) | (((phase * 4) + 2) << 9);
+				words[num++] = (c3 & 0x1FF) | (((phase * 4) + 3) << 9);
+
+				phase++;
+				if (phase >= 32) break;
+			}
+		}
+	}
+
+	return num;
+}
+
 static void setScaler()
 {
-	fileTYPE f = {};
 	static char filename[1024];
+	static uint16_t coeff[32 * 4];
 
 	uint32_t arc[4] = {};
 	for (int i = 0; i < 2; i++)
@@ -234,52 +272,13 @@ static void setScaler()
 	DisableIO();
 	sprintf(filename, COEFF_DIR"/%s", scaler_flt_cfg + 1);
 
-	if (FileOpen(&f, filename))
+	int num = coeff_load(filename, parseScaler, coeff, sizeof(coeff) / sizeof(coeff[0]));
+	if (num >= 0)
 	{
 		//printf("Read scaler coefficients\n");
-		char *buf = (char*)malloc(f.size+1);
-		if (buf)
-		{
-			memset(buf, 0, f.size + 1);
-			int size;
-			if ((size = FileReadAdv(&f, buf, f.size)))
-			{
-				spi_uio_cmd_cont(UIO_SET_FLTCOEF);
-
-				char *end = buf + size;
-				char *pos = buf;
-				int phase = 0;
-				while (pos < end)
-				{
-					char *st = pos;
-					while ((pos < end) && *pos && (*pos != 10)) pos++;
-					*pos = 0;
-					while (*st == ' ' || *st == '\t' || *st == 13) st++;
-					if (*st == '#' || *st == ';' || !*st) pos++;
-					else
-					{
-						int c0, c1, c2, c3;
-						int n = sscanf(st, "%d,%d,%d,%d", &c0, &c1, &c2, &c3);
-						if (n == 4)
-						{
-							//printf("   phase %c-%02d: %4d,%4d,%4d,%4d\n", (phase >= 16) ? 'V' : 'H', phase % 16, c0, c1, c2, c3);
-							//printf("%03X: %03X %03X %03X %03X;\n",phase*4, c0 & 0x1FF, c1 & 0x1FF, c2 & 0x1FF, c3 & 0x1FF);
-
-							spi_w((c0 & 0x1FF) | (((phase * 4) + 0) << 9));
-							spi_w((c1 & 0x1FF) | (((phase * 4) + 1) << 9));
-							spi_w((c2 & 0x1FF) | (((phase * 4) + 2) << 9));
-							spi_w((c3 & 0x1FF) | (((phase * 4) + 3) << 9));
-
-							phase++;
-							if (phase >= 32) break;
-						}
-					}
-				}
-				DisableIO();
-			}
-
-			free(buf);
-		}
+		spi_uio_cmd_cont(UIO_SET_FLTCOEF);
+		fpga_spi_fast_block_write(coeff, num);
+		DisableIO();
 	}
 }
 
@@ -328,10 +327,49 @@ static void loadScalerCfg()
 static char gamma_cfg[1024] = { 0 };
 static char has_gamma = 0;
 
+static int parseGamma(char *buf, int size, uint16_t *words, int max)
+{
+	char *end = buf + size;
+	char *pos = buf;
+	int index = 0;
+	int num = 0;
+	while (pos < end)
+	{
+		char *st = pos;
+		while ((pos < end) && *pos && (*pos != 10)) pos++;
+		*pos = 0;
+		while (*st == ' ' || *st == '\t' || *st == 13) st++;
+		if (*st == '#' || *st == ';' || !*st) pos++;
+		else
+		{
+			int c0, c1, c2;
+			int n = sscanf(st, "%d,%d,%d", &c0, &c1, &c2);
+			if (n == 1)
+			{
+				c1 = c0;
+				c2 = c0;
+				n = 3;
+			}
+
+			if (n == 3 && num + 3 <= max)
+			{
+				words[num++] = (index << 8) | (c0 & 0xFF);
+				words[num++] = (index << 8) | (c1 & 0xFF);
+				words[num++] = (index << 8) | (c2 & 0xFF);
+
+				index++;
+				if (index >= 256) break;
+			}
+		}
+	}
+
+	return num;
+}
+
 static void setGamma()
 {
-	fileTYPE f = {};
 	static char filename[1024];
+	static uint16_t curve[256 * 3];
 
 	if (!spi_uio_cmd_cont(UIO_SET_GAMMA))
 	{
@@ -344,55 +382,13 @@ static void setGamma()
 	DisableIO();
 	sprintf(filename, GAMMA_DIR"/%s", gamma_cfg + 1);
 
-	if (FileOpen(&f, filename))
+	int num = coeff_load(filename, parseGamma, curve, sizeof(curve) / sizeof(curve[0]));
+	if (num >= 0)
 	{
-		char *buf = (char*)malloc(f.size+1);
-		if (buf)
-		{
-			memset(buf, 0, f.size + 1);
-			int size;
-			if ((size = FileReadAdv(&f, buf, f.size)))
-			{
-				spi_uio_cmd_cont(UIO_SET_GAMCURV);
-
-				char *end = buf + size;
-				char *pos = buf;
-				int index = 0;
-				while (pos < end)
-				{
-					char *st = pos;
-					while ((pos < end) && *pos && (*pos != 10)) pos++;
-					*pos = 0;
-					while (*st == ' ' || *st == '\t' || *st == 13) st++;
-					if (*st == '#' || *st == ';' || !*st) pos++;
-					else
-					{
-						int c0, c1, c2;
-						int n = sscanf(st, "%d,%d,%d", &c0, &c1, &c2);
-						if (n == 1)
-						{
-							c1 = c0;
-							c2 = c0;
-							n = 3;
-						}
-
-						if (n == 3)
-						{
-							spi_w((index << 8) | (c0 & 0xFF));
-							spi_w((index << 8) | (c1 & 0xFF));
-							spi_w((index << 8) | (c2 & 0xFF));
-
-							index++;
-							if (index >= 256) break;
-						}
-					}
-				}
-				DisableIO();
-				spi_uio_cmd8(UIO_SET_GAMMA, gamma_cfg[0]);
-			}
-
-			free(buf);
-		}
+		spi_uio_cmd_cont(UIO_SET_GAMCURV);
+		fpga_spi_fast_block_write(curve, num);
+		DisableIO();
+		spi_uio_cmd8(UIO_SET_GAMMA, gamma_cfg[0]);
 	}
 }
 int video_get_gamma_en()
@@ -1166,6 +1162,61 @@ static Imlib_Image load_bg()
 
 static int bg_has_picture = 0;
 extern uint8_t  _binary_logo_png_start[], _binary_logo_png_end[];
+
+static Imlib_Image logo = 0;
+static Imlib_Image menubg = 0;
+
+static Imlib_Image load_logo(int retry)
+{
+	Imlib_Image img = 0;
+	Imlib_Load_Error error;
+
+	unlink("/tmp/logo.png");
+	if (FileSave("/tmp/logo.png", _binary_logo_png_start, _binary_logo_png_end - _binary_logo_png_start))
+	{
+		while(1)
+		{
+			error = IMLIB_LOAD_ERROR_NONE;
+			if ((img = imlib_load_image_with_error_return("/tmp/logo.png", &error))) break;
+			else
+			{
+				if (error != IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT || !retry)
+				{
+					printf("logo.png error = %d\n", error);
+					break;
+				}
+			}
+			vs_wait();
+		};
+	}
+	else
+	{
+		printf("Fail to save to /tmp/logo.png\n");
+	}
+	unlink("/tmp/logo.png");
+	printf("Logo = %p\n", img);
+	return img;
+}
+
+// the logo is the same for every core, so the host process of a fast core
+// switch decodes it once (with imlib's loaders) before forking the cores.
+void video_logo_preload()
+{
+	if (!logo) logo = load_logo(0);
+}
+
+// startup step: decode the images on a worker while the core is set up.
+// Only imlib and file_io calls here, nothing touches the FPGA.
+// The wallpaper is only decoded if the saved menu mode shows it.
+void video_menu_bg_preload()
+{
+	video_logo_preload();
+
+	uint32_t status[2] = { 0, 0 };
+	if (!FileLoadConfig("MENU.CFG", status, 8) || ((status[0] >> 1) & 7) != 1) return;
+	if (!menubg) menubg = load_bg();
+}
+
 void video_menu_bg(int n, int idle)
 {
 	bg_has_picture = 0;
@@ -1175,45 +1226,22 @@ void video_menu_bg(int n, int idle)
 		printf("**** BG DEBUG START ****\n");
 		printf("n = %d\n", n);
 
-		Imlib_Load_Error error;
-		static Imlib_Image logo = 0;
-		if (!logo)
+		startup_wait("menu_bg");
+
+		static int logo_rotated = 0;
+		if (!logo) logo = load_logo(1);
+		if (logo && !logo_rotated)
 		{
-			unlink("/tmp/logo.png");
-			if (FileSave("/tmp/logo.png", _binary_logo_png_start, _binary_logo_png_end - _binary_logo_png_start))
-			{
-				while(1)
-				{
-					error = IMLIB_LOAD_ERROR_NONE;
-					if ((logo = imlib_load_image_with_error_return("/tmp/logo.png", &error))) break;
-					else
-					{
-						if (error != IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT)
-						{
-							printf("logo.png error = %d\n", error);
-							break;
-						}
-					}
-					vs_wait();
-				};
-
-				if (cfg.osd_rotate)
-				{
-					imlib_context_set_image(logo);
-					imlib_image_orientate(cfg.osd_rotate == 1 ? 3 : 1);
-				}
-			}
-			else
+			logo_rotated = 1;
+			if (cfg.osd_rotate)
 			{
-				printf("Fail to save to /tmp/logo.png\n");
+				imlib_context_set_image(logo);
+				imlib_image_orientate(cfg.osd_rotate == 1 ? 3 : 1);
 			}
-			unlink("/tmp/logo.png");
-			printf("Logo = %p\n", logo);
 		}
 
 		menu_bgn = (menu_bgn == 1) ? 2 : 1;
 
-		static Imlib_Image menubg = 0;
 		static Imlib_Image bg1 = 0, bg2 = 0;
 		if (!bg1) bg1 = imlib_create_image_using_data(fb_width, fb_height, (uint32_t*)(fb_base + (FB_SIZE * 1)));
 		if (!bg1) printf("Warning: bg1 is 0\n");
@@ -1240,6 +1268,13 @@ void video_menu_bg(int n, int idle)
 
 		draw_black();
 
+		if (n != 1 && menubg)
+		{
+			imlib_context_set_image(menubg);
+			imlib_free_image();
+			menubg = 0;
+		}
+
 		switch (n)
 		{
 		case 1:
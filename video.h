@@ -19,6 +19,8 @@ int   hasAPI1_5();
 void video_fb_enable(int enable, int n = 0);
 int video_fb_state();
 void video_menu_bg(int n, int idle = 0);
+void video_menu_bg_preload();
+void video_logo_preload();
 int video_bg_has_picture();
 int video_chvt(int num);
 void video_cmd(char *cmd);